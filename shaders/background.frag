@@ -0,0 +1,13 @@
+#version 450
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+// the cached background, the whole image covers the viewport
+layout(set = 0, binding = 0) uniform sampler2D background;
+
+void main() 
+{
+	outFragColor = texture(background, inUV);
+}
@@ -0,0 +1,17 @@
+#version 450
+
+layout (location = 0) out vec2 outUV;
+
+layout(push_constant) uniform constants
+{
+	// part of the image the viewport shows
+	vec2 uvScale;
+} PushConstants;
+
+void main() 
+{
+	// one triangle over the whole viewport, on the far plane of the reverse-Z depth
+	vec2 position = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+	outUV = position * PushConstants.uvScale;
+}
@@ -0,0 +1,20 @@
+// Tiles of the draw image the background effect runs on, listed by background_tiles.comp.
+// The header is also the indirect dispatch over them, one workgroup per tile.
+#define BACKGROUND_TILE_SIZE 16
+
+layout(buffer_reference, std430) buffer BackgroundTiles {
+	uint groupCountX;
+	uint groupCountY;
+	uint groupCountZ;
+	uint pad;
+	uvec2 tiles[];
+};
+
+// Texel of the invocation, the tile list is only dispatched over when useTiles is set
+ivec2 background_texel(uint useTiles, BackgroundTiles tileBuffer)
+{
+	if (useTiles == 0) {
+		return ivec2(gl_GlobalInvocationID.xy);
+	}
+	return ivec2(tileBuffer.tiles[gl_WorkGroupID.x] * BACKGROUND_TILE_SIZE + gl_LocalInvocationID.xy);
+}
@@ -0,0 +1,97 @@
+// Shared by the culling compute shaders
+
+#include "object_data.glsl"
+
+// hierarchical depth of the objects drawn in the first phase
+layout(set = 0, binding = 0) uniform sampler2D depthPyramid;
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand {
+	uint indexCount;
+	uint instanceCount;
+	uint firstIndex;
+	int vertexOffset;
+	uint firstInstance;
+};
+
+struct CullObject {
+	uint indexCount;
+	uint firstIndex;
+	// index into the object data and visibility buffers
+	uint objectIndex;
+	// start of the object in the expanded index buffer, ~0 when it is drawn without meshlets
+	uint expandedFirstIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer CullObjectBuffer{ 
+	CullObject objects[];
+};
+
+layout(buffer_reference, std430) buffer CullStatsBuffer{ 
+	uint occludedCount;
+	uint visibleCount;
+	uint triangleCount;
+	uint culledMeshlets;
+};
+
+// culling phases, match the engine constants
+#define CULL_PHASE_PREVIOUS 0
+#define CULL_PHASE_RETEST 1
+#define CULL_PHASE_SINGLE 2
+
+#define NO_EXPANSION 0xffffffffu
+
+// True when the box is entirely outside one of the side planes of the view
+bool is_outside_frustum(mat4 matrix, vec3 origin, vec3 extents)
+{
+	bvec4 outside = bvec4(true);
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = matrix * vec4(origin + corner * extents, 1.0);
+
+		outside = outside && bvec4(clip.x < -clip.w, clip.x > clip.w, clip.y < -clip.w, clip.y > clip.w);
+	}
+	return any(outside);
+}
+
+// True when the box is behind the depth in the pyramid everywhere it covers
+bool is_occluded(mat4 matrix, vec3 origin, vec3 extents)
+{
+	vec2 uvMin = vec2(1.0);
+	vec2 uvMax = vec2(0.0);
+	float nearestDepth = 0.0;
+
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = matrix * vec4(origin + corner * extents, 1.0);
+
+		// the box crosses the camera plane, nothing in front of it can hide it
+		if (clip.w <= 0.0) {
+			return false;
+		}
+
+		vec3 ndc = clip.xyz / clip.w;
+		uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+		uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+		// reverse depth, the nearest point has the largest value
+		nearestDepth = max(nearestDepth, ndc.z);
+	}
+
+	uvMin = clamp(uvMin, vec2(0.0), vec2(1.0));
+	uvMax = clamp(uvMax, vec2(0.0), vec2(1.0));
+
+	// pick the level where the box covers at most 2x2 texels
+	vec2 size = (uvMax - uvMin) * vec2(textureSize(depthPyramid, 0));
+	int level = int(ceil(log2(max(max(size.x, size.y), 1.0))));
+	level = min(level, textureQueryLevels(depthPyramid) - 1);
+
+	ivec2 levelSize = textureSize(depthPyramid, level);
+	ivec2 texMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+	ivec2 texMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+	float farthest = min(
+		min(texelFetch(depthPyramid, texMin, level).r, texelFetch(depthPyramid, ivec2(texMax.x, texMin.y), level).r),
+		min(texelFetch(depthPyramid, ivec2(texMin.x, texMax.y), level).r, texelFetch(depthPyramid, texMax, level).r));
+
+	return nearestDepth < farthest;
+}
@@ -0,0 +1,49 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "input_structures.glsl"
+#include "object_data.glsl"
+
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+}; 
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
+	Vertex vertices[];
+};
+
+// object index of every instance drawn this frame
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	uint objectIndices[];
+};
+
+//push constants block, same as mesh.vert
+layout( push_constant ) uniform constants
+{
+	VertexBuffer vertexBuffer;
+	InstanceBuffer instanceBuffer;
+	ObjectDataBuffer objectBuffer;
+} PushConstants;
+
+// must match mesh.vert so the main pass can depth test against the pre-pass
+invariant gl_Position;
+
+void main() 
+{
+	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	uint objectIndex = PushConstants.instanceBuffer.objectIndices[gl_InstanceIndex];
+	mat4 render_matrix = object_transform(PushConstants.objectBuffer.objects[objectIndex]);
+	
+	vec4 position = vec4(v.position, 1.0f);
+
+	// same two steps as mesh.vert, invariance only holds for identical expressions
+	vec4 worldPos = render_matrix * position;
+	gl_Position =  sceneData.viewproj * worldPos;
+}
@@ -1,3 +1,8 @@
+#include "lights.glsl"
+
+// must match tv_types.h
+#define SHADOW_CASCADES 4
+
 layout(set = 0, binding = 0) uniform  SceneData{   
 
 	mat4 view;
@@ -6,8 +11,22 @@ layout(set = 0, binding = 0) uniform  SceneData{
 	vec4 ambientColor;
 	vec4 sunlightDirection; //w for sun power
 	vec4 sunlightColor;
+	// world to shadow map of every cascade
+	mat4 shadowMatrices[SHADOW_CASCADES];
+	// view depth each cascade ends at
+	vec4 cascadeSplits;
+	// world size of a shadow map texel of each cascade
+	vec4 cascadeTexelSizes;
+	// xy draw extent, z and w scale and bias of the cluster slice of a log depth
+	vec4 clusterParams;
+	uint lightCount;
+	LightBuffer lightBuffer;
+	ClusterBuffer clusterBuffer;
 } sceneData;
 
+// a layer per cascade, reverse-Z depth from the sun
+layout(set = 0, binding = 1) uniform sampler2DArrayShadow shadowMap;
+
 layout(set = 1, binding = 0) uniform GLTFMaterialData{   
 
 	vec4 colorFactors;
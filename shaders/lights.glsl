@@ -0,0 +1,43 @@
+// Clustered lights, the constants and layouts must match tv_lights.h
+
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+// lights past this in a cluster are dropped, it bounds the cost of a fragment
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+struct Light {
+	// world position, w range
+	vec4 positionRange;
+	// rgb color, w intensity
+	vec4 colorIntensity;
+	// xyz direction the light points to, w cosine of the outer cone, -1 for point lights
+	vec4 spotDirection;
+	// x cosine of the inner cone
+	vec4 spotParams;
+};
+
+layout(buffer_reference, std430) readonly buffer LightBuffer{
+	Light lights[];
+};
+
+// every cluster has MAX_LIGHTS_PER_CLUSTER slots of light indices after the counts
+layout(buffer_reference, std430) buffer ClusterBuffer{
+	uint counts[CLUSTER_COUNT];
+	uint indices[];
+};
+
+// Slice of a view space depth, the slices get exponentially thicker with the distance
+uint cluster_slice(float viewDepth, float sliceScale, float sliceBias)
+{
+	return uint(clamp(floor(log(viewDepth) * sliceScale + sliceBias), 0.0, float(CLUSTER_Z - 1)));
+}
+
+// Falls to zero at the range with a smooth edge, inverse square before that
+float light_attenuation(float distance, float range)
+{
+	float ratio = distance / range;
+	float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+	return window * window / (distance * distance + 1.0);
+}
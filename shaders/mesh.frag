@@ -1,20 +1,75 @@
 #version 450
 
 #extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
 #include "input_structures.glsl"
 
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inUV;
+layout (location = 3) in vec3 inWorldPos;
 
 layout (location = 0) out vec4 outFragColor;
 
+// Diffuse light of the point and spot lights assigned to the cluster of the fragment
+vec3 cluster_lights(vec3 normal, float viewDepth)
+{
+	vec3 light = vec3(0.0);
+	if (sceneData.lightCount == 0) {
+		return light;
+	}
+
+	uvec2 tile = uvec2(clamp(gl_FragCoord.xy / sceneData.clusterParams.xy * vec2(CLUSTER_X, CLUSTER_Y),
+		vec2(0.0), vec2(CLUSTER_X - 1, CLUSTER_Y - 1)));
+	uint slice = cluster_slice(max(viewDepth, 1e-4), sceneData.clusterParams.z, sceneData.clusterParams.w);
+	uint cluster = tile.x + tile.y * CLUSTER_X + slice * CLUSTER_X * CLUSTER_Y;
+
+	uint count = sceneData.clusterBuffer.counts[cluster];
+	for (uint i = 0; i < count; i++) {
+		Light l = sceneData.lightBuffer.lights[sceneData.clusterBuffer.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i]];
+
+		vec3 toLight = l.positionRange.xyz - inWorldPos;
+		float distance = length(toLight);
+		vec3 direction = toLight / max(distance, 1e-4);
+
+		float attenuation = light_attenuation(distance, l.positionRange.w);
+		if (l.spotDirection.w > -1.0) {
+			attenuation *= smoothstep(l.spotDirection.w, l.spotParams.x, dot(-direction, l.spotDirection.xyz));
+		}
+
+		light += l.colorIntensity.rgb * l.colorIntensity.w * attenuation * max(dot(normal, direction), 0.0);
+	}
+	return light;
+}
+
+// How much of the sun reaches the fragment, everything past the last cascade is lit
+float sun_shadow(vec3 normal, float viewDepth)
+{
+	uint cascade = 0;
+	while (cascade < SHADOW_CASCADES && viewDepth > sceneData.cascadeSplits[cascade]) {
+		cascade++;
+	}
+	if (cascade == SHADOW_CASCADES) {
+		return 1.0;
+	}
+
+	// moving out along the normal by about a texel keeps surfaces from shadowing themselves
+	vec3 position = inWorldPos + normal * sceneData.cascadeTexelSizes[cascade] * 1.5;
+	vec4 shadowPos = sceneData.shadowMatrices[cascade] * vec4(position, 1.0);
+
+	// the sampler compares and filters the four nearest texels
+	return texture(shadowMap, vec4(shadowPos.xy * 0.5 + 0.5, cascade, shadowPos.z));
+}
+
 void main() 
 {
-	float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz), 0.1f);
+	vec3 normal = normalize(inNormal);
+	float viewDepth = -(sceneData.view * vec4(inWorldPos, 1.0)).z;
+
+	float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz) * sun_shadow(normal, viewDepth), 0.1f);
 
 	vec3 color = inColor * texture(colorTex,inUV).xyz;
 	vec3 ambient = color *  sceneData.ambientColor.xyz;
 
-	outFragColor = vec4(color * lightValue *  sceneData.sunlightColor.w + ambient ,1.0f);
-}
\ No newline at end of file
+	outFragColor = vec4(color * lightValue *  sceneData.sunlightColor.w + color * cluster_lights(normal, viewDepth) + ambient ,1.0f);
+}
@@ -4,10 +4,12 @@
 #extension GL_EXT_buffer_reference : require
 
 #include "input_structures.glsl"
+#include "object_data.glsl"
 
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec2 outUV;
+layout (location = 3) out vec3 outWorldPos;
 
 struct Vertex {
 
@@ -22,22 +24,35 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer{
 	Vertex vertices[];
 };
 
+// object index of every instance drawn this frame
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	uint objectIndices[];
+};
+
 //push constants block
 layout( push_constant ) uniform constants
 {
-	mat4 render_matrix;
 	VertexBuffer vertexBuffer;
+	InstanceBuffer instanceBuffer;
+	ObjectDataBuffer objectBuffer;
 } PushConstants;
 
+// the depth pre-pass must produce bit-identical depth
+invariant gl_Position;
+
 void main() 
 {
 	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	uint objectIndex = PushConstants.instanceBuffer.objectIndices[gl_InstanceIndex];
+	mat4 render_matrix = object_transform(PushConstants.objectBuffer.objects[objectIndex]);
 	
 	vec4 position = vec4(v.position, 1.0f);
 
-	gl_Position =  sceneData.viewproj * PushConstants.render_matrix *position;
+	vec4 worldPos = render_matrix * position;
+	gl_Position =  sceneData.viewproj * worldPos;
+	outWorldPos = worldPos.xyz;
 
-	outNormal = (PushConstants.render_matrix * vec4(v.normal, 0.f)).xyz;
+	outNormal = (render_matrix * vec4(v.normal, 0.f)).xyz;
 	outColor = v.color.xyz * materialData.colorFactors.xyz;	
 	outUV.x = v.uv_x;
 	outUV.y = v.uv_y;
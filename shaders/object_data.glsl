@@ -0,0 +1,19 @@
+// Persistent per-object data, indexed by object and updated by object_scatter.comp
+
+struct ObjectData {
+	// rows of the 3x4 object to world transform
+	vec4 transformRows[3];
+	// mesh space bounds, xyz origin and w sphere radius
+	vec4 boundsSphere;
+	vec3 boundsExtents;
+	uint materialIndex;
+};
+
+layout(buffer_reference, std430) readonly buffer ObjectDataBuffer{ 
+	ObjectData objects[];
+};
+
+mat4 object_transform(ObjectData object)
+{
+	return transpose(mat4(object.transformRows[0], object.transformRows[1], object.transformRows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
@@ -0,0 +1,43 @@
+#version 450
+
+#extension GL_GOOGLE_include_directive : require
+#extension GL_EXT_buffer_reference : require
+
+#include "object_data.glsl"
+
+struct Vertex {
+
+	vec3 position;
+	float uv_x;
+	vec3 normal;
+	float uv_y;
+	vec4 color;
+}; 
+
+layout(buffer_reference, std430) readonly buffer VertexBuffer{ 
+	Vertex vertices[];
+};
+
+// object index of every instance of the cascade
+layout(buffer_reference, std430) readonly buffer InstanceBuffer{ 
+	uint objectIndices[];
+};
+
+//push constants block
+layout( push_constant ) uniform constants
+{
+	// world to the shadow map of the cascade
+	mat4 viewproj;
+	VertexBuffer vertexBuffer;
+	InstanceBuffer instanceBuffer;
+	ObjectDataBuffer objectBuffer;
+} PushConstants;
+
+void main() 
+{
+	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	uint objectIndex = PushConstants.instanceBuffer.objectIndices[gl_InstanceIndex];
+	mat4 render_matrix = object_transform(PushConstants.objectBuffer.objects[objectIndex]);
+
+	gl_Position = PushConstants.viewproj * render_matrix * vec4(v.position, 1.0f);
+}
@@ -0,0 +1,112 @@
+/*
+	Background cache: the background effect is rendered into an image of its own only when
+	the effect, its push constants or its pipeline change. The geometry pass then draws it
+	as a full screen triangle on the far plane, so only the pixels the opaque surfaces left
+	empty are shaded.
+	For effects that change every frame the image can instead be rendered after the opaque
+	surfaces, only on the tiles where some of the depth is still cleared.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+#include "tv_descriptors.h"
+#include "tv_render_graph.h"
+
+class TinyVulkan;
+struct ComputeEffect;
+
+// Where the background effect is rendered
+enum class BackgroundMode {
+	// over the whole draw image before the geometry, or on the compute queue
+	EveryFrame,
+	// into the cache when it changes
+	Cached,
+	// every frame after the opaque surfaces, on the tiles they left uncovered
+	Uncovered,
+};
+
+class BackgroundCache {
+public:
+	// Queues the pipeline compile on the engine registry, call before its wait()
+	void init(TinyVulkan* engine);
+	void destroy();
+
+	/*
+		Imports the cached image into graph. Returns true when it does not hold effect yet,
+		the caller then has to render effect into it with a pass writing the image and using
+		target(). The image is taken as holding effect from then on.
+	*/
+	bool import(RenderGraph& graph, uint32_t effectIndex, const ComputeEffect& effect, RGImage& image);
+
+	/*
+		Imports the image for the Uncovered mode, at the size of the draw image whatever
+		halfResolution says. Its texels match the pixels of the draw image.
+	*/
+	RGImage import_uncovered(RenderGraph& graph);
+
+	// Storage image set of the cached image for this frame, for the effect layout
+	DescriptorHandle target();
+	VkExtent2D extent() const { return { _image.imageExtent.width, _image.imageExtent.height }; }
+
+	/*
+		Lists the tiles of extent with a pixel the depth image was not drawn to into tiles(),
+		with the dispatch over them in front. The pass has to read the depth image as Sampled.
+	*/
+	void classify_tiles(VkCommandBuffer cmd, VkExtent2D extent);
+	const AllocatedBuffer& tiles() const { return _tiles; }
+
+	/*
+		Draws the source part of the image over viewport inside a rendering with the draw and
+		depth images, where the depth is still cleared. The pass has to read the image as Sampled.
+	*/
+	void draw(VkCommandBuffer cmd, VkExtent2D viewport, VkExtent2D source);
+
+	struct Stats {
+		uint32_t renders;
+		// frames that drew the cached image without rendering it
+		uint32_t reused;
+	};
+	Stats stats{};
+
+	// Renders the effect at half the size of the draw image, the draw filters it back up
+	bool halfResolution{ false };
+private:
+	// What the cached image was rendered with
+	struct Key {
+		uint32_t effectIndex;
+		VkPipeline pipeline;
+		ComputePushConstants pushConstants;
+	};
+
+	// Must match background_tiles.comp
+	struct TilePushConstants {
+		VkDeviceAddress tileBuffer;
+		glm::ivec2 extent;
+	};
+
+	// Recreates the image when it is not at the size half asks for
+	void resize(bool half);
+	void create_image();
+
+	TinyVulkan* _engine;
+
+	AllocatedImage _image{};
+	bool _halfImage{ false };
+	VkSampler _sampler;
+
+	VkDescriptorSetLayout _drawDescriptorLayout;
+	DescriptorTemplate _drawTemplate;
+	VkPipelineLayout _drawPipelineLayout;
+	VkPipeline _drawPipeline;
+
+	AllocatedBuffer _tiles{};
+	VkSampler _depthSampler;
+	VkDescriptorSetLayout _tileDescriptorLayout;
+	DescriptorTemplate _tileTemplate;
+	VkPipelineLayout _tilePipelineLayout;
+	VkPipeline _tilePipeline;
+
+	Key _key{};
+	bool _valid{ false };
+};
@@ -0,0 +1,67 @@
+/*
+	Deferred destruction of GPU objects: handles are kept in one array per type, tagged with
+	the timeline value after which the GPU no longer uses them, and destroyed in batches once
+	the timeline gets there. Once the arrays have grown the frame loop does not allocate.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+class MemoryTracker;
+
+class DeletionQueue {
+public:
+	void init(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker);
+
+	/*
+		Objects pushed from now on are destroyed once the timeline reaches value, normally the
+		one the submit of the frame being recorded signals. Values must not go down.
+	*/
+	void set_release_value(uint64_t value) { _releaseValue = value; }
+
+	void push_buffer(const AllocatedBuffer& buffer);
+	void push_image(const AllocatedImage& image);
+	// Views and images without memory of their own, and the memory such images are bound to
+	void push_image_view(VkImageView view);
+	void push_raw_image(VkImage image);
+	void push_memory(VmaAllocation allocation);
+
+	// Destroys everything released at or before completedValue, views first and memory last
+	void collect(uint64_t completedValue);
+	// Destroys everything, the device has to be idle
+	void flush();
+
+	struct Stats {
+		// still waiting on the GPU
+		uint32_t buffers;
+		uint32_t images;
+		uint32_t imageViews;
+		uint32_t memoryBlocks;
+		// destroyed by the last collect
+		uint32_t lastDestroyed;
+		uint64_t totalDestroyed;
+	};
+	Stats stats{};
+private:
+	template<typename T>
+	struct Entry {
+		T handle;
+		uint64_t releaseValue;
+	};
+
+	// Calls destroy on the leading entries released at or before completedValue and drops them
+	template<typename T, typename F>
+	uint32_t destroy_until(std::vector<Entry<T>>& entries, uint64_t completedValue, F&& destroy);
+	void update_stats();
+
+	VkDevice _device;
+	VmaAllocator _allocator;
+	MemoryTracker* _tracker;
+	uint64_t _releaseValue{ 0 };
+
+	std::vector<Entry<VkImageView>> _imageViews;
+	std::vector<Entry<AllocatedImage>> _images;
+	std::vector<Entry<VkImage>> _rawImages;
+	std::vector<Entry<AllocatedBuffer>> _buffers;
+	std::vector<Entry<VmaAllocation>> _memory;
+};
@@ -5,21 +5,50 @@
 
 #include <tv_types.h>
 
+#include <mutex>
+#include <thread>
+
+class MemoryTracker;
+enum class MemoryCategory : uint32_t;
+
+// One descriptor as the writers store it and the update templates read it
+union DescriptorInfo {
+    VkDescriptorImageInfo image;
+    VkDescriptorBufferInfo buffer;
+};
+static_assert(sizeof(DescriptorInfo) == sizeof(VkDescriptorImageInfo) && sizeof(DescriptorInfo) == sizeof(VkDescriptorBufferInfo),
+    "the infos of a write are read as a plain array");
+
+// Update template of a set layout, fed by a DescriptorWriter
+struct DescriptorTemplate {
+    VkDescriptorUpdateTemplate handle{ VK_NULL_HANDLE };
+    // descriptors of all the bindings, the writer has to fill every one
+    uint32_t descriptorCount{ 0 };
+
+    void destroy(VkDevice device);
+};
+
 // Abstraction to build a DescriptorSet
 struct DescriptorLayoutBuilder 
 {
 
     std::vector<VkDescriptorSetLayoutBinding> bindings;
 
-    // Add a DescriptorSetLayoutBinding
-    void add_binding(uint32_t binding, VkDescriptorType type);
+    // Add a DescriptorSetLayoutBinding, count > 1 makes it an array
+    void add_binding(uint32_t binding, VkDescriptorType type, uint32_t count = 1);
     // Clear all bindings
     void clear();
     // Create the VkDescriptorSetLayout
     VkDescriptorSetLayout build(VkDevice device, VkShaderStageFlags shaderStages, void* pNext = nullptr, VkDescriptorSetLayoutCreateFlags flags = 0);
+    // Creates the update template of layout, built from these bindings. Writes then go in binding order
+    DescriptorTemplate build_template(VkDevice device, VkDescriptorSetLayout layout) const;
 };
 
-// Abstraction to allocate a VkDescriptorSet from a VkDescriptorPool
+/*
+    Abstraction to allocate a VkDescriptorSet from a VkDescriptorPool. Every thread allocating
+    takes pools into a chain of its own, so threads only meet when they need another pool.
+    Clearing resets all the pools and hands them back for any thread to take.
+*/
 struct DescriptorAllocator {
 public:
     // Size of the VkDescriptorPool
@@ -28,40 +57,170 @@ public:
         float ratio;
     };
 
+    // Counts since the last clear
+    struct Stats {
+        uint32_t setsAllocated;
+        uint32_t poolsCreated;
+        // allocations that found their pool full and went on to the next
+        uint32_t outOfPoolRetries;
+        uint32_t pools;
+        uint32_t threads;
+    };
+
     // Creates the VkDescriptorPool according to the PoolSizeRatio
     void init_pool(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios);
-    // Does not delete the VkDescriptorPool, only the sets and resets the pool
+    // Does not delete the VkDescriptorPool, only the sets and resets the pool. No thread may be allocating
     void clear_descriptors(VkDevice device);
     // Destroys the VkDescriptorPool
     void destroy_pools(VkDevice device);
-    // Allocates VkDescriptorSet(s) from the pool
+    // Allocates VkDescriptorSet(s) from the pools of the calling thread
     VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout, void* pNext = nullptr);
+    // Sums over the threads, no thread may be allocating
+    Stats stats();
 private:
-    // Gets pool from readyPools, otherwise creates a new one
-    VkDescriptorPool get_pool(VkDevice device);
+    // Pools one thread allocates from
+    struct Chain {
+        std::thread::id thread;
+        // Unusable pools
+        std::vector<VkDescriptorPool> fullPools;
+        // Usable pools
+        std::vector<VkDescriptorPool> readyPools;
+        uint32_t setsAllocated;
+        uint32_t retries;
+    };
+
+    // Chains a thread used last, so finding its own does not lock
+    struct ChainSlot {
+        uint32_t allocator;
+        Chain* chain;
+    };
+    static constexpr uint32_t CHAIN_SLOTS = 8;
+    static thread_local ChainSlot threadChains[CHAIN_SLOTS];
+    static thread_local uint32_t nextChainSlot;
+
+    Chain& thread_chain();
+    // Gets a pool from the chain, otherwise from the free pools or a new one
+    VkDescriptorPool get_pool(VkDevice device, Chain& chain);
     VkDescriptorPool create_pool(VkDevice device, uint32_t setCount, std::span<PoolSizeRatio> poolRatios);
 
     std::vector<PoolSizeRatio> ratios;
-    // Unusable pools
-    std::vector<VkDescriptorPool> fullPools;
-    // Usable pools
-    std::vector<VkDescriptorPool> readyPools;
+    // Reset pools no chain has taken
+    std::vector<VkDescriptorPool> freePools;
     uint32_t setsPerPool;
+    uint32_t poolsCreated{ 0 };
+    uint32_t poolCount{ 0 };
 
+    // node based, threads keep pointers to their chains while others are added
+    std::deque<Chain> chains;
+    // guards the chains, freePools and the pool growth
+    std::mutex mutex;
+    // new on every init_pool, tells the allocators apart in threadChains
+    uint32_t id{ 0 };
 };
 
-// Abstraction for writing descriptor set objects
+// Abstraction for writing descriptor set objects, kept in fixed storage so writing does not allocate
 struct DescriptorWriter {
-    std::deque<VkDescriptorImageInfo> imageInfos;
-    std::deque<VkDescriptorBufferInfo> bufferInfos;
-    std::vector<VkWriteDescriptorSet> writes;
+    // Enough for the largest set, the 16 mip views of the mip generator
+    static constexpr uint32_t MAX_DESCRIPTORS = 16;
+
+    // Run of descriptors of one binding, consecutive array elements end up in one
+    struct Write {
+        uint32_t binding;
+        uint32_t arrayElement;
+        uint32_t count;
+        VkDescriptorType type;
+        uint32_t firstInfo;
+    };
+
+    std::array<DescriptorInfo, MAX_DESCRIPTORS> infos;
+    std::array<Write, MAX_DESCRIPTORS> writes;
+    uint32_t infoCount{ 0 };
+    uint32_t writeCount{ 0 };
 
-    // Writes image resources
-    void write_image(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type);
+    // Writes image resources, arrayElement selects the element of an array binding
+    void write_image(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type,
+        uint32_t arrayElement = 0);
     // Writes buffer resources
     void write_buffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type);
     // Resets everything
     void clear();
     // Updates the contents of a descriptor set  
     void update_set(VkDevice device, VkDescriptorSet set);
-};
\ No newline at end of file
+    // Same through the template of the layout of set, the writes have to cover its bindings in order
+    void update_set(VkDevice device, VkDescriptorSet set, const DescriptorTemplate& updateTemplate);
+private:
+    void add_write(uint32_t binding, uint32_t arrayElement, VkDescriptorType type);
+};
+
+/*
+    Allocates sets straight from host visible buffer memory (VK_EXT_descriptor_buffer): each set
+    is a linear slice of the current block and its descriptors are written with vkGetDescriptorEXT.
+    Blocks are kept across clears like the pools of DescriptorAllocator. Layouts need the
+    descriptor buffer flag and pipelines using them the descriptor buffer create flag.
+    Allocators that are never cleared hand freed sets to the next allocation of the same size.
+*/
+class DescriptorBufferAllocator {
+public:
+    // Loads the extension functions and descriptor sizes, once the device is made with the extension
+    static void load(VkDevice device, VkPhysicalDevice gpu);
+
+    // Most sets bind() takes at once
+    static constexpr uint32_t MAX_BOUND_SETS = 4;
+
+    struct Stats {
+        uint32_t sets;
+        VkDeviceSize bytes;
+        uint32_t blocks;
+    };
+
+    void init(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker, MemoryCategory category,
+        VkDeviceSize blockSize = 64 * 1024);
+    // Starts over at the first block, the GPU must be done with every set
+    void clear();
+    void destroy();
+
+    // New set of layout, safe to call from several threads at once
+    DescriptorHandle allocate(VkDescriptorSetLayout layout);
+    // Writes every binding of layout from writer into set. No frame in flight may be using it
+    void write(const DescriptorHandle& set, VkDescriptorSetLayout layout, const DescriptorWriter& writer) const;
+    // Keeps the range of set for a later allocation of the same size
+    void free(const DescriptorHandle& set, VkDescriptorSetLayout layout);
+
+    /*
+        Binds the blocks of sets, which may come from different allocators, and points the set
+        indices from firstSet on at them. Every bind drops the offsets set against the buffers
+        bound before, so the sets one pipeline uses go in the same call.
+    */
+    static void bind(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t firstSet,
+        std::span<const DescriptorHandle> sets);
+
+    // Counts since the last clear
+    Stats stats{};
+private:
+    struct Block {
+        AllocatedBuffer buffer;
+        VkDeviceAddress address;
+    };
+
+    struct FreeSet {
+        VkDeviceSize size;
+        uint32_t block;
+        VkDeviceSize offset;
+    };
+
+    VkDeviceSize descriptor_size(VkDescriptorType type) const;
+    void add_block();
+
+    VkDevice _device;
+    VmaAllocator _allocator;
+    MemoryTracker* _tracker;
+    MemoryCategory _category;
+    VkDeviceSize _blockSize;
+
+    std::vector<Block> _blocks;
+    uint32_t _current{ 0 };
+    VkDeviceSize _used{ 0 };
+    std::vector<FreeSet> _freeSets;
+    // guards the blocks and the free sets, bind reads the blocks of other allocators
+    mutable std::mutex _mutex;
+};
@@ -0,0 +1,50 @@
+/*
+	Dynamic resolution: picks the render scale from GPU timestamps so the frame stays under a
+	target time, without bouncing between two scales.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+class DynamicResolution {
+public:
+	// Creates two timestamp queries per frame in flight, on the queue family the frames are submitted to
+	void init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameCount);
+	void destroy();
+
+	// Start and end of the measured commands, first and last thing recorded in the frame's command buffer
+	void begin_frame(VkCommandBuffer cmd, uint32_t frame);
+	void end_frame(VkCommandBuffer cmd, uint32_t frame);
+
+	/*
+		Reads the GPU time of the last submit of frame, call once its fence was waited on. Returns
+		the scale to render the next frame at, which only moves when auto scaling is enabled.
+	*/
+	float update(uint32_t frame);
+
+	// False when the queue family has no timestamps, the scale stays manual then
+	bool supported() const { return _supported; }
+
+	bool autoScale{ true };
+	float targetMs{ 16.6f };
+	float minScale{ 0.5f };
+	float maxScale{ 1.f };
+	// the current render scale of both axes, set directly when autoScale is off
+	float scale{ 1.f };
+
+	// smoothed GPU time of the frame
+	float gpuMs{ 0.f };
+private:
+	VkDevice _device;
+	VkQueryPool _queryPool{ VK_NULL_HANDLE };
+	// nanoseconds per timestamp tick
+	float _timestampPeriod;
+	uint64_t _timestampMask;
+	bool _supported{ false };
+
+	// frames whose queries were written since they were last read
+	std::vector<bool> _pending;
+	// measurements left that were rendered before the last scale change
+	uint32_t _settleFrames{ 0 };
+	uint32_t _frameCount;
+};
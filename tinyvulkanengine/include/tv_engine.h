@@ -5,12 +5,28 @@
 
 #include <tv_types.h>
 
+#include <atomic>
+
 #include "tv_descriptors.h"
 #include "tv_loader.h"
 #include "tv_camera.h"
-
-// Handles the cleanup of objects
-struct DeletionQueue
+#include "tv_jobs.h"
+#include "tv_pipeline_registry.h"
+#include "tv_shader_reload.h"
+#include "tv_memory.h"
+#include "tv_resource_cache.h"
+#include "tv_mip_generator.h"
+#include "tv_render_graph.h"
+#include "tv_dynamic_resolution.h"
+#include "tv_postprocess.h"
+#include "tv_lights.h"
+#include "tv_shadows.h"
+#include "tv_background.h"
+#include "tv_deletion_queue.h"
+#include "tv_sampler_cache.h"
+
+// Destroys the objects made at startup in reverse order on shutdown. The frame loop uses DeletionQueue
+struct CleanupQueue
 {
 	// Stores callback func for every object
 	std::deque<std::function<void()>> deletors;
@@ -35,26 +51,135 @@ struct FrameData {
 	VkCommandPool _commandPool;
 	// Records commands to be submitted to the device queue for execution
 	VkCommandBuffer _mainCommandBuffer;
+	// Async compute work, only created when the compute queue is not the graphics one.
+	// Streaming has no dependency on the last frame, the background has to wait for it
+	VkCommandPool _computeCommandPool{ VK_NULL_HANDLE };
+	VkCommandBuffer _streamingCommandBuffer;
+	VkCommandBuffer _computeCommandBuffer;
 	// Used for GPU to GPU sync, link between multiple gpu queue operations
 	// _swapchainSemaphore -> render commands wait on swapchain img request
 	// _renderSemaphore -> waits for the draw commands of a given frame to be completed
 	VkSemaphore _swapchainSemaphore, _renderSemaphore;
 	// Used to sync the main loop in the CPU with the GPU
 	VkFence _renderFence;
-	// Deletion Queue for each frame in flight
-	DeletionQueue _deletionQueue;
 	// Global data descriptor for every frame
 	DescriptorAllocator _frameDescriptors;
+	// Sets of the per-frame passes when the descriptor buffer backend is on
+	DescriptorBufferAllocator _frameDescriptorBuffer;
+	// Occlusion culling inputs and outputs, sized for _cullCapacity objects
+	AllocatedBuffer _cullObjectBuffer{};
+	AllocatedBuffer _indirectBuffer{};
+	uint32_t _cullCapacity{ 0 };
+	// Culling counters, read back the next time this frame comes around
+	AllocatedBuffer _cullStatsBuffer{};
+	// Meshlets of the drawn objects and the index buffer their surviving triangles go to
+	AllocatedBuffer _meshletWorkBuffer{};
+	uint32_t _meshletWorkCapacity{ 0 };
+	AllocatedBuffer _expandedIndexBuffer{};
+	uint32_t _expandedIndexCapacity{ 0 };
+	// Object index of this frame's draws, opaque ones first in draw order
+	AllocatedBuffer _instanceBuffer{};
+	uint32_t _instanceCapacity{ 0 };
+	// Changed object data, scattered into the persistent object buffer
+	AllocatedBuffer _objectUploadBuffer{};
+	uint32_t _objectUploadCapacity{ 0 };
 };
 // Double-buffering
 constexpr unsigned int FRAME_OVERLAP = 2;
 
-// Compute Shaders Push Constants
-struct ComputePushConstants {
-	glm::vec4 data1;
-	glm::vec4 data2;
-	glm::vec4 data3;
-	glm::vec4 data4;
+// Object data scatter input, matches object_scatter.comp
+struct GPUObjectUpload {
+	GPUObjectData data;
+	uint32_t objectIndex;
+	uint32_t pad[3];
+};
+
+// Object data scatter push constants
+struct ObjectScatterPushConstants {
+	VkDeviceAddress uploadBuffer;
+	VkDeviceAddress objectBuffer;
+	uint32_t uploadCount;
+};
+
+// Occlusion culling data for one object
+struct GPUCullObject {
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	// index into the object data and visibility buffers
+	uint32_t objectIndex;
+	// start in the expanded index buffer, NO_MESHLET_EXPANSION for whole surface draws
+	uint32_t expandedFirstIndex;
+};
+
+constexpr uint32_t NO_MESHLET_EXPANSION = UINT32_MAX;
+
+// Culling phases, see occlusion_cull.comp
+constexpr uint32_t CULL_PHASE_PREVIOUS = 0;
+constexpr uint32_t CULL_PHASE_RETEST = 1;
+// culling without the depth pyramid, when only meshlet culling is on
+constexpr uint32_t CULL_PHASE_SINGLE = 2;
+
+// Meshlet culling data for one meshlet of a drawn object
+struct GPUMeshletWork {
+	glm::vec4 sphere;
+	glm::vec4 cone;
+	VkDeviceAddress indexBuffer;
+	// the object in the cull object buffer
+	uint32_t drawIndex;
+	uint32_t firstIndex;
+	uint32_t triangleCount;
+	// the object in the object data buffer
+	uint32_t objectIndex;
+	// start of the object in the expanded index buffer
+	uint32_t expandedFirstIndex;
+	uint32_t pad;
+};
+
+// Counters written by the culling shader
+struct GPUCullStats {
+	uint32_t occludedCount;
+	uint32_t visibleCount;
+	uint32_t triangleCount;
+	uint32_t culledMeshlets;
+};
+
+// Occlusion culling shader push constants
+struct CullPushConstants {
+	glm::mat4 viewproj;
+	VkDeviceAddress objectBuffer;
+	VkDeviceAddress objectDataBuffer;
+	VkDeviceAddress commandBuffer;
+	VkDeviceAddress visibilityBuffer;
+	VkDeviceAddress statsBuffer;
+	uint32_t objectCount;
+	uint32_t phase;
+};
+
+// Meshlet culling shader push constants
+struct MeshletCullPushConstants {
+	glm::mat4 viewproj;
+	glm::vec4 cameraPosition;
+	VkDeviceAddress workBuffer;
+	VkDeviceAddress objectDataBuffer;
+	VkDeviceAddress commandBuffer;
+	VkDeviceAddress expandedBuffer;
+	VkDeviceAddress statsBuffer;
+	uint32_t workCount;
+	uint32_t phase;
+};
+
+// Depth pyramid reduction push constants
+struct HiZPushConstants {
+	glm::vec2 inputSize;
+	glm::vec2 outputSize;
+};
+
+// Background effect push constants, must match gradient_color.comp and sky.comp
+struct BackgroundPushConstants {
+	ComputePushConstants effect;
+	// tiles from BackgroundCache::classify_tiles, used when useTiles is set
+	VkDeviceAddress tileBuffer;
+	uint32_t useTiles;
 };
 
 // Compute shaders
@@ -67,20 +192,34 @@ struct ComputeEffect {
 	ComputePushConstants pushConstants;
 };
 
+// Placement of a drawn surface, what the object buffer holds for it
+struct DrawObject {
+	glm::mat4 transform;
+	Bounds bounds;
+};
+
 struct RenderObject {
 	uint32_t indexCount;
 	uint32_t firstIndex;
-	VkBuffer indexBuffer;
-
-	MaterialInstance* material;
-	Bounds bounds;
-	glm::mat4 transform;
-	VkDeviceAddress vertexBufferAddress;
+	// pooled in the resource cache, the buffers, LODs and meshlets are looked up from it
+	MeshHandle mesh;
+	MaterialHandle material;
+	// into DrawContext::objects and the object buffer
+	uint32_t objectIndex;
+
+	// simplified index ranges of the surface in the pooled mesh, none when lodCount is 0
+	uint32_t firstLod;
+	uint32_t lodCount;
+	// meshlets of the full detail range in the pooled mesh, cleared when a coarser LOD is selected
+	uint32_t firstMeshlet;
+	uint32_t meshletCount;
 };
 
 struct DrawContext {
 	std::vector<RenderObject> OpaqueSurfaces;
 	std::vector<RenderObject> TransparentSurfaces;
+	// one per surface above, in the order they were added
+	std::vector<DrawObject> objects;
 };
 
 struct MeshNode : public Node {
@@ -93,8 +232,14 @@ struct MeshNode : public Node {
 struct GLTFMetallic_Roughness {
 	MaterialPipeline opaquePipeline;
 	MaterialPipeline transparentPipeline;
+	// Vertex-only variant of the opaque pipeline for depth passes
+	MaterialPipeline depthOnlyPipeline;
 
 	VkDescriptorSetLayout materialLayout;
+	// material sets are written every time a texture streams in or out
+	DescriptorTemplate materialTemplate;
+	// materialIndex of the next written material
+	std::atomic<uint32_t> materialCount{ 0 };
 
 	struct MaterialConstants {
 		glm::vec4 colorFactors;
@@ -112,21 +257,29 @@ struct GLTFMetallic_Roughness {
 		uint32_t dataBufferOffset;
 	};
 
-	DescriptorWriter writer;
-
 	/*
-		Initializes the opaque and transparent pipelines.
+		Requests the opaque, transparent and depth-only pipelines from the engine pipeline registry.
 	*/
 	void build_pipelines(TinyVulkan* engine);
 	/*
-		Destroys the opaque and transparent pipelines.
+		Destroys the pipeline and descriptor set layouts. The pipelines belong to the registry.
 	*/
 	void clear_resources(VkDevice device);
 	/*
 		Selects opaque or transparent pipeline, allocates descriptor set, and writes it using
-		the image and buffer from MaterialResources.
+		the image and buffer from MaterialResources. Safe to call from several threads at once.
+	*/
+	MaterialInstance write_material(TinyVulkan* engine, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator);
+	/*
+		Allocates and writes a new material descriptor set, from the engine descriptor buffer
+		when it has one and from descriptorAllocator otherwise.
+	*/
+	DescriptorHandle write_material_set(TinyVulkan* engine, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator);
+	/*
+		Rewrites an existing material set in place, used when a material's texture changes.
+		No frame in flight may be using the set.
 	*/
-	MaterialInstance write_material(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator);
+	void update_material_set(TinyVulkan* engine, const MaterialResources& resources, const DescriptorHandle& materialSet);
 };
 
 struct EngineStats {
@@ -135,15 +288,25 @@ struct EngineStats {
 	int drawcall_count;
 	float scene_update_time;
 	float mesh_draw_time;
+	int occlusion_culled_count;
+	int triangles_saved;
+	int meshlets_culled;
+	int objects_updated;
 };
 
 class TinyVulkan {
 public:
 	// Main deletion queue for global objects
-	DeletionQueue _mainDeletionQueue;
+	CleanupQueue _mainDeletionQueue;
 
 	// VMA memory allocator object
 	VmaAllocator _allocator;
+	// Memory used per category and heap, every engine allocation is counted
+	MemoryTracker memoryTracker;
+	// Objects the frames in flight may still use, freed as _graphicsTimeline passes them
+	DeletionQueue deletionQueue;
+	// Every sampler of the engine, SAMPLER_LINEAR and SAMPLER_NEAREST are the defaults
+	SamplerCache samplerCache;
 
 	// Camera object
 	Camera mainCamera;
@@ -152,17 +315,60 @@ public:
 	EngineStats stats;
 
 	// Creates a buffer
-	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usageFlags, VmaMemoryUsage memoryUsage);
+	AllocatedBuffer create_buffer(size_t allocSize, VkBufferUsageFlags usageFlags, VmaMemoryUsage memoryUsage,
+		MemoryCategory category = MemoryCategory::Other);
 	// Destroys a buffer
 	void destroy_buffer(const AllocatedBuffer& buffer);
+	// Device address of a buffer created with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+	VkDeviceAddress get_buffer_address(const AllocatedBuffer& buffer);
+
+	/*
+		Flags for the layouts and pipelines whose sets come from the descriptor buffers with the
+		backend on: the per-frame passes, the scene and material sets and the draw image.
+	*/
+	VkDescriptorSetLayoutCreateFlags descriptor_layout_flags() const;
+	VkPipelineCreateFlags descriptor_pipeline_flags() const;
+	/*
+		Writes writer into a new set of layout for this frame, from the descriptor buffer of the
+		frame with the backend on and from its pools through updateTemplate otherwise.
+	*/
+	DescriptorHandle write_frame_descriptors(VkDescriptorSetLayout layout, DescriptorWriter& writer,
+		const DescriptorTemplate& updateTemplate);
+	// write_frame_descriptors, then binds the set at setIndex
+	void bind_frame_descriptors(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout,
+		uint32_t setIndex, VkDescriptorSetLayout layout, DescriptorWriter& writer, const DescriptorTemplate& updateTemplate);
+	/*
+		Set of layout kept until free_descriptors, from the persistent descriptor buffer with the
+		backend on and from pool otherwise. Safe to call from several threads at once.
+	*/
+	DescriptorHandle allocate_descriptors(DescriptorAllocator& pool, VkDescriptorSetLayout layout);
+	// Writes writer into set, pool sets through updateTemplate. No frame in flight may be using it
+	void write_descriptors(const DescriptorHandle& set, VkDescriptorSetLayout layout, DescriptorWriter& writer,
+		const DescriptorTemplate& updateTemplate);
+	// Hands a set from allocate_descriptors back, pool sets go with their pool
+	void free_descriptors(const DescriptorHandle& set, VkDescriptorSetLayout layout);
+	/*
+		Binds sets from firstSet on. With descriptor buffers every bind drops the sets bound
+		before, so all the sets a draw uses have to go in one call.
+	*/
+	void bind_descriptors(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout, uint32_t firstSet,
+		std::span<const DescriptorHandle> sets);
 
 	// Draw resources
 	AllocatedImage _drawImage;
 	AllocatedImage _depthImage;
+	// The part of the draw images rendered to this frame, upscaled to the swapchain
 	VkExtent2D _drawExtent;
-	float renderScale = 1.f;
-
-	AllocatedImage create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
+	// What draw_geometry drew with, for draw_transparent_pass
+	DescriptorHandle _sceneDescriptor;
+	uint32_t _transparentInstance;
+	// Picks the render scale of every frame from the GPU time
+	DynamicResolution dynamicResolution;
+	// Takes the draw image to the swapchain size
+	PostProcess postProcess;
+
+	AllocatedImage create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false,
+		MemoryCategory category = MemoryCategory::Texture);
 	AllocatedImage create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped = false);
 	void destroy_image(const AllocatedImage& img);
 
@@ -172,9 +378,6 @@ public:
 	AllocatedImage _greyImage;
 	AllocatedImage _errorCheckerboardImage;
 
-	VkSampler _defaultSamplerLinear;
-	VkSampler _defaultSamplerNearest;
-
 	MaterialInstance defaultData;
 	GLTFMetallic_Roughness metalRoughMaterial;
 	
@@ -197,9 +400,65 @@ public:
 
 	// Draw loop
 	void draw();
-	void draw_background(VkCommandBuffer cmd);
+	/*
+		Runs the selected background effect over extent of the storage image in target, or with
+		tiles only over the tiles BackgroundCache::classify_tiles listed in it.
+	*/
+	void draw_background(VkCommandBuffer cmd, const DescriptorHandle& target, VkExtent2D extent, const AllocatedBuffer* tiles = nullptr);
+	/*
+		Submits the texture streaming, and the background effect into the draw image when
+		background is set, to the compute queue. Adds the barriers the graphics queue takes
+		the written images over with to acquires.
+	*/
+	void submit_async_compute(std::vector<VkImageMemoryBarrier2>& acquires, bool background);
 	void draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView);
 	void draw_geometry(VkCommandBuffer cmd);
+	// The uncovered background and then the transparent surfaces draw_geometry left out for it
+	void draw_transparent_pass(VkCommandBuffer cmd);
+	/*
+		Switches the object to the coarsest LOD whose error, projected to the screen,
+		stays under lodErrorThreshold pixels.
+	*/
+	void select_lod(RenderObject& obj);
+	// Pixels one mesh space unit of the object covers on screen, 0 when the camera is inside it
+	float projected_pixels_per_unit(const DrawObject& obj) const;
+	// Whether the object is drawn from meshlet culled expanded indices
+	bool uses_meshlets(const RenderObject& obj) const { return bMeshletCulling && obj.meshletCount > 0; }
+	/*
+		Uploads the data of the objects that changed since the last frame and scatters it
+		into the persistent object buffer.
+	*/
+	void update_objects(VkCommandBuffer cmd);
+	/*
+		Writes the object indices of the opaque and then the transparent draws to the frame's
+		instance buffer.
+	*/
+	void write_instances(std::span<const uint32_t> opaqueDraws, std::span<const uint32_t> transparentDraws);
+	/*
+		Records the draws of objects[draws[i]], whose transforms start at firstInstance in the
+		instance buffer. Runs of the same surface and material become one instanced draw.
+		Depth-only draws use the depth pre-pass pipeline. With an indirect buffer, draw i reads
+		its command at indirectOffset + i and runs sharing their buffers become one multi-draw.
+	*/
+	void draw_objects(VkCommandBuffer cmd, const std::vector<RenderObject>& objects, std::span<const uint32_t> draws,
+		uint32_t firstInstance, const DescriptorHandle& globalDescriptor, bool depthOnly, VkBuffer indirectBuffer = VK_NULL_HANDLE,
+		VkDeviceSize indirectOffset = 0);
+	/*
+		Uploads the culling data of the opaque draws and resets the culling counters.
+	*/
+	void prepare_culling(VkCommandBuffer cmd, std::span<const uint32_t> draws);
+	/*
+		Writes the indirect commands of one culling phase, then culls the meshlets of the
+		drawn objects into the expanded index buffer. See the CULL_PHASE constants.
+	*/
+	void cull_objects(VkCommandBuffer cmd, uint32_t objectCount, uint32_t phase);
+	/*
+		Reduces the depth image into the depth pyramid.
+	*/
+	void build_hiz(VkCommandBuffer cmd);
+
+	// Replaces the lights with testLightCount random ones spread over the drawn surfaces
+	void scatter_test_lights();
 
 	// Run main loop
 	void run();
@@ -224,13 +483,46 @@ public:
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
 
+	// A queue of a family without graphics when the device has one, the graphics queue otherwise
+	VkQueue _computeQueue;
+	uint32_t _computeQueueFamily;
+	// compute work goes to its own queue and overlaps the rasterization
+	bool _asyncCompute{ false };
+	// The scene, material, draw image and per-frame pass sets are written into buffer memory
+	// (VK_EXT_descriptor_buffer) instead of pool sets
+	bool _descriptorBuffers{ false };
+	// Submits of frame n signal value n + 1 on the semaphore of their queue
+	VkSemaphore _graphicsTimeline;
+	VkSemaphore _computeTimeline;
+
 	DescriptorAllocator globalDescriptorAllocator;
+	// Material and draw image sets with the descriptor buffer backend, kept until they are freed
+	DescriptorBufferAllocator _descriptorBuffer;
 
-	VkDescriptorSet _drawImageDescriptors;
+	DescriptorHandle _drawImageDescriptors;
 	VkDescriptorSetLayout _drawImageDescriptorLayout;
+	DescriptorTemplate _drawImageDescriptorTemplate;
 
 	VkPipelineLayout _gradientPipelineLayout;
 
+	// Worker threads shared by background engine work
+	WorkerPool _workers;
+
+	// Shared by every pipeline build, including the ones on worker threads
+	VkPipelineCache _pipelineCache;
+	// Owns every pipeline and shader module of the engine
+	PipelineRegistry pipelineRegistry;
+	// Recompiles edited shaders in the background
+	ShaderWatcher shaderWatcher;
+	// Keeps the mips the visible surfaces need on the GPU, within a budget
+	TextureStreamer textureStreamer;
+	// Textures, samplers and meshes shared by every loaded file
+	ResourceCache resourceCache;
+	// Fills the mip chains of uploaded images in compute
+	MipGenerator mipGenerator;
+
+	RenderGraph renderGraph;
+
 	// immediate submit structures
 	VkFence _immFence;
 	VkCommandBuffer _immCommandBuffer;
@@ -241,6 +533,10 @@ public:
 	// Stores an array of compute pipelines
 	std::vector<ComputeEffect> backfroundEffects;
 	int currentBackgroundEffect{ 0 };
+	// Renders the effect only when it changes, or only where the opaque surfaces left pixels
+	// uncovered, and draws it behind them instead of running it over the draw image every frame
+	BackgroundCache backgroundCache;
+	BackgroundMode backgroundMode = BackgroundMode::Cached;
 
 	// Creates mesh buffers and uploads them to the GPU
 	GPUMeshBuffers uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
@@ -249,14 +545,72 @@ public:
 	GPUSceneData sceneData;
 
 	VkDescriptorSetLayout _gpuSceneDataDescriptorLayout;
+	DescriptorTemplate _gpuSceneDataDescriptorTemplate;
 
 	DrawContext mainDrawContext;
 	std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> loadedScenes;
 	bool bShouldRenderStructure = false;
 	bool bShouldRenderSponza = false;
+
+	// Point and spot lights, assigned to clusters every frame
+	ClusteredLights clusteredLights;
+	int testLightCount = 0;
+
+	// Shadows of the sun, the distant cascades are reused across frames
+	ShadowCascades shadowCascades;
+
+	// LOD selection
+	bool bUseLods = true;
+	float lodErrorThreshold = 1.f;
+
+	// Occlusion and meshlet culling
+	bool bDepthPrepass = false;
+	bool bOcclusionCulling = true;
+	bool bMeshletCulling = true;
+
+	// Depth pyramid, a power of two below the draw image, one view per level
+	AllocatedImage _hizImage;
+	std::vector<VkImageView> _hizMipViews;
+	// from the sampler cache
+	VkSampler _hizSampler;
+
+	VkDescriptorSetLayout _hizBuildDescriptorLayout;
+	VkDescriptorSetLayout _cullDescriptorLayout;
+	// one set per level, reading the level above it
+	std::vector<VkDescriptorSet> _hizBuildDescriptors;
+	VkDescriptorSet _cullDescriptor;
+
+	VkPipelineLayout _hizBuildPipelineLayout;
+	VkPipelineLayout _cullPipelineLayout;
+	VkPipelineLayout _meshletCullPipelineLayout;
+	VkPipeline _hizBuildPipeline;
+	VkPipeline _cullPipeline;
+	VkPipeline _meshletCullPipeline;
+	// meshlets queued by prepare_culling this frame
+	uint32_t _meshletWorkCount{ 0 };
+
+	// Visibility of every object, indexed by object index and kept across frames
+	AllocatedBuffer _visibilityBuffer{};
+	uint32_t _visibilityCapacity{ 0 };
+	uint32_t _visibilityObjectCount{ 0 };
+	// Last culling counters read back from the GPU
+	GPUCullStats _cullStats{};
+
+	// Object data of the opaque and then the transparent surfaces, in the order the scene
+	// adds them. Only the objects that differ from the CPU copy are uploaded each frame
+	AllocatedBuffer _objectBuffer{};
+	uint32_t _objectCapacity{ 0 };
+	std::vector<GPUObjectData> _uploadedObjects;
+
+	VkPipelineLayout _objectScatterPipelineLayout;
+	VkPipeline _objectScatterPipeline;
 	
 
 	void update_scene();
+	/*
+		Swaps in the shaders the watcher recompiled since the last frame.
+	*/
+	void reload_changed_shaders();
 private:
 	/*
 		Initializes Vulkan instance, creates the logical VkDevice, and initializes the
@@ -299,6 +653,14 @@ private:
 		Initializes the compute pipeline to generate a background effect.
 	*/
 	void init_compute_pipelines();
+	/*
+		Creates the depth pyramid and requests the pyramid, object and meshlet culling pipelines.
+	*/
+	void init_occlusion_culling();
+	/*
+		Requests the pipeline that scatters changed objects into the object buffer.
+	*/
+	void init_object_scatter();
 	/*
 		Initializes the ImGUI library and its Vulkan-related parameters.
 	*/
@@ -11,5 +11,11 @@ namespace vkutil {
 	// Copies image into swapchain for presentation
 	void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
 
-	void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D imageSize);
+	// Global memory barrier between two pipeline stages
+	void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess,
+		VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess);
+	// Layout transition of part of an image, waiting only on the given stages and accesses
+	void image_barrier(VkCommandBuffer cmd, VkImage image, VkImageSubresourceRange range, VkImageLayout currentLayout,
+		VkImageLayout newLayout, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage,
+		VkAccessFlags2 dstAccess);
 }
\ No newline at end of file
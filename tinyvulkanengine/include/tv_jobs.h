@@ -0,0 +1,38 @@
+/*
+	Small worker thread pool for background engine work.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class WorkerPool {
+public:
+	// Starts the worker threads. 0 picks one less than the hardware thread count
+	void init(uint32_t threadCount = 0);
+	// Finishes the queued jobs and joins every worker
+	void shutdown();
+	// Queues a job to run on any worker
+	void submit(std::function<void()>&& job);
+	// Blocks until every queued job has finished
+	void wait();
+
+	uint32_t thread_count() const { return (uint32_t)threads.size(); }
+private:
+	void worker_loop();
+
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> jobs;
+
+	std::mutex mutex;
+	// Signaled when a job is queued or the pool is stopping
+	std::condition_variable jobAvailable;
+	// Signaled when the last running job finishes
+	std::condition_variable jobsDone;
+
+	uint32_t runningJobs{ 0 };
+	bool stopping{ false };
+};
@@ -0,0 +1,71 @@
+/*
+	Clustered lights: the view frustum is split into a grid of froxels, a compute pass lists the
+	lights touching each one, and fragments only go through the list of their own cluster.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+// Must match lights.glsl
+constexpr uint32_t CLUSTER_X = 16;
+constexpr uint32_t CLUSTER_Y = 9;
+constexpr uint32_t CLUSTER_Z = 24;
+constexpr uint32_t CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+constexpr uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+
+struct GPULight {
+	// world position, w range
+	glm::vec4 positionRange;
+	// rgb color, w intensity
+	glm::vec4 colorIntensity;
+	// xyz direction the light points to, w cosine of the outer cone, -1 for point lights
+	glm::vec4 spotDirection;
+	// x cosine of the inner cone
+	glm::vec4 spotParams;
+};
+
+class TinyVulkan;
+
+class ClusteredLights {
+public:
+	// Queues the pipeline compile on the engine registry, call before its wait()
+	void init(TinyVulkan* engine, uint32_t frameCount);
+	void destroy();
+
+	/*
+		Uploads lights into the buffers of frame and records their assignment to the clusters of
+		a drawExtent sized view. Fills the light fields of sceneData, which has to hold the view
+		of the frame already. Fragment shaders can read the clusters after the recorded barrier.
+	*/
+	void record(VkCommandBuffer cmd, uint32_t frame, GPUSceneData& sceneData, VkExtent2D drawExtent);
+
+	// Point light when the outer cone is -1
+	std::vector<GPULight> lights;
+
+	// View space depths the slices span, everything further is in the last slice
+	float clusterNear{ 0.1f };
+	float clusterFar{ 1000.f };
+private:
+	// Must match light_cull.comp
+	struct PushConstants {
+		glm::mat4 view;
+		glm::vec4 projection;
+		VkDeviceAddress lightBuffer;
+		VkDeviceAddress clusterBuffer;
+		uint32_t lightCount;
+	};
+
+	struct FrameBuffers {
+		AllocatedBuffer lights{};
+		uint32_t lightCapacity{ 0 };
+		AllocatedBuffer clusters{};
+	};
+
+	TinyVulkan* _engine;
+
+	VkPipelineLayout _pipelineLayout;
+	VkPipeline _pipeline;
+
+	// the frames in flight each read their own lists
+	std::vector<FrameBuffers> _frames;
+};
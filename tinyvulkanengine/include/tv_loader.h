@@ -6,11 +6,16 @@
 #include <unordered_map>
 #include <filesystem>
 #include "tv_descriptors.h"
+#include "tv_meshutil.h"
+#include "tv_texture_streaming.h"
 
 #include <fastgltf/tools.hpp>
 
 struct GLTFMaterial {
-    MaterialInstance data;
+    // in the resource cache material pool, removed with the file
+    MaterialHandle instance;
+    // back faces are visible, so meshlets of it cannot be cone culled
+    bool doubleSided;
 };
 
 struct Bounds {
@@ -19,18 +24,40 @@ struct Bounds {
     glm::vec3 extents;
 };
 
+// Simplified index range of a surface
+struct SurfaceLOD {
+    uint32_t startIndex;
+    uint32_t count;
+    // how far the simplified surface may be from the full one, in mesh units
+    float error;
+};
+
 struct GeoSurface {
     uint32_t startIndex;
     uint32_t count;
+    // coarser levels after the full detail range above, finest first. A range of PooledMesh::lods
+    uint32_t firstLod;
+    uint32_t lodCount;
+    // clusters of the full detail range, a range of PooledMesh::meshlets. Empty for small surfaces
+    uint32_t firstMeshlet;
+    uint32_t meshletCount;
     Bounds bounds;
     std::shared_ptr<GLTFMaterial> material;
 };
 
+// What the resource cache pools per mesh, the surfaces refer to ranges of the LODs and meshlets
+struct PooledMesh {
+    GPUMeshBuffers buffers;
+    std::vector<SurfaceLOD> lods;
+    std::vector<Meshlet> meshlets;
+};
+
 struct MeshAsset {
     std::string name;
 
     std::vector<GeoSurface> surfaces;
-    GPUMeshBuffers meshBuffers;
+    // pooled and shared by the engine resource cache
+    MeshHandle buffers;
 };
 //forward declaration
 class TinyVulkan;
@@ -41,15 +68,23 @@ struct LoadedGLTF : public IRenderable {
     // storage for all the data on a given glTF file
     std::unordered_map<std::string, std::shared_ptr<MeshAsset>> meshes;
     std::unordered_map<std::string, std::shared_ptr<Node>> nodes;
-    std::unordered_map<std::string, AllocatedImage> images;
+    // streamed by the engine, released to the resource cache with the file
+    std::vector<TextureHandle> textures;
+    // cached geometry of every mesh, the mesh names above may repeat
+    std::vector<MeshHandle> geometry;
     std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
+    // pooled instances of every material, the names above may repeat
+    std::vector<MaterialHandle> materialInstances;
 
     // nodes that dont have a parent, for iterating through the file in tree order
     std::vector<std::shared_ptr<Node>> topNodes;
 
+    // owned by the engine sampler cache
     std::vector<VkSampler> samplers;
 
     DescriptorAllocator descriptorPool;
+    // every material set of the file with the spares, from descriptorPool or the engine descriptor buffer
+    std::vector<DescriptorHandle> materialSets;
 
     AllocatedBuffer materialDataBuffer;
 
@@ -65,4 +100,4 @@ private:
 };
 
 std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::string_view filePath);
-std::optional<AllocatedImage> load_image(TinyVulkan* engine, fastgltf::Asset& asset, fastgltf::Image& image);
\ No newline at end of file
+std::optional<TextureHandle> load_image(TinyVulkan* engine, fastgltf::Asset& asset, fastgltf::Image& image);
\ No newline at end of file
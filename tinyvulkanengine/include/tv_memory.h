@@ -0,0 +1,65 @@
+/*
+	GPU memory accounting: per-category allocation totals and per-heap budgets from VMA.
+*/
+#pragma once
+
+#include <tv_types.h>
+#include <atomic>
+
+// What an allocation is used for, stored in its VMA user data
+enum class MemoryCategory : uint32_t {
+	Mesh,
+	Texture,
+	RenderTarget,
+	// per-frame and staging buffers
+	Transient,
+	Other,
+	Count
+};
+
+const char* memory_category_name(MemoryCategory category);
+
+class MemoryTracker {
+public:
+	struct HeapBudget {
+		VkDeviceSize usage;
+		VkDeviceSize budget;
+		bool deviceLocal;
+	};
+
+	/*
+		Without VK_EXT_memory_budget VMA estimates the budgets from its own allocations
+		and the heap sizes.
+	*/
+	void init(VmaAllocator allocator, bool budgetExtension);
+
+	// Tags the allocation about to be created with its category
+	static void set_category(VmaAllocationCreateInfo& info, MemoryCategory category);
+	// Counts a created allocation under the category it was tagged with
+	void add(VmaAllocation allocation);
+	// Call before freeing an allocation passed to add
+	void remove(VmaAllocation allocation);
+
+	/*
+		Refreshes the heap budgets and warns once when a heap goes over warningThreshold
+		of its budget. Call once per frame.
+	*/
+	void update(uint32_t frameNumber);
+	// Writes the categories, heap budgets and the detailed VMA statistics as JSON
+	bool dump_json(const char* filePath) const;
+
+	VkDeviceSize category_bytes(MemoryCategory category) const { return bytes[(uint32_t)category]; }
+	uint32_t category_count(MemoryCategory category) const { return counts[(uint32_t)category]; }
+	bool has_budget_extension() const { return _budgetExtension; }
+
+	std::vector<HeapBudget> heaps;
+	float warningThreshold{ 0.9f };
+private:
+	VmaAllocator _allocator;
+	bool _budgetExtension;
+
+	// workers allocate staging buffers, so the totals are atomic
+	std::atomic<VkDeviceSize> bytes[(uint32_t)MemoryCategory::Count]{};
+	std::atomic<uint32_t> counts[(uint32_t)MemoryCategory::Count]{};
+	std::vector<bool> heapWarned;
+};
@@ -0,0 +1,40 @@
+/*
+	Mesh processing helpers used by the loader.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+// Cluster of triangles inside a surface index range, culled as one unit
+struct Meshlet {
+	// bounding sphere in mesh space
+	glm::vec3 center;
+	float radius;
+	// every triangle normal is within the cone around coneAxis, coneCutoff is the sine
+	// of its half angle. 1 means the normals spread too far to ever cull on it
+	glm::vec3 coneAxis;
+	float coneCutoff;
+	// relative to the start of the surface range
+	uint32_t firstIndex;
+	uint32_t triangleCount;
+};
+
+namespace meshutil {
+	/*
+		Simplifies an indexed triangle list with quadric error edge collapses until it has
+		at most targetIndexCount indices, or until the next collapse would move the surface
+		further than targetError (in mesh units). Vertices only collapse onto other existing
+		vertices, so the result indexes the same vertex buffer. Border and seam vertices never
+		move. Returns the error of the simplified result.
+	*/
+	float simplify(std::span<const uint32_t> indices, std::span<const Vertex> vertices, size_t targetIndexCount,
+		float targetError, std::vector<uint32_t>& result);
+
+	/*
+		Reorders the triangles of an index range into meshlets of at most maxVertices unique
+		vertices and maxTriangles triangles, growing each one through its neighbouring triangles.
+		Without cone culling the normal cones are left disabled, for double sided surfaces.
+	*/
+	std::vector<Meshlet> build_meshlets(std::span<uint32_t> indices, std::span<const Vertex> vertices,
+		bool coneCulling, size_t maxVertices = 64, size_t maxTriangles = 124);
+}
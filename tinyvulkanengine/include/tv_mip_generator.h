@@ -0,0 +1,71 @@
+/*
+	Compute mip generation: every queued image gets its whole mip chain from one dispatch.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+#include "tv_descriptors.h"
+
+class TinyVulkan;
+class DeletionQueue;
+
+class MipGenerator {
+public:
+	// Queues the pipeline compile on the engine registry, call before its wait()
+	void init(TinyVulkan* engine);
+	void destroy();
+
+	/*
+		Queues an image whose level 0 was just written by a copy. It has to be an R8G8B8A8_UNORM
+		image with storage usage, in TRANSFER_DST_OPTIMAL.
+	*/
+	void add(const AllocatedImage& image);
+
+	/*
+		Records the mip generation of every queued image: one barrier for all of them, a dispatch
+		per image with nothing between them, and one barrier leaving every level in
+		SHADER_READ_ONLY_OPTIMAL. The views are destroyed through deletionQueue.
+		With release set cmd is a compute queue command buffer, and that last barrier hands the
+		images over to the graphics queue.
+	*/
+	void record(VkCommandBuffer cmd, DescriptorAllocator& descriptors, DeletionQueue& deletionQueue, bool release = false);
+
+	// Moves the graphics queue half of the last released images into barriers, to record before sampling them
+	void take_acquire_barriers(std::vector<VkImageMemoryBarrier2>& barriers);
+
+	// Images handled by the last record()
+	uint32_t lastBatchSize{ 0 };
+private:
+	struct PushConstants {
+		VkDeviceAddress counterBuffer;
+		uint32_t counterIndex;
+		uint32_t srcMip;
+		uint32_t mipCount;
+	};
+
+	struct Job {
+		AllocatedImage image;
+		uint32_t mipLevels;
+		// first level not written yet, the source of the next dispatch
+		uint32_t nextMip;
+		std::vector<VkImageView> views;
+		VkDescriptorSet set;
+	};
+
+	TinyVulkan* _engine;
+
+	VkDescriptorSetLayout _descriptorLayout;
+	DescriptorTemplate _descriptorTemplate;
+	VkPipelineLayout _pipelineLayout;
+	VkPipeline _pipeline;
+
+	// one workgroup counter per image of a batch, zero between dispatches
+	AllocatedBuffer _counterBuffer{};
+	uint32_t _counterCapacity{ 0 };
+	bool _countersCleared{ false };
+
+	std::vector<AllocatedImage> pending;
+	// acquire barriers matching the releases of the last record()
+	std::vector<VkImageMemoryBarrier2> acquires;
+};
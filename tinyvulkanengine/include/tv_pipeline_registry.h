@@ -0,0 +1,84 @@
+/*
+	Pipeline registry: dedupes pipelines by their full state and compiles them on worker threads.
+*/
+#pragma once
+
+#include <tv_types.h>
+#include <unordered_map>
+#include <chrono>
+
+#include "tv_pipelines.h"
+#include "tv_jobs.h"
+
+class PipelineRegistry {
+public:
+	// Counters shown in the stats window
+	struct Stats {
+		uint32_t requested;
+		uint32_t compiled;
+		uint32_t deduplicated;
+		uint32_t reloaded;
+		float compileTime;
+	};
+
+	void init(VkDevice device, VkPipelineCache cache, WorkerPool* workers);
+	// Waits for pending compiles and destroys every pipeline and shader module
+	void destroy();
+
+	// Loads a shader module once per path, later calls return the same handle
+	VkShaderModule get_shader(const char* filePath);
+
+	/*
+		Requests a pipeline built from the builder state. Identical requests share one
+		pipeline. The handle is written into target once wait() returns.
+	*/
+	void request_graphics(const PipelineBuilder& builder, VkPipeline* target);
+	void request_compute(VkPipelineLayout layout, VkShaderModule shader, VkPipeline* target, VkPipelineCreateFlags flags = 0);
+
+	// Blocks until every requested pipeline is compiled and writes the handles to their targets
+	void wait();
+
+	/*
+		Reloads a shader module from disk and rebuilds every pipeline using it, then writes
+		the new handles to their targets. The GPU must not be using the old pipelines.
+		When any pipeline fails to build, the old module and pipelines stay and it returns false.
+	*/
+	bool reload_shader(const std::string& filePath);
+
+	Stats stats{};
+private:
+	struct Entry {
+		bool isCompute;
+		PipelineBuilder builder;
+		VkPipelineLayout computeLayout;
+		VkShaderModule computeShader;
+		VkPipelineCreateFlags computeFlags;
+
+		VkPipeline pipeline;
+		std::vector<VkPipeline*> targets;
+	};
+
+	// Queues the compile job for a newly added entry
+	void compile(Entry& entry);
+	// Builds entry.pipeline on a worker, left VK_NULL_HANDLE when creation fails
+	void build(Entry& entry);
+	// Entry with the same state as request, which only needs its state fields set, or null
+	Entry* find(const Entry& request);
+	// Finds the entry with the request's state, or adds a copy of the request
+	Entry* find_or_add(const Entry& request, bool& added);
+	static size_t key_of(const Entry& entry);
+	static bool same_state(const Entry& a, const Entry& b);
+
+	VkDevice _device;
+	VkPipelineCache _cache;
+	WorkerPool* _workers;
+
+	// node based map, so entry pointers stay valid while workers write into them. The key is
+	// only a hash, entries sharing one are told apart by same_state
+	std::unordered_multimap<size_t, Entry> entries;
+	std::unordered_map<std::string, VkShaderModule> shaders;
+	// entries whose handles have not been written to their targets yet
+	std::vector<Entry*> pending;
+
+	std::chrono::steady_clock::time_point firstPendingTime;
+};
@@ -21,14 +21,22 @@ public:
     VkPipelineDepthStencilStateCreateInfo _depthStencil;
     VkPipelineRenderingCreateInfo _renderInfo;
     VkFormat _colorAttachmentformat;
+    // VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT for layouts made of descriptor buffer sets
+    VkPipelineCreateFlags _flags;
 
     PipelineBuilder() { clear(); }
 
     void clear();
 
-    VkPipeline build_pipeline(VkDevice device);
+    VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
+    // Hashes the pipeline state and shader module handles, used to dedupe pipelines
+    size_t hash() const;
+    // Compares the same state hash() covers, two builders with equal hashes may still differ
+    bool same_state(const PipelineBuilder& other) const;
 
     void set_shaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+    // Vertex stage only, for depth-only passes
+    void set_vertex_shader(VkShaderModule vertexShader);
     void set_input_topology(VkPrimitiveTopology topology);
     void set_polygon_mode(VkPolygonMode mode);
     void set_cull_mode(VkCullModeFlags cullMode, VkFrontFace frontFace);
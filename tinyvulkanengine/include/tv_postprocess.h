@@ -0,0 +1,48 @@
+/*
+	Post processing: tonemaps the rendered part of the draw image, upscales it to the swapchain
+	size with an edge adaptive filter and sharpens the result.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+#include "tv_descriptors.h"
+#include "tv_render_graph.h"
+
+class TinyVulkan;
+
+class PostProcess {
+public:
+	// Queues the pipeline compiles on the engine registry, call before its wait()
+	void init(TinyVulkan* engine);
+	void destroy();
+
+	/*
+		Adds the passes from inputExtent texels of input, an R16G16B16A16_SFLOAT image, to all of
+		output. The intermediate images are transients of the graph.
+	*/
+	void add_passes(RenderGraph& graph, RGImage input, VkExtent2D inputExtent, RGImage output, VkExtent2D outputExtent);
+
+	float exposure{ 1.f };
+	// 0 keeps the upscaled image softest, 1 sharpens the most
+	float sharpness{ 0.5f };
+private:
+	// Must match upscale.comp and sharpen.comp
+	struct PushConstants {
+		glm::ivec2 inputSize;
+		glm::ivec2 outputSize;
+		float exposure;
+		float sharpness;
+	};
+
+	void dispatch(VkCommandBuffer cmd, VkPipeline pipeline, VkImageView input, VkImageView output, const PushConstants& pushConstants);
+
+	TinyVulkan* _engine;
+
+	// a storage image in, a storage image out, for both passes
+	VkDescriptorSetLayout _descriptorLayout;
+	DescriptorTemplate _descriptorTemplate;
+	VkPipelineLayout _pipelineLayout;
+	VkPipeline _upscalePipeline;
+	VkPipeline _sharpenPipeline;
+};
@@ -0,0 +1,157 @@
+/*
+	Render graph: passes declare how they use images, the graph culls the passes nothing
+	needs, places the barriers between them and aliases the memory of transient images.
+*/
+#pragma once
+
+#include <tv_types.h>
+#include <unordered_map>
+
+class TinyVulkan;
+
+// Index of an image in the graph, valid until the next begin()
+using RGImage = uint32_t;
+
+// How a pass uses an image, picks its layout and the stages and accesses to synchronize
+enum class ImageUsage {
+	// attachments load their previous contents, so they read and write
+	ColorAttachment,
+	DepthAttachment,
+	// compute shader writes that do not depend on the previous contents
+	StorageWrite,
+	StorageRead,
+	// sampled from fragment or compute shaders
+	Sampled,
+	TransferSrc,
+	TransferDst,
+};
+
+class RenderGraph {
+public:
+	// What the barriers of the next use of an image have to wait for
+	struct ImageState {
+		VkImageLayout layout;
+		// the last write, later uses wait for it and make it visible
+		VkPipelineStageFlags2 writeStage;
+		VkAccessFlags2 writeAccess;
+		// stages that read since the last write, the next write waits for them
+		VkPipelineStageFlags2 readStages;
+	};
+
+	struct ImageAccess {
+		RGImage image;
+		ImageUsage usage;
+	};
+
+	// Counters of the last execute(), shown in the stats window
+	struct Stats {
+		uint32_t passes;
+		uint32_t culledPasses;
+		uint32_t barriers;
+		uint32_t transientImages;
+		// memory blocks backing the transient images, fewer than the images when they alias
+		uint32_t transientBlocks;
+	};
+
+	void init(TinyVulkan* engine);
+	// Destroys the transient images and their memory, the GPU must be idle
+	void destroy();
+
+	// Starts recording a new frame, forgets the passes and images of the last one
+	void begin();
+
+	/*
+		Adds an image the graph does not own. Its state is remembered across frames, initial
+		overrides it, for images whose previous use was synchronized outside the graph like
+		a freshly acquired swapchain image.
+	*/
+	RGImage import_image(const char* name, VkImage image, VkImageView view, VkExtent3D extent, VkFormat format,
+		const ImageState* initial = nullptr);
+	/*
+		Adds an image that only lives during the frame. Its usage flags come from the passes
+		using it, and images whose passes do not overlap share memory. The contents are
+		undefined at the first use of every frame.
+	*/
+	RGImage create_transient(const char* name, VkExtent3D extent, VkFormat format);
+
+	// Keeps the passes writing the image even though no pass reads it
+	void mark_output(RGImage image);
+	// Marks the image as an output and leaves it in PRESENT_SRC_KHR
+	void present(RGImage image);
+
+	/*
+		Adds a pass, passes run in the order they are added. The barriers the accesses need are
+		recorded before record is called.
+	*/
+	void add_pass(const char* name, std::initializer_list<ImageAccess> accesses, std::function<void(VkCommandBuffer)>&& record);
+
+	// Transient images are only created by execute(), use these from inside the pass functions
+	VkImage get_image(RGImage image) const;
+	VkImageView get_view(RGImage image) const;
+
+	// Culls the passes, creates the transient images and records every remaining pass
+	void execute(VkCommandBuffer cmd);
+
+	Stats stats{};
+private:
+	struct Resource {
+		const char* name;
+		VkImage image;
+		VkImageView view;
+		VkExtent3D extent;
+		VkFormat format;
+		bool imported;
+		bool output;
+		bool present;
+		// transient images only
+		VkImageUsageFlags usage;
+		uint32_t transientIndex;
+		// first and last kept pass using the image
+		uint32_t firstPass;
+		uint32_t lastPass;
+
+		ImageState state;
+	};
+
+	struct Pass {
+		const char* name;
+		std::vector<ImageAccess> accesses;
+		std::function<void(VkCommandBuffer)> record;
+		bool culled;
+	};
+
+	// Created once and kept while the frames ask for the same transient images
+	struct TransientImage {
+		std::string name;
+		VkExtent3D extent;
+		VkFormat format;
+		VkImageUsageFlags usage;
+		uint32_t firstPass;
+		uint32_t lastPass;
+
+		VkImage image;
+		VkImageView view;
+		uint32_t block;
+	};
+
+	struct MemoryBlock {
+		VmaAllocation allocation;
+		// last use of whichever image used the memory last, the next one has to wait for it
+		ImageState state;
+	};
+
+	void cull_passes();
+	// Creates the transient images, or keeps last frame's when nothing changed
+	void allocate_transients();
+	void destroy_transients(bool deferred);
+
+	TinyVulkan* _engine;
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+
+	std::vector<TransientImage> transients;
+	std::vector<MemoryBlock> blocks;
+	// state of the imported images between frames
+	std::unordered_map<VkImage, ImageState> importedStates;
+};
@@ -0,0 +1,79 @@
+/*
+	Resource cache: textures and meshes keyed by their content, shared between loaded files.
+	Meshes and materials live in pools, render objects refer to them by handle.
+*/
+#pragma once
+
+#include <tv_types.h>
+#include <unordered_map>
+
+#include "tv_loader.h"
+#include "tv_texture_streaming.h"
+
+class TinyVulkan;
+
+// Pooled mesh and the processed surfaces referring to it, the surface materials are left empty
+struct MeshGeometry {
+	MeshHandle buffers;
+	std::vector<GeoSurface> surfaces;
+};
+
+class ResourceCache {
+public:
+	// Counters shown in the stats window
+	struct Stats {
+		uint32_t textures;
+		uint32_t meshes;
+		// acquires that found an existing resource
+		uint32_t textureHits;
+		uint32_t meshHits;
+	};
+
+	void init(TinyVulkan* engine);
+	// Destroys what is still cached, every loaded file should have released its resources by now
+	void destroy();
+
+	/*
+		Returns the texture added with the same encoded bytes and takes a reference to it, or
+		INVALID_TEXTURE when there is none yet. The caller then decodes the image and calls add_texture.
+	*/
+	TextureHandle acquire_texture(std::span<const uint8_t> bytes);
+	// Caches a new texture with a copy of its encoded bytes, holding one reference
+	void add_texture(std::span<const uint8_t> bytes, TextureHandle texture);
+	// Drops a reference, the last one removes the texture from the streamer
+	void release_texture(TextureHandle texture);
+
+	// Same as acquire_texture, for mesh geometry. contents is everything the geometry is built from
+	const MeshGeometry* acquire_mesh(std::span<const uint8_t> contents);
+	// Pools the mesh and caches it with the surfaces and contents
+	MeshHandle add_mesh(std::vector<uint8_t> contents, PooledMesh mesh, std::vector<GeoSurface> surfaces);
+	// Drops a reference, the last one hands the mesh buffers to the deletion queue
+	void release_mesh(MeshHandle handle);
+
+	Stats stats{};
+
+	ResourcePool<PooledMesh> meshData;
+	// Written by the loaded files, which remove them again when they are unloaded
+	ResourcePool<MaterialInstance> materials;
+private:
+	template<typename T>
+	struct Entry {
+		T resource;
+		uint32_t refCount;
+		// the bytes hashed into the key, compared on a hit since different bytes can share a key
+		std::vector<uint8_t> contents;
+	};
+
+	static size_t hash_bytes(std::span<const uint8_t> bytes);
+	// Entry with the same contents among the ones under the key of contents, or end()
+	template<typename T>
+	static auto find(std::unordered_multimap<size_t, Entry<T>>& entries, std::span<const uint8_t> contents);
+
+	TinyVulkan* _engine;
+
+	std::unordered_multimap<size_t, Entry<TextureHandle>> textures;
+	std::unordered_map<TextureHandle, size_t> textureKeys;
+	std::unordered_multimap<size_t, Entry<MeshGeometry>> meshes;
+	// key of every cached mesh by its buffers handle
+	std::unordered_map<uint32_t, size_t> meshKeys;
+};
@@ -0,0 +1,119 @@
+/*
+	Generational handles into pooled storage. A handle packs a slot index and the generation of
+	the slot in 32 bits, the values themselves stay packed in one array. Removing a value bumps
+	the generation of its slot, so handles still pointing at it stop resolving instead of
+	reaching whatever takes the slot next.
+*/
+#pragma once
+
+#include <cassert>
+#include <compare>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+template<typename T>
+struct Handle {
+	static constexpr uint32_t INDEX_BITS = 20;
+	static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+	static constexpr uint32_t GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+
+	// generations start at 1, so a zero handle never resolves
+	uint32_t value{ 0 };
+
+	uint32_t index() const { return value & INDEX_MASK; }
+	uint32_t generation() const { return value >> INDEX_BITS; }
+	bool valid() const { return value != 0; }
+
+	auto operator<=>(const Handle&) const = default;
+};
+
+template<typename T>
+class ResourcePool {
+public:
+	Handle<T> add(T value)
+	{
+		uint32_t slot;
+		if (!_freeSlots.empty()) {
+			slot = _freeSlots.back();
+			_freeSlots.pop_back();
+		}
+		else {
+			slot = static_cast<uint32_t>(_slots.size());
+			assert(slot <= Handle<T>::INDEX_MASK);
+			_slots.push_back({ 1, NO_VALUE });
+		}
+
+		_slots[slot].dense = static_cast<uint32_t>(_values.size());
+		_values.push_back(std::move(value));
+		_denseSlots.push_back(slot);
+		return { (_slots[slot].generation << Handle<T>::INDEX_BITS) | slot };
+	}
+
+	// Moves the last value into the hole, so the values stay packed. Returns the removed one
+	T remove(Handle<T> handle)
+	{
+		assert(contains(handle));
+		Slot& slot = _slots[handle.index()];
+		uint32_t dense = slot.dense;
+		T value = std::move(_values[dense]);
+
+		uint32_t last = static_cast<uint32_t>(_values.size()) - 1;
+		if (dense != last) {
+			_values[dense] = std::move(_values[last]);
+			_denseSlots[dense] = _denseSlots[last];
+			_slots[_denseSlots[dense]].dense = dense;
+		}
+		_values.pop_back();
+		_denseSlots.pop_back();
+
+		slot.dense = NO_VALUE;
+		slot.generation = (slot.generation + 1) & Handle<T>::GENERATION_MASK;
+		if (slot.generation == 0) {
+			slot.generation = 1;
+		}
+		_freeSlots.push_back(handle.index());
+		return value;
+	}
+
+	bool contains(Handle<T> handle) const
+	{
+		uint32_t slot = handle.index();
+		return handle.valid() && slot < _slots.size() && _slots[slot].generation == handle.generation()
+			&& _slots[slot].dense != NO_VALUE;
+	}
+
+	T& get(Handle<T> handle)
+	{
+		assert(contains(handle));
+		return _values[_slots[handle.index()].dense];
+	}
+	const T& get(Handle<T> handle) const
+	{
+		assert(contains(handle));
+		return _values[_slots[handle.index()].dense];
+	}
+	// nullptr for stale handles
+	T* try_get(Handle<T> handle) { return contains(handle) ? &_values[_slots[handle.index()].dense] : nullptr; }
+
+	// Packed values in no particular order
+	std::span<T> values() { return _values; }
+	size_t size() const { return _values.size(); }
+	// Slots ever used, handle indices are below it
+	size_t capacity() const { return _slots.size(); }
+private:
+	static constexpr uint32_t NO_VALUE = UINT32_MAX;
+
+	struct Slot {
+		uint32_t generation;
+		// position in _values, NO_VALUE while free
+		uint32_t dense;
+	};
+
+	std::vector<T> _values;
+	// slot of every value, to fix the slot up when a value moves
+	std::vector<uint32_t> _denseSlots;
+	std::vector<Slot> _slots;
+	std::vector<uint32_t> _freeSlots;
+};
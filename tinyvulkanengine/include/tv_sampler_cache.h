@@ -0,0 +1,56 @@
+/*
+	Sampler cache: every sampler of the engine comes from here, made once per distinct create
+	info and kept until shutdown. Samplers are numbered in creation order, the numbers stay
+	valid for the life of the engine so they can be the slots of a bindless sampler array.
+*/
+#pragma once
+
+#include <tv_types.h>
+#include <unordered_map>
+#include <mutex>
+
+// Made by init, so every user can count on them
+constexpr uint32_t SAMPLER_LINEAR = 0;
+constexpr uint32_t SAMPLER_NEAREST = 1;
+
+class SamplerCache {
+public:
+	// Counters shown in the stats window
+	struct Stats {
+		uint32_t samplers;
+		// requests that found an existing sampler
+		uint32_t hits;
+	};
+
+	// Creates the default samplers
+	void init(VkDevice device);
+	void destroy();
+
+	/*
+		Index of the sampler made from info, the first request with it creates the sampler.
+		The key covers the fields of info but not its pNext chain, which has to be empty.
+		Safe to call from several threads at once.
+	*/
+	uint32_t get_index(const VkSamplerCreateInfo& info);
+	VkSampler get(uint32_t index);
+	// get(get_index(info))
+	VkSampler get_sampler(const VkSamplerCreateInfo& info);
+
+	// Every sampler by index, for filling a bindless array. No sampler may be added meanwhile
+	std::span<const VkSampler> samplers() const { return _samplers; }
+
+	Stats stats{};
+private:
+	static size_t sampler_key(const VkSamplerCreateInfo& info);
+	// Compares the fields sampler_key covers, equal keys do not mean equal samplers
+	static bool same_info(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b);
+
+	VkDevice _device;
+
+	// samplers by key, the ones sharing a key are told apart by their create info
+	std::unordered_multimap<size_t, uint32_t> _indices;
+	std::vector<VkSampler> _samplers;
+	// create info of every sampler, by index
+	std::vector<VkSamplerCreateInfo> _infos;
+	std::mutex _mutex;
+};
@@ -0,0 +1,46 @@
+/*
+	Watches the shader sources and recompiles them to SPIR-V in the background.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <filesystem>
+
+class ShaderWatcher {
+public:
+	/*
+		Starts the watcher thread on shaderDir. Changed .vert/.frag/.comp files are compiled
+		with the glslangValidator at validatorPath, a changed .glsl include recompiles all of them.
+	*/
+	bool init(const std::string& shaderDir, const std::string& validatorPath);
+	// Stops and joins the watcher thread
+	void stop();
+
+	// Returns the .spv paths compiled since the last call
+	std::vector<std::string> take_compiled();
+private:
+	void watch_loop();
+	void handle_change(const std::string& fileName);
+	void compile(const std::string& fileName);
+
+	std::string _shaderDir;
+	std::string _validator;
+
+	std::thread thread;
+	std::atomic<bool> stopping{ false };
+
+	std::mutex compiledMutex;
+	std::vector<std::string> compiled;
+
+#ifdef __linux__
+	int inotifyFd{ -1 };
+#else
+	// last seen write time per source file, used when there is no inotify
+	std::unordered_map<std::string, std::filesystem::file_time_type> writeTimes;
+#endif
+};
@@ -0,0 +1,129 @@
+/*
+	Cascaded shadow maps for the sun: the view up to shadowDistance is split into cascades,
+	each rendered from the sun into a layer of one depth array with its own culled draws.
+	The distant cascades are fitted around the camera position with some slack and kept
+	until the camera leaves it, the sun turns or the scene changes.
+*/
+#pragma once
+
+#include <tv_types.h>
+
+#include "tv_render_graph.h"
+
+class TinyVulkan;
+struct DrawContext;
+
+class ShadowCascades {
+public:
+	// Queues the pipeline compile on the engine registry, call before its wait()
+	void init(TinyVulkan* engine, uint32_t frameCount);
+	void destroy();
+
+	/*
+		Fits the cascades to the camera of sceneData, which has to hold the view, projection and
+		sun of the frame already, and culls objects for the ones to render. Fills the shadow
+		fields of sceneData. sceneChanged drops the cached cascades.
+	*/
+	void prepare(uint32_t frame, const DrawContext& context, GPUSceneData& sceneData, glm::vec3 cameraPosition,
+		bool sceneChanged);
+	/*
+		Adds the pass rendering what prepare picked. The returned image has to be read as Sampled
+		by the passes using view() and sampler().
+	*/
+	RGImage add_pass(RenderGraph& graph, uint32_t frame);
+
+	// All the cascades as an array, for a sampler2DArrayShadow
+	VkImageView view() const { return _shadowMap.imageView; }
+	// Compares reverse-Z depths, outside the map counts as lit
+	VkSampler sampler() const { return _sampler; }
+
+	struct CascadeStats {
+		// whether this frame rendered the cascade or reused it
+		bool rendered;
+		// times it was rendered since the start
+		uint32_t renderCount;
+		uint32_t objects;
+		uint32_t draws;
+		uint32_t triangles;
+		// GPU time of the last render, smoothed
+		float gpuMs;
+	};
+	CascadeStats stats[SHADOW_CASCADES]{};
+
+	// View depth the last cascade ends at
+	float shadowDistance{ 150.f };
+	// 0 splits the distance evenly, 1 logarithmically
+	float splitLambda{ 0.75f };
+	// How far behind a cascade objects still cast shadows into it
+	float casterDistance{ 100.f };
+	// Cascades from firstCachedCascade on are only rendered when invalidated
+	bool cacheDistantCascades{ true };
+	int firstCachedCascade{ 2 };
+	// Fraction of its far split the camera can move before a cached cascade is rendered again
+	float cacheMoveThreshold{ 0.1f };
+private:
+	// Must match shadow.vert
+	struct PushConstants {
+		glm::mat4 viewproj;
+		VkDeviceAddress vertexBuffer;
+		VkDeviceAddress instanceBuffer;
+		VkDeviceAddress objectBuffer;
+	};
+
+	// Copies of one mesh drawn as one instanced draw
+	struct Batch {
+		VkDeviceAddress vertexBuffer;
+		MeshHandle mesh;
+		VkBuffer indexBuffer;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		// relative to the first instance of the cascade
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+	};
+
+	struct Cascade {
+		glm::mat4 viewproj;
+		// fit of the last render, a cached cascade is reused while these still hold
+		glm::vec3 center;
+		float radius;
+		glm::vec3 sunDirection;
+		// rendered with the cached fit, around the camera position
+		bool valid;
+
+		bool render;
+		// sorted object indices of the last render, the batches point into them
+		std::vector<uint32_t> objectIndices;
+		std::vector<Batch> batches;
+		// where objectIndices start in the instance buffer of the frame
+		uint32_t firstInstance;
+	};
+
+	struct FrameBuffers {
+		AllocatedBuffer instances{};
+		uint32_t instanceCapacity{ 0 };
+		// cascades whose timestamps were written the last time the frame was recorded
+		bool pending[SHADOW_CASCADES]{};
+	};
+
+	void read_timestamps(uint32_t frame);
+	void record(VkCommandBuffer cmd, uint32_t frame);
+
+	TinyVulkan* _engine;
+
+	AllocatedImage _shadowMap{};
+	// one per cascade, to render into
+	VkImageView _layerViews[SHADOW_CASCADES]{};
+	VkSampler _sampler;
+
+	VkPipelineLayout _pipelineLayout;
+	VkPipeline _pipeline;
+
+	// two timestamps per cascade and frame
+	VkQueryPool _queryPool{ VK_NULL_HANDLE };
+	float _timestampPeriod;
+	uint64_t _timestampMask;
+
+	Cascade _cascades[SHADOW_CASCADES]{};
+	std::vector<FrameBuffers> _frames;
+};
@@ -0,0 +1,124 @@
+/*
+	Texture streaming: only the mip levels the visible surfaces need stay on the GPU.
+*/
+#pragma once
+
+#include <tv_types.h>
+#include <unordered_map>
+#include <mutex>
+
+#include "tv_jobs.h"
+
+class TinyVulkan;
+
+// Index of a streamed texture
+using TextureHandle = uint32_t;
+constexpr TextureHandle INVALID_TEXTURE = UINT32_MAX;
+
+class TextureStreamer {
+public:
+	// Counters shown in the stats window
+	struct Stats {
+		size_t residentBytes;
+		uint32_t textureCount;
+		uint32_t streamedIn;
+		uint32_t evicted;
+		uint32_t pendingUploads;
+	};
+
+	void init(TinyVulkan* engine, WorkerPool* workers);
+	// Waits for the pending uploads and destroys what is left of them
+	void destroy();
+
+	/*
+		Copies the RGBA8 pixels and builds their mip chain on the CPU. Only the mips of at
+		most residentSize texels are uploaded, with the next update(), the larger ones once a
+		surface needs them.
+	*/
+	TextureHandle add_texture(const uint8_t* pixels, VkExtent2D size);
+	// Destroys the texture right away, the GPU must not be using it
+	void remove_texture(TextureHandle texture);
+	// Current image of the texture, replaced every time mips are streamed in or evicted.
+	// The engine's white image until the first upload lands
+	const AllocatedImage& get_image(TextureHandle texture) const;
+
+	/*
+		Called with the new image view whenever the texture's image is replaced, so the
+		descriptor sets of the material can be rewritten.
+	*/
+	void add_listener(TextureHandle texture, MaterialHandle material, std::function<void(VkImageView)>&& listener);
+	// Lets request_material find the texture sampled by a material
+	void set_material_texture(MaterialHandle material, TextureHandle texture);
+	// Forgets a destroyed material and its listeners, its texture may still be shared by others
+	void remove_material(MaterialHandle material);
+	// Marks the material's texture as used this frame, covering about screenSize pixels
+	void request_material(MaterialHandle material, float screenSize);
+
+	/*
+		Swaps in the finished uploads, evicts the least recently used mips when over the
+		budget and starts uploading the mips requested last frame. Records into cmd, a compute
+		queue command buffer when the engine runs async compute.
+	*/
+	void update(VkCommandBuffer cmd, uint64_t frameNumber);
+
+	// GPU memory the textures may use, the low mips count towards it but are never evicted
+	int budgetMB{ 256 };
+	// Largest mip level, in texels, uploaded when a texture is added
+	uint32_t residentSize{ 128 };
+	// Upper bound on the uploads started in one frame
+	uint32_t maxUploadsPerFrame{ 4 };
+
+	Stats stats{};
+private:
+	struct Texture {
+		VkExtent2D size;
+		uint32_t mipCount;
+		// the mip levels down to baseMip, finest first. mipOffsets covers every level and has
+		// one extra entry for the end
+		std::vector<uint8_t> mipData;
+		std::vector<size_t> mipOffsets;
+
+		// holds the mips from residentMip down, mipCount before the first upload lands
+		AllocatedImage image;
+		uint32_t residentMip;
+		// coarsest residentMip, the mips below it are never evicted
+		uint32_t baseMip;
+		// finest mip requested since the last update
+		uint32_t wantedMip;
+		uint64_t lastUsedFrame;
+
+		// first mip of the upload in flight, or residentMip when there is none
+		uint32_t targetMip;
+		bool alive;
+
+		std::vector<std::pair<MaterialHandle, std::function<void(VkImageView)>>> listeners;
+	};
+
+	struct Upload {
+		TextureHandle texture;
+		uint32_t firstMip;
+		AllocatedBuffer staging;
+	};
+
+	// GPU size of the mips from firstMip down
+	size_t chain_size(const Texture& texture, uint32_t firstMip) const;
+	// Size of a single mip, the part of the chain that is uploaded
+	size_t mip_size(const Texture& texture, uint32_t mip) const;
+	// Copies the mips into a staging buffer on a worker, update() swaps them in
+	void start_upload(TextureHandle handle, uint32_t firstMip);
+	// Creates the image for the upload and records the copies into it
+	AllocatedImage record_upload(VkCommandBuffer cmd, const Texture& texture, const Upload& upload);
+
+	TinyVulkan* _engine;
+	WorkerPool* _workers;
+
+	std::vector<Texture> textures;
+	// texture of every material, by handle index
+	std::vector<TextureHandle> materialTextures;
+	// bytes of every texture once its uploads in flight land
+	size_t committedBytes{ 0 };
+	uint64_t currentFrame{ 0 };
+
+	std::mutex finishedMutex;
+	std::vector<Upload> finished;
+};
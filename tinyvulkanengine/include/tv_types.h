@@ -17,10 +17,13 @@
 #include <vulkan/vk_enum_string_helper.h>
 #include <vk_mem_alloc.h>
 
+#include "tv_resource_pool.h"
+
 //#include <fmt/core.h>
 
 #include <glm/mat4x4.hpp>
 #include <glm/vec4.hpp>
+#include <glm/vec2.hpp>
 
 // Holds data needed for an image
 struct AllocatedImage {
@@ -52,14 +55,46 @@ struct GPUMeshBuffers {
     AllocatedBuffer indexBuffer;
     AllocatedBuffer vertexBuffer;
     VkDeviceAddress vertexBufferAddress;
+    // read by the meshlet culling shader
+    VkDeviceAddress indexBufferAddress;
+};
+
+// Mesh buffers, LODs and meshlets pooled by the resource cache
+struct PooledMesh;
+using MeshHandle = Handle<PooledMesh>;
+
+// Compute Shaders Push Constants
+struct ComputePushConstants {
+    glm::vec4 data1;
+    glm::vec4 data2;
+    glm::vec4 data3;
+    glm::vec4 data4;
 };
 
 // Holds push constants for the mesh object draws
 struct GPUDrawPushConstants {
-    glm::mat4 worldMatrix;
     VkDeviceAddress vertexBuffer;
+    // object index per instance, read with gl_InstanceIndex
+    VkDeviceAddress instanceBuffer;
+    VkDeviceAddress objectBuffer;
+};
+
+// Persistent per-object data, matches object_data.glsl
+struct GPUObjectData {
+    // rows of the 3x4 object to world transform
+    glm::vec4 transformRows[3];
+    // mesh space bounds, xyz origin and w sphere radius
+    glm::vec4 boundsSphere;
+    glm::vec3 boundsExtents;
+    uint32_t materialIndex;
 };
 
+// Materials pooled by the resource cache
+using MaterialHandle = Handle<MaterialInstance>;
+
+// Sun shadow cascades, must match input_structures.glsl
+constexpr uint32_t SHADOW_CASCADES = 4;
+
 // Holds uniform buffer of scene data
 struct GPUSceneData {
     glm::mat4 view;
@@ -68,6 +103,17 @@ struct GPUSceneData {
     glm::vec4 ambientColor;
     glm::vec4 sunlightDirection; // w for sun power
     glm::vec4 sunlightColor;
+    // world to shadow map of every cascade
+    glm::mat4 shadowMatrices[SHADOW_CASCADES];
+    // view depth each cascade ends at
+    glm::vec4 cascadeSplits;
+    // world size of a shadow map texel of each cascade
+    glm::vec4 cascadeTexelSizes;
+    // Clustered lights, xy draw extent, z and w scale and bias of the slice of a log depth
+    glm::vec4 clusterParams;
+    uint32_t lightCount;
+    VkDeviceAddress lightBuffer;
+    VkDeviceAddress clusterBuffer;
 };
 
 // Holds some of the properties of materials
@@ -83,11 +129,23 @@ struct MaterialPipeline {
     VkPipelineLayout layout;
 };
 
+class DescriptorBufferAllocator;
+
+// Descriptor set of either backend, a pool set or a range of a descriptor buffer
+struct DescriptorHandle {
+    VkDescriptorSet set{ VK_NULL_HANDLE };
+    const DescriptorBufferAllocator* buffer{ nullptr };
+    uint32_t block{ 0 };
+    VkDeviceSize offset{ 0 };
+};
+
 // Holds objects needed to render a material
 struct MaterialInstance {
     MaterialPipeline* pipeline;
-    VkDescriptorSet materialSet;
+    DescriptorHandle materialSet;
     MaterialPass passType;
+    // unique per written material, stored in the object data
+    uint32_t materialIndex;
 };
 
 struct DrawContext;
@@ -127,6 +185,12 @@ struct Node : public IRenderable {
     }
 };
 
+// Mixes a value into a running hash (boost style)
+inline void hash_combine(size_t& seed, size_t value)
+{
+    seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
 #define VK_CHECK(x)                                                     \
     do {                                                                \
         VkResult err = x;                                               \
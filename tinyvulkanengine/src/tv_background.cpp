@@ -0,0 +1,219 @@
+#include <tv_background.h>
+#include <tv_engine.h>
+#include <tv_images.h>
+#include <tv_initializers.h>
+#include <tv_pipelines.h>
+
+#include <algorithm>
+#include <cstring>
+
+void BackgroundCache::init(TinyVulkan* engine)
+{
+    _engine = engine;
+    VkDevice device = engine->_device;
+
+    create_image();
+
+    // a tile per 16x16 pixels of the draw image at most, after the dispatch arguments
+    VkExtent3D drawSize = engine->_drawImage.imageExtent;
+    size_t tileCount = size_t((drawSize.width + 15) / 16) * ((drawSize.height + 15) / 16);
+    _tiles = engine->create_buffer(4 * sizeof(uint32_t) + tileCount * sizeof(glm::uvec2),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    // filters the half resolution image back up, clamped so the edges do not wrap around
+    VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    _sampler = engine->samplerCache.get_sampler(samplerInfo);
+
+    // the tile classification fetches exact depth texels
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    _depthSampler = engine->samplerCache.get_sampler(samplerInfo);
+
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    // both sets are written every frame, so from the descriptor buffer when the engine has one
+    _drawDescriptorLayout = builder.build(device, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr, engine->descriptor_layout_flags());
+    _tileDescriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT, nullptr, engine->descriptor_layout_flags());
+    if (!engine->_descriptorBuffers) {
+        _drawTemplate = builder.build_template(device, _drawDescriptorLayout);
+        _tileTemplate = builder.build_template(device, _tileDescriptorLayout);
+    }
+
+    VkPushConstantRange drawRange{};
+    drawRange.offset = 0;
+    drawRange.size = sizeof(glm::vec2);
+    drawRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_drawDescriptorLayout;
+    layoutInfo.pPushConstantRanges = &drawRange;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_drawPipelineLayout));
+
+    VkPushConstantRange tileRange{};
+    tileRange.offset = 0;
+    tileRange.size = sizeof(TilePushConstants);
+    tileRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    layoutInfo.pSetLayouts = &_tileDescriptorLayout;
+    layoutInfo.pPushConstantRanges = &tileRange;
+    VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_tilePipelineLayout));
+
+    VkShaderModule vertexShader = engine->pipelineRegistry.get_shader("../shaders/background.vert.spv");
+    VkShaderModule fragmentShader = engine->pipelineRegistry.get_shader("../shaders/background.frag.spv");
+    VkShaderModule tileShader = engine->pipelineRegistry.get_shader("../shaders/background_tiles.comp.spv");
+    if (vertexShader == VK_NULL_HANDLE || fragmentShader == VK_NULL_HANDLE || tileShader == VK_NULL_HANDLE) {
+        printf("Error when building the background shaders \n");
+        assert(false);
+    }
+
+    // On the far plane of the reverse-Z depth, only passes where nothing was drawn
+    PipelineBuilder pipelineBuilder;
+    pipelineBuilder.set_shaders(vertexShader, fragmentShader);
+    pipelineBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    pipelineBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    pipelineBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    pipelineBuilder.set_multisampling_none();
+    pipelineBuilder.disable_blending();
+    pipelineBuilder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+    pipelineBuilder.set_color_attachment_format(engine->_drawImage.imageFormat);
+    pipelineBuilder.set_depth_format(engine->_depthImage.imageFormat);
+    pipelineBuilder._pipelineLayout = _drawPipelineLayout;
+    pipelineBuilder._flags = engine->descriptor_pipeline_flags();
+    engine->pipelineRegistry.request_graphics(pipelineBuilder, &_drawPipeline);
+
+    engine->pipelineRegistry.request_compute(_tilePipelineLayout, tileShader, &_tilePipeline, engine->descriptor_pipeline_flags());
+}
+
+void BackgroundCache::destroy()
+{
+    VkDevice device = _engine->_device;
+    vkDestroyPipelineLayout(device, _tilePipelineLayout, nullptr);
+    vkDestroyPipelineLayout(device, _drawPipelineLayout, nullptr);
+    _tileTemplate.destroy(device);
+    _drawTemplate.destroy(device);
+    vkDestroyDescriptorSetLayout(device, _tileDescriptorLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, _drawDescriptorLayout, nullptr);
+    _engine->destroy_buffer(_tiles);
+    _engine->destroy_image(_image);
+}
+
+void BackgroundCache::create_image()
+{
+    VkExtent3D size = _engine->_drawImage.imageExtent;
+    if (_halfImage) {
+        size.width = std::max(1u, size.width / 2);
+        size.height = std::max(1u, size.height / 2);
+    }
+    // same format as the draw image, the effects are written for it
+    _image = _engine->create_image(size, _engine->_drawImage.imageFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        false, MemoryCategory::RenderTarget);
+}
+
+void BackgroundCache::resize(bool half)
+{
+    if (_halfImage == half) {
+        return;
+    }
+    // the frames in flight may still draw the old image
+    _engine->deletionQueue.push_image(_image);
+    _halfImage = half;
+    create_image();
+    _valid = false;
+}
+
+bool BackgroundCache::import(RenderGraph& graph, uint32_t effectIndex, const ComputeEffect& effect, RGImage& image)
+{
+    resize(halfResolution);
+
+    bool render = !_valid || _key.effectIndex != effectIndex || _key.pipeline != effect.pipeline
+        || memcmp(&_key.pushConstants, &effect.pushConstants, sizeof(ComputePushConstants)) != 0;
+    _key.effectIndex = effectIndex;
+    _key.pipeline = effect.pipeline;
+    _key.pushConstants = effect.pushConstants;
+    _valid = true;
+
+    image = graph.import_image("background", _image.image, _image.imageView, _image.imageExtent, _image.imageFormat);
+
+    if (render) {
+        stats.renders++;
+    }
+    else {
+        stats.reused++;
+    }
+    return render;
+}
+
+RGImage BackgroundCache::import_uncovered(RenderGraph& graph)
+{
+    resize(false);
+    // only the uncovered tiles get written, it stops holding a whole effect
+    _valid = false;
+    return graph.import_image("background", _image.image, _image.imageView, _image.imageExtent, _image.imageFormat);
+}
+
+DescriptorHandle BackgroundCache::target()
+{
+    DescriptorWriter writer;
+    writer.write_image(0, _image.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    return _engine->write_frame_descriptors(_engine->_drawImageDescriptorLayout, writer, _engine->_drawImageDescriptorTemplate);
+}
+
+void BackgroundCache::classify_tiles(VkCommandBuffer cmd, VkExtent2D extent)
+{
+    // the last frame may still read the list, as dispatch arguments or from the effect
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+    // no tiles yet, the classification counts them into the x of the dispatch
+    uint32_t dispatch[4] = { 0, 1, 1, 0 };
+    vkCmdUpdateBuffer(cmd, _tiles.buffer, 0, sizeof(dispatch), dispatch);
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+    DescriptorWriter writer;
+    writer.write_image(0, _engine->_depthImage.imageView, _depthSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+    TilePushConstants pushConstants;
+    pushConstants.tileBuffer = _engine->get_buffer_address(_tiles);
+    pushConstants.extent = glm::ivec2(extent.width, extent.height);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _tilePipeline);
+    _engine->bind_frame_descriptors(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _tilePipelineLayout, 0, _tileDescriptorLayout, writer,
+        _tileTemplate);
+    vkCmdPushConstants(cmd, _tilePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(TilePushConstants), &pushConstants);
+    vkCmdDispatch(cmd, (extent.width + 15) / 16, (extent.height + 15) / 16, 1);
+
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT);
+}
+
+void BackgroundCache::draw(VkCommandBuffer cmd, VkExtent2D viewport, VkExtent2D source)
+{
+    // the image is replaced when its size changes, so the set is made every frame
+    DescriptorWriter writer;
+    writer.write_image(0, _image.imageView, _sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _drawPipeline);
+    _engine->bind_frame_descriptors(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _drawPipelineLayout, 0, _drawDescriptorLayout, writer,
+        _drawTemplate);
+
+    glm::vec2 uvScale = glm::vec2(source.width, source.height) / glm::vec2(_image.imageExtent.width, _image.imageExtent.height);
+    vkCmdPushConstants(cmd, _drawPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::vec2), &uvScale);
+
+    VkViewport view = { 0.f, 0.f, float(viewport.width), float(viewport.height), 0.f, 1.f };
+    VkRect2D scissor = { { 0, 0 }, viewport };
+    vkCmdSetViewport(cmd, 0, 1, &view);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+}
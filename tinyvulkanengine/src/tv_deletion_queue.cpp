@@ -0,0 +1,105 @@
+#include <tv_deletion_queue.h>
+#include <tv_memory.h>
+
+#include <algorithm>
+#include <limits>
+
+void DeletionQueue::init(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker)
+{
+    _device = device;
+    _allocator = allocator;
+    _tracker = tracker;
+}
+
+void DeletionQueue::push_buffer(const AllocatedBuffer& buffer)
+{
+    _buffers.push_back({ buffer, _releaseValue });
+    stats.buffers++;
+}
+
+void DeletionQueue::push_image(const AllocatedImage& image)
+{
+    _images.push_back({ image, _releaseValue });
+    stats.images++;
+}
+
+void DeletionQueue::push_image_view(VkImageView view)
+{
+    _imageViews.push_back({ view, _releaseValue });
+    stats.imageViews++;
+}
+
+void DeletionQueue::push_raw_image(VkImage image)
+{
+    _rawImages.push_back({ image, _releaseValue });
+    stats.images++;
+}
+
+void DeletionQueue::push_memory(VmaAllocation allocation)
+{
+    _memory.push_back({ allocation, _releaseValue });
+    stats.memoryBlocks++;
+}
+
+template<typename T, typename F>
+uint32_t DeletionQueue::destroy_until(std::vector<Entry<T>>& entries, uint64_t completedValue, F&& destroy)
+{
+    // pushed in release order, the finished ones are all at the front
+    auto end = std::find_if(entries.begin(), entries.end(), [=](const Entry<T>& entry) {
+        return entry.releaseValue > completedValue;
+        });
+    for (auto it = entries.begin(); it != end; it++) {
+        destroy(it->handle);
+    }
+    uint32_t count = static_cast<uint32_t>(end - entries.begin());
+    // keeps the capacity for the next frames
+    entries.erase(entries.begin(), end);
+    return count;
+}
+
+void DeletionQueue::collect(uint64_t completedValue)
+{
+    uint32_t destroyed = 0;
+
+    // views before their images, images before the memory they are bound to
+    destroyed += destroy_until(_imageViews, completedValue, [&](VkImageView view) {
+        vkDestroyImageView(_device, view, nullptr);
+        });
+    destroyed += destroy_until(_images, completedValue, [&](const AllocatedImage& image) {
+        vkDestroyImageView(_device, image.imageView, nullptr);
+        if (image.allocation != VK_NULL_HANDLE) {
+            _tracker->remove(image.allocation);
+        }
+        vmaDestroyImage(_allocator, image.image, image.allocation);
+        });
+    destroyed += destroy_until(_rawImages, completedValue, [&](VkImage image) {
+        vkDestroyImage(_device, image, nullptr);
+        });
+    destroyed += destroy_until(_buffers, completedValue, [&](const AllocatedBuffer& buffer) {
+        if (buffer.allocation != VK_NULL_HANDLE) {
+            _tracker->remove(buffer.allocation);
+        }
+        vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
+        });
+    destroyed += destroy_until(_memory, completedValue, [&](VmaAllocation allocation) {
+        _tracker->remove(allocation);
+        vmaFreeMemory(_allocator, allocation);
+        });
+
+    stats.lastDestroyed = destroyed;
+    stats.totalDestroyed += destroyed;
+    update_stats();
+}
+
+void DeletionQueue::flush()
+{
+    collect(std::numeric_limits<uint64_t>::max());
+}
+
+void DeletionQueue::update_stats()
+{
+    stats.buffers = static_cast<uint32_t>(_buffers.size());
+    stats.images = static_cast<uint32_t>(_images.size() + _rawImages.size());
+    stats.imageViews = static_cast<uint32_t>(_imageViews.size());
+    stats.memoryBlocks = static_cast<uint32_t>(_memory.size());
+}
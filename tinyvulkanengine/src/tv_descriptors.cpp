@@ -1,10 +1,13 @@
 ﻿#include <tv_descriptors.h>
+#include <tv_memory.h>
 
-void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type)
+#include <atomic>
+
+void DescriptorLayoutBuilder::add_binding(uint32_t binding, VkDescriptorType type, uint32_t count)
 {
     VkDescriptorSetLayoutBinding newbind{};
     newbind.binding = binding;
-    newbind.descriptorCount = 1;
+    newbind.descriptorCount = count;
     newbind.descriptorType = type;
 
     bindings.push_back(newbind);
@@ -36,16 +39,97 @@ VkDescriptorSetLayout DescriptorLayoutBuilder::build(VkDevice device, VkShaderSt
     return set;
 }
 
-VkDescriptorPool DescriptorAllocator::get_pool(VkDevice device)
+DescriptorTemplate DescriptorLayoutBuilder::build_template(VkDevice device, VkDescriptorSetLayout layout) const
+{
+    DescriptorTemplate result;
+
+    // one entry per binding, reading its descriptors from consecutive infos
+    std::vector<VkDescriptorUpdateTemplateEntry> entries;
+    for (const VkDescriptorSetLayoutBinding& b : bindings) {
+        VkDescriptorUpdateTemplateEntry entry{};
+        entry.dstBinding = b.binding;
+        entry.dstArrayElement = 0;
+        entry.descriptorCount = b.descriptorCount;
+        entry.descriptorType = b.descriptorType;
+        entry.offset = result.descriptorCount * sizeof(DescriptorInfo);
+        entry.stride = sizeof(DescriptorInfo);
+        entries.push_back(entry);
+
+        result.descriptorCount += b.descriptorCount;
+    }
+
+    VkDescriptorUpdateTemplateCreateInfo info = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+    info.descriptorUpdateEntryCount = (uint32_t)entries.size();
+    info.pDescriptorUpdateEntries = entries.data();
+    info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+    info.descriptorSetLayout = layout;
+
+    VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &info, nullptr, &result.handle));
+    return result;
+}
+
+void DescriptorTemplate::destroy(VkDevice device)
+{
+    vkDestroyDescriptorUpdateTemplate(device, handle, nullptr);
+    handle = VK_NULL_HANDLE;
+}
+
+namespace {
+    std::atomic<uint32_t> nextAllocatorId{ 1 };
+}
+
+thread_local DescriptorAllocator::ChainSlot DescriptorAllocator::threadChains[CHAIN_SLOTS]{};
+thread_local uint32_t DescriptorAllocator::nextChainSlot{ 0 };
+
+DescriptorAllocator::Chain& DescriptorAllocator::thread_chain()
+{
+    for (const ChainSlot& slot : threadChains) {
+        if (slot.allocator == id) {
+            return *slot.chain;
+        }
+    }
+
+    // first allocation of this thread since the slot was taken over, look for its chain or start one
+    Chain* chain = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::thread::id thread = std::this_thread::get_id();
+        for (Chain& c : chains) {
+            if (c.thread == thread) {
+                chain = &c;
+                break;
+            }
+        }
+        if (chain == nullptr) {
+            chain = &chains.emplace_back();
+            chain->thread = thread;
+        }
+    }
+
+    threadChains[nextChainSlot] = ChainSlot{ id, chain };
+    nextChainSlot = (nextChainSlot + 1) % CHAIN_SLOTS;
+    return *chain;
+}
+
+VkDescriptorPool DescriptorAllocator::get_pool(VkDevice device, Chain& chain)
 {
     VkDescriptorPool newPool;
-    if (readyPools.size() != 0) {
-        newPool = readyPools.back();
-        readyPools.pop_back();
+    if (chain.readyPools.size() != 0) {
+        newPool = chain.readyPools.back();
+        chain.readyPools.pop_back();
+        return newPool;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freePools.size() != 0) {
+        newPool = freePools.back();
+        freePools.pop_back();
     }
     else {
         //need to create a new pool
         newPool = create_pool(device, setsPerPool, ratios);
+        poolsCreated++;
+        poolCount++;
 
         setsPerPool = setsPerPool * 1.5;
         if (setsPerPool > 4092) {
@@ -80,6 +164,7 @@ VkDescriptorPool DescriptorAllocator::create_pool(VkDevice device, uint32_t setC
 
 void DescriptorAllocator::init_pool(VkDevice device, uint32_t maxSets, std::span<PoolSizeRatio> poolRatios)
 {
+    id = nextAllocatorId++;
     ratios.clear();
 
     for (auto ratio : poolRatios) {
@@ -87,40 +172,79 @@ void DescriptorAllocator::init_pool(VkDevice device, uint32_t maxSets, std::span
     }
 
     VkDescriptorPool newPool = create_pool(device, maxSets, poolRatios);
+    poolsCreated = 1;
+    poolCount = 1;
 
     setsPerPool = maxSets * 1.5; //grow it next allocation
 
-    readyPools.push_back(newPool);
+    // taken by the first thread to allocate
+    freePools.push_back(newPool);
 }
 
 void DescriptorAllocator::clear_descriptors(VkDevice device)
 {
-    for (auto p : readyPools) {
-        vkResetDescriptorPool(device, p, 0);
-    }
-    for (auto p : fullPools) {
-        vkResetDescriptorPool(device, p, 0);
-        readyPools.push_back(p);
+    // merge the pools of every thread back, whoever allocates first next time takes them
+    for (Chain& chain : chains) {
+        for (auto p : chain.readyPools) {
+            vkResetDescriptorPool(device, p, 0);
+            freePools.push_back(p);
+        }
+        for (auto p : chain.fullPools) {
+            vkResetDescriptorPool(device, p, 0);
+            freePools.push_back(p);
+        }
+        chain.readyPools.clear();
+        chain.fullPools.clear();
+        chain.setsAllocated = 0;
+        chain.retries = 0;
     }
-    fullPools.clear();
+    poolsCreated = 0;
 }
 
 void DescriptorAllocator::destroy_pools(VkDevice device)
 {
-    for (auto p : readyPools) {
-        vkDestroyDescriptorPool(device, p, nullptr);
+    for (Chain& chain : chains) {
+        for (auto p : chain.readyPools) {
+            vkDestroyDescriptorPool(device, p, nullptr);
+        }
+        for (auto p : chain.fullPools) {
+            vkDestroyDescriptorPool(device, p, nullptr);
+        }
     }
-    readyPools.clear();
-    for (auto p : fullPools) {
+    chains.clear();
+    for (auto p : freePools) {
         vkDestroyDescriptorPool(device, p, nullptr);
     }
-    fullPools.clear();
+    freePools.clear();
+    poolCount = 0;
+
+    // the threads may still have slots pointing at the chains
+    id = nextAllocatorId++;
+}
+
+DescriptorAllocator::Stats DescriptorAllocator::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Stats result{};
+    for (const Chain& chain : chains) {
+        result.setsAllocated += chain.setsAllocated;
+        result.outOfPoolRetries += chain.retries;
+        if (chain.setsAllocated > 0) {
+            result.threads++;
+        }
+    }
+    result.poolsCreated = poolsCreated;
+    result.pools = poolCount;
+    return result;
 }
 
 VkDescriptorSet DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLayout layout, void* pNext)
 {
+    Chain& chain = thread_chain();
+
     //get or create a pool to allocate from
-    VkDescriptorPool poolToUse = get_pool(device);
+    VkDescriptorPool poolToUse = get_pool(device, chain);
 
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.pNext = pNext;
@@ -135,68 +259,340 @@ VkDescriptorSet DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLa
     //allocation failed. Try again
     if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL) {
 
-        fullPools.push_back(poolToUse);
+        chain.fullPools.push_back(poolToUse);
+        chain.retries++;
 
-        poolToUse = get_pool(device);
+        poolToUse = get_pool(device, chain);
         allocInfo.descriptorPool = poolToUse;
 
         VK_CHECK(vkAllocateDescriptorSets(device, &allocInfo, &ds));
     }
 
-    readyPools.push_back(poolToUse);
+    chain.readyPools.push_back(poolToUse);
+    chain.setsAllocated++;
     return ds;
 }
 
+void DescriptorWriter::add_write(uint32_t binding, uint32_t arrayElement, VkDescriptorType type)
+{
+    // the next element of the last write, its infos are already next to each other
+    if (writeCount > 0) {
+        Write& last = writes[writeCount - 1];
+        if (last.binding == binding && last.type == type && last.arrayElement + last.count == arrayElement
+            && last.firstInfo + last.count == infoCount) {
+            last.count++;
+            infoCount++;
+            return;
+        }
+    }
+
+    assert(writeCount < MAX_DESCRIPTORS);
+    writes[writeCount++] = Write{ binding, arrayElement, 1, type, infoCount };
+    infoCount++;
+}
+
 void DescriptorWriter::write_buffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type)
 {
-    VkDescriptorBufferInfo& info = bufferInfos.emplace_back(VkDescriptorBufferInfo{
+    assert(infoCount < MAX_DESCRIPTORS);
+    infos[infoCount].buffer = VkDescriptorBufferInfo{
         .buffer = buffer,
         .offset = offset,
         .range = size
-        });
-
-    VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-
-    write.dstBinding = binding;
-    write.dstSet = VK_NULL_HANDLE; //left empty for now until we need to write it
-    write.descriptorCount = 1;
-    write.descriptorType = type;
-    write.pBufferInfo = &info;
-
-    writes.push_back(write);
+    };
+    add_write(binding, 0, type);
 }
 
-void DescriptorWriter::write_image(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type)
+void DescriptorWriter::write_image(int binding, VkImageView image, VkSampler sampler, VkImageLayout layout, VkDescriptorType type,
+    uint32_t arrayElement)
 {
-    VkDescriptorImageInfo& info = imageInfos.emplace_back(VkDescriptorImageInfo{
+    assert(infoCount < MAX_DESCRIPTORS);
+    infos[infoCount].image = VkDescriptorImageInfo{
         .sampler = sampler,
         .imageView = image,
         .imageLayout = layout
-        });
-
-    VkWriteDescriptorSet write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-
-    write.dstBinding = binding;
-    write.dstSet = VK_NULL_HANDLE; //left empty for now until we need to write it
-    write.descriptorCount = 1;
-    write.descriptorType = type;
-    write.pImageInfo = &info;
-
-    writes.push_back(write);
+    };
+    add_write(binding, arrayElement, type);
 }
 
 void DescriptorWriter::clear()
 {
-    imageInfos.clear();
-    writes.clear();
-    bufferInfos.clear();
+    infoCount = 0;
+    writeCount = 0;
 }
 
 void DescriptorWriter::update_set(VkDevice device, VkDescriptorSet set)
 {
-    for (VkWriteDescriptorSet& write : writes) {
+    std::array<VkWriteDescriptorSet, MAX_DESCRIPTORS> vkWrites;
+    for (uint32_t i = 0; i < writeCount; i++) {
+        const Write& w = writes[i];
+        VkWriteDescriptorSet& write = vkWrites[i];
+        write = { .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
         write.dstSet = set;
+        write.dstBinding = w.binding;
+        write.dstArrayElement = w.arrayElement;
+        write.descriptorCount = w.count;
+        write.descriptorType = w.type;
+
+        bool isBuffer = w.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || w.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+            || w.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || w.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+        if (isBuffer) {
+            write.pBufferInfo = &infos[w.firstInfo].buffer;
+        }
+        else {
+            write.pImageInfo = &infos[w.firstInfo].image;
+        }
     }
 
-    vkUpdateDescriptorSets(device, (uint32_t)writes.size(), writes.data(), 0, nullptr);
-}
\ No newline at end of file
+    vkUpdateDescriptorSets(device, writeCount, vkWrites.data(), 0, nullptr);
+}
+
+void DescriptorWriter::update_set(VkDevice device, VkDescriptorSet set, const DescriptorTemplate& updateTemplate)
+{
+    // the template reads the infos by binding order, which the writes have to match
+    assert(infoCount == updateTemplate.descriptorCount);
+    vkUpdateDescriptorSetWithTemplate(device, set, updateTemplate.handle, infos.data());
+}
+
+namespace {
+    // Shared by every DescriptorBufferAllocator of the device
+    struct DescriptorBufferDevice {
+        PFN_vkGetDescriptorSetLayoutSizeEXT getLayoutSize;
+        PFN_vkGetDescriptorSetLayoutBindingOffsetEXT getBindingOffset;
+        PFN_vkGetDescriptorEXT getDescriptor;
+        PFN_vkCmdBindDescriptorBuffersEXT bindBuffers;
+        PFN_vkCmdSetDescriptorBufferOffsetsEXT setOffsets;
+        VkPhysicalDeviceDescriptorBufferPropertiesEXT properties;
+    };
+    DescriptorBufferDevice descriptorBufferDevice;
+}
+
+void DescriptorBufferAllocator::load(VkDevice device, VkPhysicalDevice gpu)
+{
+    DescriptorBufferDevice& d = descriptorBufferDevice;
+    d.getLayoutSize = (PFN_vkGetDescriptorSetLayoutSizeEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutSizeEXT");
+    d.getBindingOffset = (PFN_vkGetDescriptorSetLayoutBindingOffsetEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorSetLayoutBindingOffsetEXT");
+    d.getDescriptor = (PFN_vkGetDescriptorEXT)vkGetDeviceProcAddr(device, "vkGetDescriptorEXT");
+    d.bindBuffers = (PFN_vkCmdBindDescriptorBuffersEXT)vkGetDeviceProcAddr(device, "vkCmdBindDescriptorBuffersEXT");
+    d.setOffsets = (PFN_vkCmdSetDescriptorBufferOffsetsEXT)vkGetDeviceProcAddr(device, "vkCmdSetDescriptorBufferOffsetsEXT");
+
+    d.properties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT };
+    VkPhysicalDeviceProperties2 properties = { .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+    properties.pNext = &d.properties;
+    vkGetPhysicalDeviceProperties2(gpu, &properties);
+}
+
+void DescriptorBufferAllocator::init(VkDevice device, VmaAllocator allocator, MemoryTracker* tracker, MemoryCategory category,
+    VkDeviceSize blockSize)
+{
+    _device = device;
+    _allocator = allocator;
+    _tracker = tracker;
+    _category = category;
+    _blockSize = blockSize;
+
+    add_block();
+}
+
+void DescriptorBufferAllocator::add_block()
+{
+    VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
+    bufferInfo.size = _blockSize;
+    // combined image samplers need the sampler usage as well
+    bufferInfo.usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT
+        | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+    allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    MemoryTracker::set_category(allocInfo, _category);
+
+    Block block;
+    VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &allocInfo, &block.buffer.buffer, &block.buffer.allocation, &block.buffer.info));
+    _tracker->add(block.buffer.allocation);
+
+    VkBufferDeviceAddressInfo addressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = block.buffer.buffer };
+    block.address = vkGetBufferDeviceAddress(_device, &addressInfo);
+
+    _blocks.push_back(block);
+}
+
+void DescriptorBufferAllocator::clear()
+{
+    _current = 0;
+    _used = 0;
+    _freeSets.clear();
+    stats = {};
+    stats.blocks = (uint32_t)_blocks.size();
+}
+
+void DescriptorBufferAllocator::destroy()
+{
+    for (Block& block : _blocks) {
+        _tracker->remove(block.buffer.allocation);
+        vmaDestroyBuffer(_allocator, block.buffer.buffer, block.buffer.allocation);
+    }
+    _blocks.clear();
+}
+
+VkDeviceSize DescriptorBufferAllocator::descriptor_size(VkDescriptorType type) const
+{
+    const VkPhysicalDeviceDescriptorBufferPropertiesEXT& p = descriptorBufferDevice.properties;
+    switch (type) {
+    case VK_DESCRIPTOR_TYPE_SAMPLER: return p.samplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: return p.combinedImageSamplerDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE: return p.sampledImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE: return p.storageImageDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER: return p.uniformBufferDescriptorSize;
+    case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: return p.storageBufferDescriptorSize;
+    default:
+        assert(false);
+        return 0;
+    }
+}
+
+DescriptorHandle DescriptorBufferAllocator::allocate(VkDescriptorSetLayout layout)
+{
+    const DescriptorBufferDevice& d = descriptorBufferDevice;
+
+    VkDeviceSize size;
+    d.getLayoutSize(_device, layout, &size);
+    assert(size <= _blockSize);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    stats.sets++;
+    stats.bytes += size;
+
+    for (size_t i = 0; i < _freeSets.size(); i++) {
+        if (_freeSets[i].size == size) {
+            DescriptorHandle set{ VK_NULL_HANDLE, this, _freeSets[i].block, _freeSets[i].offset };
+            _freeSets[i] = _freeSets.back();
+            _freeSets.pop_back();
+            return set;
+        }
+    }
+
+    // sets start at the offset alignment, the next block once this one is full
+    VkDeviceSize alignment = d.properties.descriptorBufferOffsetAlignment;
+    VkDeviceSize offset = (_used + alignment - 1) & ~(alignment - 1);
+    if (offset + size > _blockSize) {
+        _current++;
+        if (_current == _blocks.size()) {
+            add_block();
+            stats.blocks++;
+        }
+        offset = 0;
+    }
+    _used = offset + size;
+    return { VK_NULL_HANDLE, this, _current, offset };
+}
+
+void DescriptorBufferAllocator::write(const DescriptorHandle& set, VkDescriptorSetLayout layout, const DescriptorWriter& writer) const
+{
+    const DescriptorBufferDevice& d = descriptorBufferDevice;
+    assert(set.buffer == this);
+
+    char* base;
+    {
+        // a new block may be going in on another thread
+        std::lock_guard<std::mutex> lock(_mutex);
+        base = (char*)_blocks[set.block].buffer.info.pMappedData + set.offset;
+    }
+
+    for (uint32_t i = 0; i < writer.writeCount; i++) {
+        const DescriptorWriter::Write& w = writer.writes[i];
+
+        VkDeviceSize bindingOffset;
+        d.getBindingOffset(_device, layout, w.binding, &bindingOffset);
+        VkDeviceSize stride = descriptor_size(w.type);
+
+        for (uint32_t k = 0; k < w.count; k++) {
+            const DescriptorInfo& info = writer.infos[w.firstInfo + k];
+
+            VkDescriptorGetInfoEXT getInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_GET_INFO_EXT };
+            getInfo.type = w.type;
+
+            // buffers go in by address, they need the device address usage
+            VkDescriptorAddressInfoEXT addressInfo = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_ADDRESS_INFO_EXT };
+            switch (w.type) {
+            case VK_DESCRIPTOR_TYPE_SAMPLER:
+                getInfo.data.pSampler = &info.image.sampler;
+                break;
+            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
+                getInfo.data.pCombinedImageSampler = &info.image;
+                break;
+            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
+                getInfo.data.pSampledImage = &info.image;
+                break;
+            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
+                getInfo.data.pStorageImage = &info.image;
+                break;
+            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER: {
+                VkBufferDeviceAddressInfo bufferAddress{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = info.buffer.buffer };
+                addressInfo.address = vkGetBufferDeviceAddress(_device, &bufferAddress) + info.buffer.offset;
+                addressInfo.range = info.buffer.range;
+                if (w.type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+                    getInfo.data.pUniformBuffer = &addressInfo;
+                }
+                else {
+                    getInfo.data.pStorageBuffer = &addressInfo;
+                }
+                break;
+            }
+            default:
+                assert(false);
+            }
+
+            d.getDescriptor(_device, &getInfo, stride, base + bindingOffset + (w.arrayElement + k) * stride);
+        }
+    }
+}
+
+void DescriptorBufferAllocator::free(const DescriptorHandle& set, VkDescriptorSetLayout layout)
+{
+    assert(set.buffer == this);
+    VkDeviceSize size;
+    descriptorBufferDevice.getLayoutSize(_device, layout, &size);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _freeSets.push_back({ size, set.block, set.offset });
+    stats.sets--;
+    stats.bytes -= size;
+}
+
+void DescriptorBufferAllocator::bind(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout,
+    uint32_t firstSet, std::span<const DescriptorHandle> sets)
+{
+    const DescriptorBufferDevice& d = descriptorBufferDevice;
+    assert(sets.size() <= MAX_BOUND_SETS);
+
+    // sets in the same block share a binding
+    std::array<VkDescriptorBufferBindingInfoEXT, MAX_BOUND_SETS> bindingInfos;
+    std::array<uint32_t, MAX_BOUND_SETS> bufferIndices;
+    std::array<VkDeviceSize, MAX_BOUND_SETS> offsets;
+    uint32_t bufferCount = 0;
+    for (size_t i = 0; i < sets.size(); i++) {
+        VkDeviceAddress address;
+        {
+            std::lock_guard<std::mutex> lock(sets[i].buffer->_mutex);
+            address = sets[i].buffer->_blocks[sets[i].block].address;
+        }
+
+        uint32_t index = 0;
+        while (index < bufferCount && bindingInfos[index].address != address) {
+            index++;
+        }
+        if (index == bufferCount) {
+            bindingInfos[index] = { .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_BUFFER_BINDING_INFO_EXT };
+            bindingInfos[index].address = address;
+            bindingInfos[index].usage = VK_BUFFER_USAGE_RESOURCE_DESCRIPTOR_BUFFER_BIT_EXT | VK_BUFFER_USAGE_SAMPLER_DESCRIPTOR_BUFFER_BIT_EXT;
+            bufferCount++;
+        }
+
+        bufferIndices[i] = index;
+        offsets[i] = sets[i].offset;
+    }
+
+    d.bindBuffers(cmd, bufferCount, bindingInfos.data());
+    d.setOffsets(cmd, bindPoint, pipelineLayout, firstSet, static_cast<uint32_t>(sets.size()), bufferIndices.data(), offsets.data());
+}
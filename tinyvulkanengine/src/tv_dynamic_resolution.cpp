@@ -0,0 +1,112 @@
+#include <tv_dynamic_resolution.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Weight of a new measurement in the smoothed time
+constexpr float SMOOTHING = 0.2f;
+// The scale only grows back while under this fraction of the target, between it and the target it holds
+constexpr float HEADROOM = 0.85f;
+// Largest change of the scale per adjustment, in both directions
+constexpr float MAX_STEP = 0.1f;
+// Smaller changes are ignored, they would only shuffle the resolution around
+constexpr float MIN_STEP = 0.02f;
+
+void DynamicResolution::init(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameCount)
+{
+    _device = device;
+    _frameCount = frameCount;
+    _pending.assign(frameCount, false);
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+    uint32_t validBits = families[queueFamily].timestampValidBits;
+    _supported = validBits > 0;
+    if (!_supported) {
+        autoScale = false;
+        return;
+    }
+    _timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    _timestampPeriod = properties.limits.timestampPeriod;
+
+    VkQueryPoolCreateInfo poolInfo{ .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = frameCount * 2;
+    VK_CHECK(vkCreateQueryPool(device, &poolInfo, nullptr, &_queryPool));
+}
+
+void DynamicResolution::destroy()
+{
+    vkDestroyQueryPool(_device, _queryPool, nullptr);
+}
+
+void DynamicResolution::begin_frame(VkCommandBuffer cmd, uint32_t frame)
+{
+    if (!_supported) {
+        return;
+    }
+    vkCmdResetQueryPool(cmd, _queryPool, frame * 2, 2);
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, _queryPool, frame * 2);
+}
+
+void DynamicResolution::end_frame(VkCommandBuffer cmd, uint32_t frame)
+{
+    if (!_supported) {
+        return;
+    }
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _queryPool, frame * 2 + 1);
+    _pending[frame] = true;
+}
+
+float DynamicResolution::update(uint32_t frame)
+{
+    if (!_pending[frame]) {
+        return scale;
+    }
+    _pending[frame] = false;
+
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(_device, _queryPool, frame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return scale;
+    }
+
+    float frameMs = ((timestamps[1] - timestamps[0]) & _timestampMask) * _timestampPeriod / 1000000.f;
+    gpuMs = gpuMs == 0.f ? frameMs : gpuMs + (frameMs - gpuMs) * SMOOTHING;
+
+    if (!autoScale) {
+        return scale;
+    }
+
+    // the frames in flight and the smoothing still carry the time of the old scale
+    if (_settleFrames > 0) {
+        _settleFrames--;
+        return scale;
+    }
+
+    // the time follows the pixel count, the square of the scale
+    float wanted = scale;
+    if (gpuMs > targetMs) {
+        wanted = scale * std::sqrt(targetMs / gpuMs);
+    }
+    else if (gpuMs < targetMs * HEADROOM) {
+        // grow towards the middle of the band the scale holds in, not right up to the target
+        wanted = scale * std::sqrt(targetMs * (1.f + HEADROOM) * 0.5f / gpuMs);
+    }
+    wanted = std::clamp(wanted, scale - MAX_STEP, scale + MAX_STEP);
+    wanted = std::clamp(wanted, minScale, maxScale);
+
+    if (std::abs(wanted - scale) >= MIN_STEP || (wanted != scale && (wanted == minScale || wanted == maxScale))) {
+        scale = wanted;
+        _settleFrames = _frameCount + 4;
+    }
+
+    return scale;
+}
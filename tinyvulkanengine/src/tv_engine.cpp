@@ -25,8 +25,17 @@
 #include <chrono>
 #include <thread>
 #include <cassert>
+#include <numeric>
+#include <limits>
+#include <random>
+
+#ifndef TV_GLSL_VALIDATOR
+#define TV_GLSL_VALIDATOR "glslangValidator"
+#endif
 
 constexpr bool bUseValidationLayers = false;
+// Falls back to the descriptor pools when off or when the device lacks the extension
+constexpr bool bUseDescriptorBuffers = true;
 TinyVulkan* loadedEngine = nullptr;
 
 TinyVulkan& TinyVulkan::Get() { return *loadedEngine; }
@@ -47,6 +56,8 @@ void TinyVulkan::init()
         _windowExtent.height,
         window_flags);
 
+    _workers.init();
+
     init_vulkan();
     init_swapchain();
     init_commands();
@@ -56,6 +67,12 @@ void TinyVulkan::init()
     init_imgui();
     init_default_data();
 
+    textureStreamer.init(this, &_workers);
+    resourceCache.init(this);
+    renderGraph.init(this);
+    dynamicResolution.init(_device, _chosenGPU, _graphicsQueueFamily, FRAME_OVERLAP);
+    shaderWatcher.init("../shaders", TV_GLSL_VALIDATOR);
+
     // Everything went fine
     _isInitialized = true;
 
@@ -106,7 +123,15 @@ void TinyVulkan::init_vulkan()
     VkPhysicalDeviceVulkan12Features features12{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
     features12.bufferDeviceAddress = true;
     features12.descriptorIndexing = true;
+    // the graphics and compute submits of a frame wait on each other through counters
+    features12.timelineSemaphore = true;
 
+    // Vulkan 1.0 features, the culled draws are multi-draws that pick their instance
+    VkPhysicalDeviceFeatures features10{};
+    features10.multiDrawIndirect = true;
+    features10.drawIndirectFirstInstance = true;
+    // the mip generator indexes its array of level views
+    features10.shaderStorageImageArrayDynamicIndexing = true;
 
     // Use vkbootstrap to select a gpu. 
     // We want a gpu that can write to the SDL surface and supports vulkan 1.3 with the correct features
@@ -115,10 +140,31 @@ void TinyVulkan::init_vulkan()
         .set_minimum_version(1, 3)
         .set_required_features_13(features)
         .set_required_features_12(features12)
+        .set_required_features(features10)
         .set_surface(_surface)
         .select()
         .value();
 
+    // Lets VMA report the real heap budgets instead of estimating them
+    bool memoryBudget = physicalDevice.enable_extension_if_present(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    // Descriptors are written straight into buffer memory when the device can
+    VkPhysicalDeviceDescriptorBufferFeaturesEXT descriptorBufferFeatures{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_FEATURES_EXT };
+    descriptorBufferFeatures.descriptorBuffer = true;
+    if (bUseDescriptorBuffers && physicalDevice.is_extension_present(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME)) {
+        VkPhysicalDeviceDescriptorBufferPropertiesEXT descriptorBufferProperties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_BUFFER_PROPERTIES_EXT };
+        VkPhysicalDeviceProperties2 deviceProperties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &descriptorBufferProperties };
+        vkGetPhysicalDeviceProperties2(physicalDevice.physical_device, &deviceProperties);
+
+        // the scene set of the frame and the persistent material set are bound from two buffers at once
+        bool twoBuffers = descriptorBufferProperties.maxResourceDescriptorBufferBindings >= 2
+            && descriptorBufferProperties.maxSamplerDescriptorBufferBindings >= 2;
+        _descriptorBuffers = twoBuffers && physicalDevice.enable_extension_features_if_present(descriptorBufferFeatures);
+        if (_descriptorBuffers) {
+            physicalDevice.enable_extension_if_present(VK_EXT_DESCRIPTOR_BUFFER_EXTENSION_NAME);
+        }
+    }
+
     // Create the final (logical) vulkan device
     vkb::DeviceBuilder deviceBuilder{ physicalDevice };
     vkb::Device vkbDevice = deviceBuilder.build().value();
@@ -131,16 +177,41 @@ void TinyVulkan::init_vulkan()
     _graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
     _graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+    // A compute family of its own runs next to the graphics queue on hardware that executes both at once
+    auto computeQueue = vkbDevice.get_queue(vkb::QueueType::compute);
+    if (computeQueue.has_value()) {
+        _computeQueue = computeQueue.value();
+        _computeQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::compute).value();
+    }
+    else {
+        _computeQueue = _graphicsQueue;
+        _computeQueueFamily = _graphicsQueueFamily;
+    }
+    _asyncCompute = _computeQueueFamily != _graphicsQueueFamily;
+
     // Initialize the memory allocator
     VmaAllocatorCreateInfo allocatorInfo = {};
     allocatorInfo.physicalDevice = _chosenGPU;
     allocatorInfo.device = _device;
     allocatorInfo.instance = _instance;
     allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+    if (memoryBudget) {
+        allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+    }
     vmaCreateAllocator(&allocatorInfo, &_allocator);
 
+    memoryTracker.init(_allocator, memoryBudget);
+    deletionQueue.init(_device, _allocator, &memoryTracker);
+
+    if (_descriptorBuffers) {
+        DescriptorBufferAllocator::load(_device, _chosenGPU);
+    }
+
+    samplerCache.init(_device);
+
     // Push the memory allocator to the global deletion queue
     _mainDeletionQueue.push_function([&]() {
+        samplerCache.destroy();
         vmaDestroyAllocator(_allocator);
         });
 }
@@ -210,9 +281,11 @@ void TinyVulkan::init_swapchain()
     VmaAllocationCreateInfo rimg_allocinfo = {};
     rimg_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
     rimg_allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    MemoryTracker::set_category(rimg_allocinfo, MemoryCategory::RenderTarget);
 
     // Allocate and create the draw image
     vmaCreateImage(_allocator, &rimg_info, &rimg_allocinfo, &_drawImage.image, &_drawImage.allocation, nullptr);
+    memoryTracker.add(_drawImage.allocation);
 
     // Build a image-view for the draw image to use for rendering
     VkImageViewCreateInfo rview_info = vkinit::imageview_create_info(_drawImage.imageFormat, _drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
@@ -223,11 +296,14 @@ void TinyVulkan::init_swapchain()
     _depthImage.imageExtent = drawImageExtent;
     VkImageUsageFlags depthImageUsages{};
     depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    // read by the depth pyramid reduction
+    depthImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
     VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthImage.imageFormat, depthImageUsages, drawImageExtent);
 
     // Allocate and create the depth image
     vmaCreateImage(_allocator, &dimg_info, &rimg_allocinfo, &_depthImage.image, &_depthImage.allocation, nullptr);
+    memoryTracker.add(_depthImage.allocation);
 
     // Build a image-view for the depth image to use for rendering
     VkImageViewCreateInfo dview_info = vkinit::imageview_create_info(_depthImage.imageFormat, _depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
@@ -235,12 +311,9 @@ void TinyVulkan::init_swapchain()
     VK_CHECK(vkCreateImageView(_device, &dview_info, nullptr, &_depthImage.imageView));
 
     // Add to deletion queues
-    _mainDeletionQueue.push_function([=]() {
-        vkDestroyImageView(_device, _drawImage.imageView, nullptr);
-        vmaDestroyImage(_allocator, _drawImage.image, _drawImage.allocation);
-
-        vkDestroyImageView(_device, _depthImage.imageView, nullptr);
-        vmaDestroyImage(_allocator, _depthImage.image, _depthImage.allocation);
+    _mainDeletionQueue.push_function([=, this]() {
+        destroy_image(_drawImage);
+        destroy_image(_depthImage);
         });
 }
 
@@ -272,6 +345,18 @@ void TinyVulkan::init_commands()
         VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._mainCommandBuffer));
     }
 
+    if (_asyncCompute) {
+        VkCommandPoolCreateInfo computePoolInfo = vkinit::command_pool_create_info(_computeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+
+        for (int i = 0; i < FRAME_OVERLAP; i++) {
+            VK_CHECK(vkCreateCommandPool(_device, &computePoolInfo, nullptr, &_frames[i]._computeCommandPool));
+
+            VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._computeCommandPool, 1);
+            VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._streamingCommandBuffer));
+            VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._computeCommandBuffer));
+        }
+    }
+
     VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_immCommandPool));
 
     // allocate the command buffer for immediate submits
@@ -302,6 +387,20 @@ void TinyVulkan::init_sync_structures()
 
     VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_immFence));
     _mainDeletionQueue.push_function([=]() { vkDestroyFence(_device, _immFence, nullptr); });
+
+    // The frame fence only covers the graphics submit, which waits for the compute one
+    VkSemaphoreTypeCreateInfo timelineInfo{ .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+    timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timelineInfo.initialValue = 0;
+    VkSemaphoreCreateInfo timelineCreateInfo = vkinit::semaphore_create_info();
+    timelineCreateInfo.pNext = &timelineInfo;
+
+    VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr, &_graphicsTimeline));
+    VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr, &_computeTimeline));
+    _mainDeletionQueue.push_function([=]() {
+        vkDestroySemaphore(_device, _graphicsTimeline, nullptr);
+        vkDestroySemaphore(_device, _computeTimeline, nullptr);
+        });
 }
 
 void TinyVulkan::init_descriptors()
@@ -309,29 +408,38 @@ void TinyVulkan::init_descriptors()
     std::vector<DescriptorAllocator::PoolSizeRatio> sizes =
     {
         { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 }
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
     };
 
     globalDescriptorAllocator.init_pool(_device, 10, sizes);
+    if (_descriptorBuffers) {
+        _descriptorBuffer.init(_device, _allocator, &memoryTracker, MemoryCategory::Other);
+    }
 
     {
         DescriptorLayoutBuilder builder;
         builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-        _drawImageDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+        _drawImageDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT, nullptr, descriptor_layout_flags());
+        _drawImageDescriptorTemplate = builder.build_template(_device, _drawImageDescriptorLayout);
     }
 
     {
         DescriptorLayoutBuilder builder;
         builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-        _gpuSceneDataDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        // the sun shadow cascades
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        _gpuSceneDataDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, nullptr,
+            descriptor_layout_flags());
+        _gpuSceneDataDescriptorTemplate = builder.build_template(_device, _gpuSceneDataDescriptorLayout);
     }
 
-    _drawImageDescriptors = globalDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
+    _drawImageDescriptors = allocate_descriptors(globalDescriptorAllocator, _drawImageDescriptorLayout);
 
     DescriptorWriter writer;
     writer.write_image(0, _drawImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
 
-    writer.update_set(_device, _drawImageDescriptors);
+    write_descriptors(_drawImageDescriptors, _drawImageDescriptorLayout, writer, _drawImageDescriptorTemplate);
 
     for (int i = 0; i < FRAME_OVERLAP; i++) {
         std::vector<DescriptorAllocator::PoolSizeRatio> frame_sizes = {
@@ -341,17 +449,27 @@ void TinyVulkan::init_descriptors()
             { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4 },
         };
 
-        _frames[i]._frameDescriptors = DescriptorAllocator{};
         _frames[i]._frameDescriptors.init_pool(_device, 1000, frame_sizes);
+        if (_descriptorBuffers) {
+            _frames[i]._frameDescriptorBuffer.init(_device, _allocator, &memoryTracker, MemoryCategory::Transient);
+        }
 
         _mainDeletionQueue.push_function([&, i]() {
             _frames[i]._frameDescriptors.destroy_pools(_device);
+            if (_descriptorBuffers) {
+                _frames[i]._frameDescriptorBuffer.destroy();
+            }
             });
     }
 
     _mainDeletionQueue.push_function([&]() {
         globalDescriptorAllocator.destroy_pools(_device);
+        if (_descriptorBuffers) {
+            _descriptorBuffer.destroy();
+        }
 
+        _drawImageDescriptorTemplate.destroy(_device);
+        _gpuSceneDataDescriptorTemplate.destroy(_device);
         vkDestroyDescriptorSetLayout(_device, _drawImageDescriptorLayout, nullptr);
         vkDestroyDescriptorSetLayout(_device, _gpuSceneDataDescriptorLayout, nullptr);
         });
@@ -369,7 +487,7 @@ void TinyVulkan::init_compute_pipelines()
     // Add Push Constants to pipeline layout
     VkPushConstantRange pushConstant{};
     pushConstant.offset = 0;
-    pushConstant.size = sizeof(ComputePushConstants);
+    pushConstant.size = sizeof(BackgroundPushConstants);
     pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
     computeLayout.pPushConstantRanges = &pushConstant;
@@ -377,81 +495,266 @@ void TinyVulkan::init_compute_pipelines()
 
     VK_CHECK(vkCreatePipelineLayout(_device, &computeLayout, nullptr, &_gradientPipelineLayout));
 
-    // Load shader modules
-    VkShaderModule gradientShader;
-    if (!vkutil::load_shader_module("../shaders/gradient_color.comp.spv", _device, &gradientShader))
-    {
-        printf("Error when building the compute shader \n");
-        assert(false);
-    }
-
-    VkShaderModule skyShader;
-    if (!vkutil::load_shader_module("../shaders/sky.comp.spv", _device, &skyShader)) {
+    // Load shader modules, the registry keeps them alive with the pipelines
+    VkShaderModule gradientShader = pipelineRegistry.get_shader("../shaders/gradient_color.comp.spv");
+    VkShaderModule skyShader = pipelineRegistry.get_shader("../shaders/sky.comp.spv");
+    if (gradientShader == VK_NULL_HANDLE || skyShader == VK_NULL_HANDLE) {
         printf("Error when building the compute shader \n");
         assert(false);
     }
 
-    // Shader stage info
-    VkPipelineShaderStageCreateInfo stageinfo{};
-    stageinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    stageinfo.pNext = nullptr;
-    stageinfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    stageinfo.module = gradientShader;
-    stageinfo.pName = "main";
-
-    // Compute pipeline info
-    VkComputePipelineCreateInfo computePipelineCreateInfo{};
-    computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-    computePipelineCreateInfo.pNext = nullptr;
-    computePipelineCreateInfo.layout = _gradientPipelineLayout;
-    computePipelineCreateInfo.stage = stageinfo;
-
     // Gradient shader effect
     ComputeEffect gradient;
     gradient.pipelineLayout = _gradientPipelineLayout;
     gradient.name = "gradient";
+    gradient.pipeline = VK_NULL_HANDLE;
     gradient.pushConstants = {};
     // Gradient shader default values
     gradient.pushConstants.data1 = glm::vec4(1, 0, 0, 1);
     gradient.pushConstants.data2 = glm::vec4(0, 0, 1, 1);
-    // Creates gradient shader compute pipeline
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &gradient.pipeline));
-
-    // Switch shader module to create sky shader
-    computePipelineCreateInfo.stage.module = skyShader;
 
     // Sky shader effect
     ComputeEffect sky;
     sky.pipelineLayout = _gradientPipelineLayout;
     sky.name = "sky";
+    sky.pipeline = VK_NULL_HANDLE;
     sky.pushConstants = {};
     // Sky shader default values
     sky.pushConstants.data1 = glm::vec4(0.1, 0.2, 0.4, 0.97);
-    // Creates sky shader compute pipeline
-    VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &sky.pipeline));
 
     // Add the 2 background effects into the array
     backfroundEffects.push_back(gradient);
     backfroundEffects.push_back(sky);
 
-    // Destroy shader modules
-    vkDestroyShaderModule(_device, gradientShader, nullptr);
-    vkDestroyShaderModule(_device, skyShader, nullptr);
+    // The pipelines get compiled on the workers, the handles land in the effects on pipelineRegistry.wait()
+    pipelineRegistry.request_compute(_gradientPipelineLayout, gradientShader, &backfroundEffects[0].pipeline, descriptor_pipeline_flags());
+    pipelineRegistry.request_compute(_gradientPipelineLayout, skyShader, &backfroundEffects[1].pipeline, descriptor_pipeline_flags());
 
     _mainDeletionQueue.push_function([=]() {
         vkDestroyPipelineLayout(_device, _gradientPipelineLayout, nullptr);
-        vkDestroyPipeline(_device, sky.pipeline, nullptr);
-        vkDestroyPipeline(_device, gradient.pipeline, nullptr);
+        });
+}
+
+// Largest power of two not above value
+static uint32_t previous_pow2(uint32_t value)
+{
+    uint32_t result = 1;
+    while (result * 2 <= value) {
+        result *= 2;
+    }
+    return result;
+}
+
+void TinyVulkan::init_occlusion_culling()
+{
+    // Power of two size so every level below the first is an exact halving
+    VkExtent3D hizExtent = {
+        previous_pow2(_drawImage.imageExtent.width),
+        previous_pow2(_drawImage.imageExtent.height),
+        1
+    };
+    _hizImage = create_image(hizExtent, VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, true,
+        MemoryCategory::RenderTarget);
+
+    uint32_t mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(hizExtent.width, hizExtent.height)))) + 1;
+    for (uint32_t mip = 0; mip < mipLevels; mip++) {
+        VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(VK_FORMAT_R32_SFLOAT, _hizImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        viewInfo.subresourceRange.baseMipLevel = mip;
+        viewInfo.subresourceRange.levelCount = 1;
+
+        VkImageView view;
+        VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &view));
+        _hizMipViews.push_back(view);
+    }
+
+    // The shaders fetch exact texels, nearest filtering and no lod clamp
+    VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.minLod = 0.f;
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    _hizSampler = samplerCache.get_sampler(samplerInfo);
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        _hizBuildDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        _cullDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    // Level 0 reads the depth image, every other level reads the one above it
+    for (uint32_t mip = 0; mip < mipLevels; mip++) {
+        VkDescriptorSet set = globalDescriptorAllocator.allocate(_device, _hizBuildDescriptorLayout);
+
+        DescriptorWriter writer;
+        if (mip == 0) {
+            writer.write_image(0, _depthImage.imageView, _hizSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        }
+        else {
+            writer.write_image(0, _hizMipViews[mip - 1], _hizSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        }
+        writer.write_image(1, _hizMipViews[mip], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        writer.update_set(_device, set);
+
+        _hizBuildDescriptors.push_back(set);
+    }
+
+    _cullDescriptor = globalDescriptorAllocator.allocate(_device, _cullDescriptorLayout);
+    {
+        DescriptorWriter writer;
+        writer.write_image(0, _hizImage.imageView, _hizSampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.update_set(_device, _cullDescriptor);
+    }
+
+    VkPushConstantRange hizRange{};
+    hizRange.offset = 0;
+    hizRange.size = sizeof(HiZPushConstants);
+    hizRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo hizLayoutInfo = vkinit::pipeline_layout_create_info();
+    hizLayoutInfo.setLayoutCount = 1;
+    hizLayoutInfo.pSetLayouts = &_hizBuildDescriptorLayout;
+    hizLayoutInfo.pPushConstantRanges = &hizRange;
+    hizLayoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(_device, &hizLayoutInfo, nullptr, &_hizBuildPipelineLayout));
+
+    VkPushConstantRange cullRange{};
+    cullRange.offset = 0;
+    cullRange.size = sizeof(CullPushConstants);
+    cullRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo cullLayoutInfo = vkinit::pipeline_layout_create_info();
+    cullLayoutInfo.setLayoutCount = 1;
+    cullLayoutInfo.pSetLayouts = &_cullDescriptorLayout;
+    cullLayoutInfo.pPushConstantRanges = &cullRange;
+    cullLayoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(_device, &cullLayoutInfo, nullptr, &_cullPipelineLayout));
+
+    // same pyramid descriptor as the object culling
+    VkPushConstantRange meshletRange{};
+    meshletRange.offset = 0;
+    meshletRange.size = sizeof(MeshletCullPushConstants);
+    meshletRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo meshletLayoutInfo = vkinit::pipeline_layout_create_info();
+    meshletLayoutInfo.setLayoutCount = 1;
+    meshletLayoutInfo.pSetLayouts = &_cullDescriptorLayout;
+    meshletLayoutInfo.pPushConstantRanges = &meshletRange;
+    meshletLayoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(_device, &meshletLayoutInfo, nullptr, &_meshletCullPipelineLayout));
+
+    VkShaderModule hizShader = pipelineRegistry.get_shader("../shaders/hiz_build.comp.spv");
+    VkShaderModule cullShader = pipelineRegistry.get_shader("../shaders/occlusion_cull.comp.spv");
+    VkShaderModule meshletShader = pipelineRegistry.get_shader("../shaders/meshlet_cull.comp.spv");
+    if (hizShader == VK_NULL_HANDLE || cullShader == VK_NULL_HANDLE || meshletShader == VK_NULL_HANDLE) {
+        printf("Error when building the occlusion culling shaders \n");
+        assert(false);
+    }
+
+    pipelineRegistry.request_compute(_hizBuildPipelineLayout, hizShader, &_hizBuildPipeline);
+    pipelineRegistry.request_compute(_cullPipelineLayout, cullShader, &_cullPipeline);
+    pipelineRegistry.request_compute(_meshletCullPipelineLayout, meshletShader, &_meshletCullPipeline);
+
+    for (int i = 0; i < FRAME_OVERLAP; i++) {
+        _frames[i]._cullStatsBuffer = create_buffer(sizeof(GPUCullStats),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VMA_MEMORY_USAGE_GPU_TO_CPU, MemoryCategory::Transient);
+        // read before the first frame ever writes it
+        memset(_frames[i]._cullStatsBuffer.info.pMappedData, 0, sizeof(GPUCullStats));
+    }
+
+    _mainDeletionQueue.push_function([&]() {
+        for (int i = 0; i < FRAME_OVERLAP; i++) {
+            destroy_buffer(_frames[i]._cullObjectBuffer);
+            destroy_buffer(_frames[i]._indirectBuffer);
+            destroy_buffer(_frames[i]._cullStatsBuffer);
+            destroy_buffer(_frames[i]._meshletWorkBuffer);
+            destroy_buffer(_frames[i]._expandedIndexBuffer);
+        }
+        destroy_buffer(_visibilityBuffer);
+
+        vkDestroyPipelineLayout(_device, _hizBuildPipelineLayout, nullptr);
+        vkDestroyPipelineLayout(_device, _cullPipelineLayout, nullptr);
+        vkDestroyPipelineLayout(_device, _meshletCullPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _hizBuildDescriptorLayout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _cullDescriptorLayout, nullptr);
+
+        for (VkImageView view : _hizMipViews) {
+            vkDestroyImageView(_device, view, nullptr);
+        }
+        destroy_image(_hizImage);
+        });
+}
+
+void TinyVulkan::init_object_scatter()
+{
+    VkPushConstantRange scatterRange{};
+    scatterRange.offset = 0;
+    scatterRange.size = sizeof(ObjectScatterPushConstants);
+    scatterRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo scatterLayoutInfo = vkinit::pipeline_layout_create_info();
+    scatterLayoutInfo.pPushConstantRanges = &scatterRange;
+    scatterLayoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(_device, &scatterLayoutInfo, nullptr, &_objectScatterPipelineLayout));
+
+    VkShaderModule scatterShader = pipelineRegistry.get_shader("../shaders/object_scatter.comp.spv");
+    if (scatterShader == VK_NULL_HANDLE) {
+        printf("Error when building the object scatter shader \n");
+        assert(false);
+    }
+
+    pipelineRegistry.request_compute(_objectScatterPipelineLayout, scatterShader, &_objectScatterPipeline);
+
+    _mainDeletionQueue.push_function([&]() {
+        destroy_buffer(_objectBuffer);
+        vkDestroyPipelineLayout(_device, _objectScatterPipelineLayout, nullptr);
         });
 }
 
 void TinyVulkan::init_pipelines()
 {
+    // One cache shared by every pipeline compile
+    VkPipelineCacheCreateInfo cacheInfo{ .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    VK_CHECK(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache));
+
+    pipelineRegistry.init(_device, _pipelineCache, &_workers);
+
     // Compute pipelines
     init_compute_pipelines();
+    init_occlusion_culling();
+    init_object_scatter();
+    mipGenerator.init(this);
+    postProcess.init(this);
+    clusteredLights.init(this, FRAME_OVERLAP);
+    shadowCascades.init(this, FRAME_OVERLAP);
+    backgroundCache.init(this);
 
     // Graphics pipelines
     metalRoughMaterial.build_pipelines(this);
+
+    // Everything above only queued compiles, wait for the workers to finish them
+    pipelineRegistry.wait();
+
+    _mainDeletionQueue.push_function([&]() {
+        mipGenerator.destroy();
+        postProcess.destroy();
+        clusteredLights.destroy();
+        shadowCascades.destroy();
+        backgroundCache.destroy();
+        pipelineRegistry.destroy();
+        vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+        });
 }
 
 void TinyVulkan::init_imgui()
@@ -546,15 +849,22 @@ void TinyVulkan::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& fun
 void TinyVulkan::cleanup()
 {
     if (_isInitialized) {
+        shaderWatcher.stop();
+
         // destroy resources in the opposite order they were created
         // make sure the gpu has stopped doing its things
         vkDeviceWaitIdle(_device);
+        renderGraph.destroy();
+        dynamicResolution.destroy();
         loadedScenes.clear();
+        resourceCache.destroy();
+        textureStreamer.destroy();
 
         for (int i = 0; i < FRAME_OVERLAP; i++) {
 
             //already written from before
             vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
+            vkDestroyCommandPool(_device, _frames[i]._computeCommandPool, nullptr);
 
             //destroy sync objects
             vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
@@ -562,9 +872,12 @@ void TinyVulkan::cleanup()
             vkDestroySemaphore(_device, _frames[i]._swapchainSemaphore, nullptr);
 
             // free per frame resources
-            _frames[i]._deletionQueue.flush();
+            destroy_buffer(_frames[i]._instanceBuffer);
+            destroy_buffer(_frames[i]._objectUploadBuffer);
         }
 
+        deletionQueue.flush();
+
         metalRoughMaterial.clear_resources(_device);
 
         // flush the global deletion queue
@@ -572,6 +885,8 @@ void TinyVulkan::cleanup()
 
         destroy_swapchain();
 
+        _workers.shutdown();
+
         vkDestroySurfaceKHR(_instance, _surface, nullptr);
         vkDestroyDevice(_device, nullptr);
 
@@ -584,7 +899,7 @@ void TinyVulkan::cleanup()
     loadedEngine = nullptr;
 }
 
-bool is_visible(const RenderObject& obj, const glm::mat4& viewproj) {
+bool is_visible(const DrawObject& obj, const glm::mat4& viewproj) {
     std::array<glm::vec3, 8> corners{
         glm::vec3 { 1, 1, 1 },
         glm::vec3 { 1, 1, -1 },
@@ -635,21 +950,109 @@ void TinyVulkan::draw_imgui(VkCommandBuffer cmd, VkImageView targetImageView)
     vkCmdEndRendering(cmd);
 }
 
-void TinyVulkan::draw_background(VkCommandBuffer cmd)
+void TinyVulkan::draw_background(VkCommandBuffer cmd, const DescriptorHandle& target, VkExtent2D extent, const AllocatedBuffer* tiles)
 {
     ComputeEffect& effect = backfroundEffects[currentBackgroundEffect];
 
     // Bind the background compute pipeline
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
 
-    // Bind the descriptor set containing the draw image for the compute pipeline
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, 1, &_drawImageDescriptors, 0, nullptr);
+    // Bind the descriptor set containing the target image for the compute pipeline
+    bind_descriptors(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _gradientPipelineLayout, 0, { &target, 1 });
 
     // Update the values of push constants
-    vkCmdPushConstants(cmd, _gradientPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.pushConstants);
+    BackgroundPushConstants pushConstants{};
+    pushConstants.effect = effect.pushConstants;
+    pushConstants.tileBuffer = tiles ? get_buffer_address(*tiles) : 0;
+    pushConstants.useTiles = tiles ? 1 : 0;
+    vkCmdPushConstants(cmd, _gradientPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BackgroundPushConstants), &pushConstants);
+
+    if (tiles) {
+        // one workgroup per listed tile, the classification wrote the count
+        vkCmdDispatchIndirect(cmd, tiles->buffer, 0);
+        return;
+    }
 
     // Execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it
-    vkCmdDispatch(cmd, std::ceil(_drawExtent.width / 16.0), std::ceil(_drawExtent.height / 16.0), 1);
+    vkCmdDispatch(cmd, std::ceil(extent.width / 16.0), std::ceil(extent.height / 16.0), 1);
+}
+
+void TinyVulkan::submit_async_compute(std::vector<VkImageMemoryBarrier2>& acquires, bool background)
+{
+    FrameData& frame = get_current_frame();
+    VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    // uploads only write images nothing samples yet, so they do not wait for the last frame
+    VkCommandBuffer streamingCmd = frame._streamingCommandBuffer;
+    VK_CHECK(vkResetCommandBuffer(streamingCmd, 0));
+    VK_CHECK(vkBeginCommandBuffer(streamingCmd, &beginInfo));
+    textureStreamer.update(streamingCmd, _frameNumber);
+    VK_CHECK(vkEndCommandBuffer(streamingCmd));
+    mipGenerator.take_acquire_barriers(acquires);
+
+    VkCommandBufferSubmitInfo streamingInfo = vkinit::command_buffer_submit_info(streamingCmd);
+    // also covers the streaming batch when the background follows it, it comes earlier on the queue
+    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _computeTimeline);
+    signalInfo.value = _frameNumber + 1;
+
+    if (!background) {
+        VkSubmitInfo2 submit = vkinit::submit_info(&streamingInfo, &signalInfo, nullptr);
+        VK_CHECK(vkQueueSubmit2(_computeQueue, 1, &submit, VK_NULL_HANDLE));
+        return;
+    }
+
+    VkCommandBuffer cmd = frame._computeCommandBuffer;
+    VK_CHECK(vkResetCommandBuffer(cmd, 0));
+    VK_CHECK(vkBeginCommandBuffer(cmd, &beginInfo));
+
+    // the background overwrites all of the draw image, the old contents and their owner do not matter
+    VkImageMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_NONE;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.image = _drawImage.image;
+    barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    depInfo.imageMemoryBarrierCount = 1;
+    depInfo.pImageMemoryBarriers = &barrier;
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+
+    draw_background(cmd, _drawImageDescriptors, _drawExtent);
+
+    // hand the draw image to the graphics queue, already in the layout the geometry pass draws in
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+    barrier.dstAccessMask = VK_ACCESS_2_NONE;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.srcQueueFamilyIndex = _computeQueueFamily;
+    barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    VkImageMemoryBarrier2 acquire = barrier;
+    acquire.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    acquire.srcAccessMask = VK_ACCESS_2_NONE;
+    acquire.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    acquire.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    acquires.push_back(acquire);
+
+    VkCommandBufferSubmitInfo computeInfo = vkinit::command_buffer_submit_info(cmd);
+
+    // the last frame reads the draw image until its upscale
+    VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, _graphicsTimeline);
+    waitInfo.value = _frameNumber;
+
+    VkSubmitInfo2 submits[2] = {
+        vkinit::submit_info(&streamingInfo, nullptr, nullptr),
+        vkinit::submit_info(&computeInfo, &signalInfo, &waitInfo),
+    };
+    VK_CHECK(vkQueueSubmit2(_computeQueue, 2, submits, VK_NULL_HANDLE));
 }
 
 void TinyVulkan::draw_geometry(VkCommandBuffer cmd)
@@ -657,6 +1060,7 @@ void TinyVulkan::draw_geometry(VkCommandBuffer cmd)
     //reset counters
     stats.drawcall_count = 0;
     stats.triangle_count = 0;
+    stats.triangles_saved = 0;
     //begin clock
     auto start = std::chrono::system_clock::now();
 
@@ -664,135 +1068,768 @@ void TinyVulkan::draw_geometry(VkCommandBuffer cmd)
     opaque_draws.reserve(mainDrawContext.OpaqueSurfaces.size());
 
     for (int i = 0; i < mainDrawContext.OpaqueSurfaces.size(); i++) {
-        if (is_visible(mainDrawContext.OpaqueSurfaces[i], sceneData.viewproj)) {
+        if (is_visible(mainDrawContext.objects[mainDrawContext.OpaqueSurfaces[i].objectIndex], sceneData.viewproj)) {
             opaque_draws.push_back(i);
         }
     }
 
+    if (bUseLods) {
+        for (uint32_t i : opaque_draws) {
+            select_lod(mainDrawContext.OpaqueSurfaces[i]);
+        }
+        for (RenderObject& obj : mainDrawContext.TransparentSurfaces) {
+            select_lod(obj);
+        }
+    }
+
+    // Ask for the texture detail the drawn surfaces cover on screen
+    auto request_textures = [&](const RenderObject& obj) {
+        const DrawObject& object = mainDrawContext.objects[obj.objectIndex];
+        float pixelsPerUnit = projected_pixels_per_unit(object);
+        float screenSize = pixelsPerUnit > 0.f ? 2.f * object.bounds.sphereRadius * pixelsPerUnit : std::numeric_limits<float>::max();
+        textureStreamer.request_material(obj.material, screenSize);
+        };
+    for (uint32_t i : opaque_draws) {
+        request_textures(mainDrawContext.OpaqueSurfaces[i]);
+    }
+    for (const RenderObject& obj : mainDrawContext.TransparentSurfaces) {
+        request_textures(obj);
+    }
+
     // sort the opaque surfaces by material and mesh
     std::sort(opaque_draws.begin(), opaque_draws.end(), [&](const auto& iA, const auto& iB) {
         const RenderObject& A = mainDrawContext.OpaqueSurfaces[iA];
         const RenderObject& B = mainDrawContext.OpaqueSurfaces[iB];
-        if (A.material == B.material) {
-            return A.indexBuffer < B.indexBuffer;
-        }
-        else {
+        if (A.material != B.material) {
             return A.material < B.material;
         }
+        if (A.mesh != B.mesh) {
+            return A.mesh < B.mesh;
+        }
+        // keeps the copies of a surface next to each other so they become one instanced draw
+        return A.firstIndex < B.firstIndex;
         });
 
-    // Begin a render pass  connected to our draw image
-    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_GENERAL);
-    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-
-    VkRenderingInfo renderInfo = vkinit::rendering_info(/*_windowExtent*/ _drawExtent, &colorAttachment, &depthAttachment);
-    
-    vkCmdBeginRendering(cmd, &renderInfo);
+    // The lights of every cluster, their buffers go into the scene data
+    clusteredLights.record(cmd, _frameNumber % FRAME_OVERLAP, sceneData, _drawExtent);
 
     //allocate a new uniform buffer for the scene data
-    AllocatedBuffer gpuSceneDataBuffer = create_buffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    AllocatedBuffer gpuSceneDataBuffer = create_buffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+        MemoryCategory::Transient);
 
-    //add it to the deletion queue of this frame so it gets deleted once its been used
-    get_current_frame()._deletionQueue.push_function([=, this]() {
-        destroy_buffer(gpuSceneDataBuffer);
-        });
+    //add it to the deletion queue so it gets deleted once this frame has been rendered
+    deletionQueue.push_buffer(gpuSceneDataBuffer);
 
     //write the buffer
     GPUSceneData* sceneUniformData = (GPUSceneData*)gpuSceneDataBuffer.allocation->GetMappedData();
     *sceneUniformData = sceneData;
 
     //create a descriptor set that binds that buffer and update it
-    VkDescriptorSet globalDescriptor = get_current_frame()._frameDescriptors.allocate(_device, _gpuSceneDataDescriptorLayout);
-
     DescriptorWriter writer;
     writer.write_buffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.update_set(_device, globalDescriptor);
+    writer.write_image(1, shadowCascades.view(), shadowCascades.sampler(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    DescriptorHandle globalDescriptor = write_frame_descriptors(_gpuSceneDataDescriptorLayout, writer, _gpuSceneDataDescriptorTemplate);
+
+    std::vector<uint32_t> transparent_draws(mainDrawContext.TransparentSurfaces.size());
+    std::iota(transparent_draws.begin(), transparent_draws.end(), 0);
+
+    write_instances(opaque_draws, transparent_draws);
+    uint32_t transparentInstance = static_cast<uint32_t>(opaque_draws.size());
+    _sceneDescriptor = globalDescriptor;
+    _transparentInstance = transparentInstance;
 
+    // Render passes connected to our draw image
+    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+    VkRenderingInfo colorPass = vkinit::rendering_info(/*_windowExtent*/ _drawExtent, &colorAttachment, &depthAttachment);
+    VkRenderingInfo depthPass = vkinit::rendering_info(_drawExtent, nullptr, &depthAttachment);
+
+    // the cached background fills what the opaque surfaces left empty, before the transparent ones blend over it.
+    // The uncovered background needs the finished depth first, both wait for draw_transparent_pass then
+    auto draw_transparent = [&]() {
+        if (backgroundMode == BackgroundMode::Uncovered) {
+            return;
+        }
+        if (backgroundMode == BackgroundMode::Cached) {
+            backgroundCache.draw(cmd, _drawExtent, backgroundCache.extent());
+        }
+        draw_objects(cmd, mainDrawContext.TransparentSurfaces, transparent_draws, transparentInstance, globalDescriptor, false);
+        };
+
+    auto render_pass = [&](const VkRenderingInfo& renderInfo, auto&& record) {
+        vkCmdBeginRendering(cmd, &renderInfo);
+        record();
+        vkCmdEndRendering(cmd);
+        // only the first pass clears depth, the later ones build on it
+        depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        };
+
+    const std::vector<RenderObject>& opaque = mainDrawContext.OpaqueSurfaces;
+
+    if ((bOcclusionCulling || bMeshletCulling) && !opaque_draws.empty()) {
+        uint32_t drawCount = static_cast<uint32_t>(opaque_draws.size());
+
+        // the counters are from the last time this frame was rendered
+        stats.triangle_count = _cullStats.triangleCount;
+        stats.occlusion_culled_count = bOcclusionCulling ? _cullStats.occludedCount : 0;
+        stats.meshlets_culled = _cullStats.culledMeshlets;
+
+        // may grow the indirect buffer, so grab its handle after
+        prepare_culling(cmd, opaque_draws);
+
+        VkBuffer indirectBuffer = get_current_frame()._indirectBuffer.buffer;
+        // the second phase commands follow the first phase ones
+        VkDeviceSize phaseOffset = drawCount * sizeof(VkDrawIndexedIndirectCommand);
+
+        if (!bOcclusionCulling) {
+            // frustum, cone and meshlet culling only, in a single pass
+            cull_objects(cmd, drawCount, CULL_PHASE_SINGLE);
+
+            if (bDepthPrepass) {
+                render_pass(depthPass, [&]() {
+                    draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, true, indirectBuffer, 0);
+                    });
+            }
+            render_pass(colorPass, [&]() {
+                draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, false, indirectBuffer, 0);
+                draw_transparent();
+                });
+        }
+        else {
+            // phase 0: what was visible last frame is drawn first and becomes the occluders
+            cull_objects(cmd, drawCount, CULL_PHASE_PREVIOUS);
+            render_pass(bDepthPrepass ? depthPass : colorPass, [&]() {
+                draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, bDepthPrepass, indirectBuffer, 0);
+                });
+
+            // phase 1: test everything against that depth, draw what phase 0 missed
+            build_hiz(cmd);
+            cull_objects(cmd, drawCount, CULL_PHASE_RETEST);
+
+            if (bDepthPrepass) {
+                render_pass(depthPass, [&]() {
+                    draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, true, indirectBuffer, phaseOffset);
+                    });
+                render_pass(colorPass, [&]() {
+                    draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, false, indirectBuffer, 0);
+                    draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, false, indirectBuffer, phaseOffset);
+                    draw_transparent();
+                    });
+            }
+            else {
+                render_pass(colorPass, [&]() {
+                    draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, false, indirectBuffer, phaseOffset);
+                    draw_transparent();
+                    });
+            }
+        }
+    }
+    else {
+        stats.occlusion_culled_count = 0;
+        stats.meshlets_culled = 0;
+
+        if (bDepthPrepass) {
+            render_pass(depthPass, [&]() {
+                draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, true);
+                });
+        }
+        render_pass(colorPass, [&]() {
+            draw_objects(cmd, opaque, opaque_draws, 0, globalDescriptor, false);
+            draw_transparent();
+            });
+    }
+
+    auto end = std::chrono::system_clock::now();
+
+    //convert to microseconds (integer), and then come back to miliseconds
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    stats.mesh_draw_time = elapsed.count() / 1000.f;
+}
+
+void TinyVulkan::draw_transparent_pass(VkCommandBuffer cmd)
+{
+    VkRenderingAttachmentInfo colorAttachment = vkinit::attachment_info(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    VkRenderingInfo renderInfo = vkinit::rendering_info(_drawExtent, &colorAttachment, &depthAttachment);
+
+    // draw_geometry already wrote the instances of the transparent surfaces after the opaque ones
+    std::vector<uint32_t> transparent_draws(mainDrawContext.TransparentSurfaces.size());
+    std::iota(transparent_draws.begin(), transparent_draws.end(), 0);
+
+    vkCmdBeginRendering(cmd, &renderInfo);
+    // the background texels match the draw image pixels, only the rendered part is shown
+    backgroundCache.draw(cmd, _drawExtent, _drawExtent);
+    draw_objects(cmd, mainDrawContext.TransparentSurfaces, transparent_draws, _transparentInstance, _sceneDescriptor, false);
+    vkCmdEndRendering(cmd);
+}
+
+void TinyVulkan::select_lod(RenderObject& obj)
+{
+    if (obj.lodCount == 0) {
+        return;
+    }
+
+    float pixelsPerUnit = projected_pixels_per_unit(mainDrawContext.objects[obj.objectIndex]);
+    // the camera is inside the bounds, keep full detail
+    if (pixelsPerUnit <= 0.f) {
+        return;
+    }
+
+    uint32_t fullCount = obj.indexCount;
+    const PooledMesh& mesh = resourceCache.meshData.get(obj.mesh);
+    for (uint32_t i = 0; i < obj.lodCount; i++) {
+        const SurfaceLOD& lod = mesh.lods[obj.firstLod + i];
+        if (lod.error * pixelsPerUnit > lodErrorThreshold) {
+            break;
+        }
+        obj.indexCount = lod.count;
+        obj.firstIndex = lod.startIndex;
+        // meshlets only cover the full detail range
+        obj.meshletCount = 0;
+    }
+
+    stats.triangles_saved += (fullCount - obj.indexCount) / 3;
+}
+
+float TinyVulkan::projected_pixels_per_unit(const DrawObject& obj) const
+{
+    // mesh units are scaled by the largest axis of the transform
+    float scale = std::max({ glm::length(glm::vec3(obj.transform[0])), glm::length(glm::vec3(obj.transform[1])),
+        glm::length(glm::vec3(obj.transform[2])) });
+
+    glm::vec3 center = glm::vec3(obj.transform * glm::vec4(obj.bounds.origin, 1.f));
+    float distance = glm::length(center - mainCamera.position) - obj.bounds.sphereRadius * scale;
+    if (distance <= 0.f) {
+        return 0.f;
+    }
+
+    // pixels covered by one world unit at that distance
+    return std::abs(sceneData.proj[1][1]) * 0.5f * _drawExtent.height / distance * scale;
+}
+
+void TinyVulkan::update_objects(VkCommandBuffer cmd)
+{
+    FrameData& frame = get_current_frame();
+    uint32_t objectCount = static_cast<uint32_t>(mainDrawContext.objects.size());
+
+    stats.objects_updated = 0;
+    if (objectCount == 0) {
+        return;
+    }
+
+    if (_objectCapacity < objectCount) {
+        // the frames in flight still read the old buffer, it goes once they retire
+        if (_objectBuffer.buffer != VK_NULL_HANDLE) {
+            deletionQueue.push_buffer(_objectBuffer);
+        }
+
+        _objectCapacity = std::max(objectCount, _objectCapacity * 2);
+        _objectBuffer = create_buffer(_objectCapacity * sizeof(GPUObjectData),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        // nothing in the new buffer is valid yet
+        _uploadedObjects.clear();
+    }
+
+    // The object indices only stay meaningful while the scene adds the same objects
+    bool uploadAll = _uploadedObjects.size() != objectCount;
+    _uploadedObjects.resize(objectCount);
+
+    // This frame's fence was waited on, nothing else uses its buffer
+    if (frame._objectUploadCapacity < objectCount) {
+        destroy_buffer(frame._objectUploadBuffer);
+
+        frame._objectUploadCapacity = std::max(objectCount, frame._objectUploadCapacity * 2);
+        frame._objectUploadBuffer = create_buffer(frame._objectUploadCapacity * sizeof(GPUObjectUpload),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Transient);
+    }
+
+    GPUObjectUpload* uploads = (GPUObjectUpload*)frame._objectUploadBuffer.info.pMappedData;
+    uint32_t uploadCount = 0;
+
+    auto write_object = [&](const RenderObject& r) {
+        uint32_t objectIndex = r.objectIndex;
+        const DrawObject& object = mainDrawContext.objects[objectIndex];
+
+        GPUObjectData data;
+        glm::mat4 rows = glm::transpose(object.transform);
+        data.transformRows[0] = rows[0];
+        data.transformRows[1] = rows[1];
+        data.transformRows[2] = rows[2];
+        data.boundsSphere = glm::vec4(object.bounds.origin, object.bounds.sphereRadius);
+        data.boundsExtents = object.bounds.extents;
+        data.materialIndex = resourceCache.materials.get(r.material).materialIndex;
+
+        // GPUObjectData has no padding, so equal bytes mean an unchanged object
+        if (!uploadAll && memcmp(&_uploadedObjects[objectIndex], &data, sizeof(GPUObjectData)) == 0) {
+            return;
+        }
+        _uploadedObjects[objectIndex] = data;
+
+        uploads[uploadCount].data = data;
+        uploads[uploadCount].objectIndex = objectIndex;
+        uploadCount++;
+        };
+
+    for (const RenderObject& r : mainDrawContext.OpaqueSurfaces) {
+        write_object(r);
+    }
+    for (const RenderObject& r : mainDrawContext.TransparentSurfaces) {
+        write_object(r);
+    }
+
+    stats.objects_updated = uploadCount;
+    if (uploadCount == 0) {
+        return;
+    }
+
+    // the previous frame may still be drawing with the objects about to be overwritten
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT);
+
+    ObjectScatterPushConstants pushConstants;
+    pushConstants.uploadBuffer = get_buffer_address(frame._objectUploadBuffer);
+    pushConstants.objectBuffer = get_buffer_address(_objectBuffer);
+    pushConstants.uploadCount = uploadCount;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _objectScatterPipeline);
+    vkCmdPushConstants(cmd, _objectScatterPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ObjectScatterPushConstants), &pushConstants);
+    vkCmdDispatch(cmd, (uploadCount + 63) / 64, 1, 1);
+
+    // read by the culling and the vertex shaders
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+}
+
+void TinyVulkan::write_instances(std::span<const uint32_t> opaqueDraws, std::span<const uint32_t> transparentDraws)
+{
+    FrameData& frame = get_current_frame();
+    uint32_t instanceCount = static_cast<uint32_t>(opaqueDraws.size() + transparentDraws.size());
+
+    // This frame's fence was waited on, nothing else uses its buffer
+    if (frame._instanceCapacity < instanceCount) {
+        destroy_buffer(frame._instanceBuffer);
+
+        frame._instanceCapacity = std::max(instanceCount, frame._instanceCapacity * 2);
+        frame._instanceBuffer = create_buffer(frame._instanceCapacity * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Transient);
+    }
+
+    uint32_t* instances = (uint32_t*)frame._instanceBuffer.info.pMappedData;
+    for (uint32_t i : opaqueDraws) {
+        *(instances++) = mainDrawContext.OpaqueSurfaces[i].objectIndex;
+    }
+    for (uint32_t i : transparentDraws) {
+        *(instances++) = mainDrawContext.TransparentSurfaces[i].objectIndex;
+    }
+}
+
+void TinyVulkan::draw_objects(VkCommandBuffer cmd, const std::vector<RenderObject>& objects, std::span<const uint32_t> draws,
+    uint32_t firstInstance, const DescriptorHandle& globalDescriptor, bool depthOnly, VkBuffer indirectBuffer, VkDeviceSize indirectOffset)
+{
     MaterialPipeline* lastPipeline = nullptr;
-    MaterialInstance* lastMaterial = nullptr;
+    MaterialHandle lastMaterial{};
     VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+    VkDeviceAddress lastVertexBuffer = 0;
 
-    auto draw = [&](const RenderObject& r) {
-        if (r.material != lastMaterial) {
-            lastMaterial = r.material;
-            //rebind pipeline and descriptors if the material changed
-            if (r.material->pipeline != lastPipeline) {
-
-                lastPipeline = r.material->pipeline;
-                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
-                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 0, 1,
-                    &globalDescriptor, 0, nullptr);
-
-                VkViewport viewport = {};
-                viewport.x = 0;
-                viewport.y = 0;
-                viewport.width = (float)_windowExtent.width;
-                viewport.height = (float)_windowExtent.height;
-                viewport.minDepth = 0.f;
-                viewport.maxDepth = 1.f;
-
-                vkCmdSetViewport(cmd, 0, 1, &viewport);
-
-                VkRect2D scissor = {};
-                scissor.offset.x = 0;
-                scissor.offset.y = 0;
-                scissor.extent.width = _windowExtent.width;
-                scissor.extent.height = _windowExtent.height;
-
-                vkCmdSetScissor(cmd, 0, 1, &scissor);
+    if (draws.empty()) {
+        return;
+    }
+    VkDeviceAddress instanceBuffer = get_buffer_address(get_current_frame()._instanceBuffer);
+    VkDeviceAddress objectBuffer = get_buffer_address(_objectBuffer);
+
+    // meshlet culled objects read the indices the culling wrote for them
+    auto index_buffer_of = [&](const RenderObject& r) {
+        if (indirectBuffer != VK_NULL_HANDLE && uses_meshlets(r)) {
+            return get_current_frame()._expandedIndexBuffer.buffer;
+        }
+        return resourceCache.meshData.get(r.mesh).buffers.indexBuffer.buffer;
+        };
+
+    // whether b can go in the same draw as a. Indirect commands carry their own index range
+    auto same_batch = [&](const RenderObject& a, const RenderObject& b) {
+        if ((!depthOnly && a.material != b.material) || a.mesh != b.mesh
+            || index_buffer_of(a) != index_buffer_of(b)) {
+            return false;
+        }
+        return indirectBuffer != VK_NULL_HANDLE || (a.firstIndex == b.firstIndex && a.indexCount == b.indexCount);
+        };
+
+    for (size_t i = 0; i < draws.size();) {
+        const RenderObject& r = objects[draws[i]];
+
+        size_t runEnd = i + 1;
+        while (runEnd < draws.size() && same_batch(r, objects[draws[runEnd]])) {
+            runEnd++;
+        }
+        uint32_t runLength = static_cast<uint32_t>(runEnd - i);
+
+        // depth passes share one pipeline and do not need the material data
+        const MaterialInstance* material = depthOnly ? nullptr : &resourceCache.materials.get(r.material);
+        MaterialPipeline* pipeline = depthOnly ? &metalRoughMaterial.depthOnlyPipeline : material->pipeline;
+
+        //rebind pipeline and descriptors if the material changed
+        if (pipeline != lastPipeline) {
+            lastPipeline = pipeline;
+            // the push constants do not survive a layout change
+            lastVertexBuffer = 0;
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+            // the other passes bind the scene set together with the material set
+            if (depthOnly) {
+                bind_descriptors(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, { &globalDescriptor, 1 });
             }
 
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 1, 1,
-                &r.material->materialSet, 0, nullptr);
+            VkViewport viewport = {};
+            viewport.x = 0;
+            viewport.y = 0;
+            viewport.width = (float)_drawExtent.width;
+            viewport.height = (float)_drawExtent.height;
+            viewport.minDepth = 0.f;
+            viewport.maxDepth = 1.f;
+
+            vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+            VkRect2D scissor = {};
+            scissor.offset.x = 0;
+            scissor.offset.y = 0;
+            scissor.extent = _drawExtent;
+
+            vkCmdSetScissor(cmd, 0, 1, &scissor);
+        }
+
+        // a descriptor buffer bind replaces the scene set as well, so it goes in again with every material
+        if (!depthOnly && r.material != lastMaterial) {
+            lastMaterial = r.material;
+            DescriptorHandle sets[] = { globalDescriptor, material->materialSet };
+            bind_descriptors(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout, 0, sets);
         }
+
         //rebind index buffer if needed
-        if (r.indexBuffer != lastIndexBuffer) {
-            lastIndexBuffer = r.indexBuffer;
-            vkCmdBindIndexBuffer(cmd, r.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+        VkBuffer indexBuffer = index_buffer_of(r);
+        if (indexBuffer != lastIndexBuffer) {
+            lastIndexBuffer = indexBuffer;
+            vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
         }
-        // calculate final mesh matrix
-        GPUDrawPushConstants push_constants;
-        push_constants.worldMatrix = r.transform;
-        push_constants.vertexBuffer = r.vertexBufferAddress;
 
-        vkCmdPushConstants(cmd, r.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+        // the transforms come from the instance buffer, so only the mesh changes the push constants
+        VkDeviceAddress vertexBuffer = resourceCache.meshData.get(r.mesh).buffers.vertexBufferAddress;
+        if (vertexBuffer != lastVertexBuffer) {
+            lastVertexBuffer = vertexBuffer;
+
+            GPUDrawPushConstants push_constants;
+            push_constants.vertexBuffer = vertexBuffer;
+            push_constants.instanceBuffer = instanceBuffer;
+            push_constants.objectBuffer = objectBuffer;
+
+            vkCmdPushConstants(cmd, pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+        }
 
-        vkCmdDrawIndexed(cmd, r.indexCount, 1, r.firstIndex, 0, 0);
+        if (indirectBuffer != VK_NULL_HANDLE) {
+            // culling decided the instance counts and picks the instances, the triangles are counted on the gpu
+            vkCmdDrawIndexedIndirect(cmd, indirectBuffer, indirectOffset + i * sizeof(VkDrawIndexedIndirectCommand), runLength,
+                sizeof(VkDrawIndexedIndirectCommand));
+        }
+        else {
+            vkCmdDrawIndexed(cmd, r.indexCount, runLength, r.firstIndex, 0, firstInstance + static_cast<uint32_t>(i));
+            if (!depthOnly) {
+                stats.triangle_count += r.indexCount / 3 * runLength;
+            }
+        }
         //stats
         stats.drawcall_count++;
-        stats.triangle_count += r.indexCount / 3;
-        };
 
-    for (auto& surface : opaque_draws) {
-        draw(mainDrawContext.OpaqueSurfaces[surface]);
+        i = runEnd;
     }
+}
 
-    for (auto& surface : mainDrawContext.TransparentSurfaces) {
-        draw(surface);
+void TinyVulkan::prepare_culling(VkCommandBuffer cmd, std::span<const uint32_t> draws)
+{
+    FrameData& frame = get_current_frame();
+    uint32_t drawCount = static_cast<uint32_t>(draws.size());
+    uint32_t objectCount = static_cast<uint32_t>(mainDrawContext.objects.size());
+
+    // This frame's fence was waited on, nothing else uses its buffers
+    if (frame._cullCapacity < drawCount) {
+        destroy_buffer(frame._cullObjectBuffer);
+        destroy_buffer(frame._indirectBuffer);
+
+        frame._cullCapacity = std::max(drawCount, frame._cullCapacity * 2);
+        frame._cullObjectBuffer = create_buffer(frame._cullCapacity * sizeof(GPUCullObject),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Transient);
+        // one command per draw for each of the two phases
+        frame._indirectBuffer = create_buffer(frame._cullCapacity * 2 * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Transient);
     }
 
-    vkCmdEndRendering(cmd);
+    // The previous frame's culling may still be writing the visibility buffer
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
 
-    auto end = std::chrono::system_clock::now();
+    // Visibility is indexed by object, so it only carries over while the object list stays the same
+    if (_visibilityObjectCount != objectCount) {
+        if (_visibilityCapacity < objectCount) {
+            // the frames in flight still read the old buffer, it goes once they retire
+            if (_visibilityBuffer.buffer != VK_NULL_HANDLE) {
+                deletionQueue.push_buffer(_visibilityBuffer);
+            }
 
-    //convert to microseconds (integer), and then come back to miliseconds
-    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-    stats.mesh_draw_time = elapsed.count() / 1000.f;
+            _visibilityCapacity = std::max(objectCount, _visibilityCapacity * 2);
+            _visibilityBuffer = create_buffer(_visibilityCapacity * sizeof(uint32_t),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Transient);
+        }
+
+        // start with everything visible, phase 0 then draws it all once
+        vkCmdFillBuffer(cmd, _visibilityBuffer.buffer, 0, VK_WHOLE_SIZE, 1);
+        _visibilityObjectCount = objectCount;
+    }
+
+    vkCmdFillBuffer(cmd, frame._cullStatsBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    // Every meshlet object gets room for all of its triangles in the expanded index buffer
+    uint32_t meshletCount = 0;
+    uint32_t expandedIndexCount = 0;
+    for (uint32_t i = 0; i < drawCount; i++) {
+        const RenderObject& r = mainDrawContext.OpaqueSurfaces[draws[i]];
+        if (uses_meshlets(r)) {
+            meshletCount += r.meshletCount;
+            expandedIndexCount += r.indexCount;
+        }
+    }
+
+    if (frame._meshletWorkCapacity < meshletCount) {
+        destroy_buffer(frame._meshletWorkBuffer);
+
+        frame._meshletWorkCapacity = std::max(meshletCount, frame._meshletWorkCapacity * 2);
+        frame._meshletWorkBuffer = create_buffer(frame._meshletWorkCapacity * sizeof(GPUMeshletWork),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU, MemoryCategory::Transient);
+    }
+    if (frame._expandedIndexCapacity < expandedIndexCount) {
+        destroy_buffer(frame._expandedIndexBuffer);
+
+        frame._expandedIndexCapacity = std::max(expandedIndexCount, frame._expandedIndexCapacity * 2);
+        frame._expandedIndexBuffer = create_buffer(frame._expandedIndexCapacity * sizeof(uint32_t),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Transient);
+    }
+
+    GPUCullObject* cullObjects = (GPUCullObject*)frame._cullObjectBuffer.info.pMappedData;
+    GPUMeshletWork* meshletWork = (GPUMeshletWork*)frame._meshletWorkBuffer.info.pMappedData;
+    uint32_t expandedFirstIndex = 0;
+    _meshletWorkCount = 0;
+
+    for (uint32_t i = 0; i < drawCount; i++) {
+        const RenderObject& r = mainDrawContext.OpaqueSurfaces[draws[i]];
+
+        cullObjects[i].indexCount = r.indexCount;
+        cullObjects[i].firstIndex = r.firstIndex;
+        cullObjects[i].objectIndex = r.objectIndex;
+        cullObjects[i].expandedFirstIndex = NO_MESHLET_EXPANSION;
+
+        if (!uses_meshlets(r)) {
+            continue;
+        }
+
+        cullObjects[i].expandedFirstIndex = expandedFirstIndex;
+        expandedFirstIndex += r.indexCount;
+
+        const PooledMesh& mesh = resourceCache.meshData.get(r.mesh);
+        for (uint32_t m = 0; m < r.meshletCount; m++) {
+            const Meshlet& meshlet = mesh.meshlets[r.firstMeshlet + m];
+            GPUMeshletWork& work = meshletWork[_meshletWorkCount++];
+            work.sphere = glm::vec4(meshlet.center, meshlet.radius);
+            work.cone = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff);
+            work.indexBuffer = mesh.buffers.indexBufferAddress;
+            work.drawIndex = i;
+            work.firstIndex = r.firstIndex + meshlet.firstIndex;
+            work.triangleCount = meshlet.triangleCount;
+            work.objectIndex = r.objectIndex;
+            work.expandedFirstIndex = cullObjects[i].expandedFirstIndex;
+            work.pad = 0;
+        }
+    }
+
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
 }
 
-void TinyVulkan::draw()
+void TinyVulkan::cull_objects(VkCommandBuffer cmd, uint32_t objectCount, uint32_t phase)
+{
+    FrameData& frame = get_current_frame();
+
+    CullPushConstants pushConstants;
+    pushConstants.viewproj = sceneData.viewproj;
+    pushConstants.objectBuffer = get_buffer_address(frame._cullObjectBuffer);
+    pushConstants.objectDataBuffer = get_buffer_address(_objectBuffer);
+    // only the retest phase writes the second half of the command buffer
+    VkDeviceSize commandOffset = phase == CULL_PHASE_RETEST ? objectCount * sizeof(VkDrawIndexedIndirectCommand) : 0;
+    pushConstants.commandBuffer = get_buffer_address(frame._indirectBuffer) + commandOffset;
+    pushConstants.visibilityBuffer = get_buffer_address(_visibilityBuffer);
+    pushConstants.statsBuffer = get_buffer_address(frame._cullStatsBuffer);
+    pushConstants.objectCount = objectCount;
+    pushConstants.phase = phase;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullPipelineLayout, 0, 1, &_cullDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, _cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants), &pushConstants);
+
+    // 64 objects per workgroup
+    vkCmdDispatch(cmd, (objectCount + 63) / 64, 1, 1);
+
+    // The draws read their commands, the meshlets and the next phase read the visibility
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+    if (_meshletWorkCount == 0) {
+        return;
+    }
+
+    MeshletCullPushConstants meshletConstants;
+    meshletConstants.viewproj = sceneData.viewproj;
+    meshletConstants.cameraPosition = glm::vec4(mainCamera.position, 1.f);
+    meshletConstants.workBuffer = get_buffer_address(frame._meshletWorkBuffer);
+    meshletConstants.objectDataBuffer = pushConstants.objectDataBuffer;
+    meshletConstants.commandBuffer = pushConstants.commandBuffer;
+    meshletConstants.expandedBuffer = get_buffer_address(frame._expandedIndexBuffer);
+    meshletConstants.statsBuffer = pushConstants.statsBuffer;
+    meshletConstants.workCount = _meshletWorkCount;
+    meshletConstants.phase = phase;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullPipelineLayout, 0, 1, &_cullDescriptor, 0, nullptr);
+    vkCmdPushConstants(cmd, _meshletCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullPushConstants), &meshletConstants);
+
+    // One workgroup per meshlet, spread over y past the guaranteed x group count limit
+    uint32_t groupsX = std::min(_meshletWorkCount, 65535u);
+    vkCmdDispatch(cmd, groupsX, (_meshletWorkCount + groupsX - 1) / groupsX, 1);
+
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT);
+}
+
+void TinyVulkan::build_hiz(VkCommandBuffer cmd)
+{
+    VkImageSubresourceRange depthRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_DEPTH_BIT);
+    vkutil::image_barrier(cmd, _depthImage.image, depthRange, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+    // every level gets rewritten, the old pyramid is not needed. Only the culling of the last frame read it
+    vkutil::image_barrier(cmd, _hizImage.image, vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT),
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _hizBuildPipeline);
+
+    // only the draw extent of the depth image was rendered to
+    VkExtent2D inputSize = _drawExtent;
+    for (uint32_t mip = 0; mip < _hizMipViews.size(); mip++) {
+        VkExtent2D outputSize = {
+            std::max(_hizImage.imageExtent.width >> mip, 1u),
+            std::max(_hizImage.imageExtent.height >> mip, 1u)
+        };
+
+        HiZPushConstants pushConstants;
+        pushConstants.inputSize = glm::vec2(inputSize.width, inputSize.height);
+        pushConstants.outputSize = glm::vec2(outputSize.width, outputSize.height);
+
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _hizBuildPipelineLayout, 0, 1, &_hizBuildDescriptors[mip], 0, nullptr);
+        vkCmdPushConstants(cmd, _hizBuildPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZPushConstants), &pushConstants);
+        vkCmdDispatch(cmd, (outputSize.width + 15) / 16, (outputSize.height + 15) / 16, 1);
+
+        // the next level reads this one, the culling all of them
+        VkImageSubresourceRange mipRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        mipRange.baseMipLevel = mip;
+        mipRange.levelCount = 1;
+        vkutil::image_barrier(cmd, _hizImage.image, mipRange, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+        inputSize = outputSize;
+    }
+
+    // the phase 1 draws test and write the depth the pyramid was read from
+    vkutil::image_barrier(cmd, _depthImage.image, depthRange, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+        VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_NONE,
+        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+}
+
+void TinyVulkan::scatter_test_lights()
 {
-    _drawExtent.height = std::min(_swapchainExtent.height, _drawImage.imageExtent.height) * renderScale;
-    _drawExtent.width = std::min(_swapchainExtent.width, _drawImage.imageExtent.width) * renderScale;
+    // the bounds of the drawn surfaces, around the origin before anything was drawn
+    glm::vec3 low(-10.f);
+    glm::vec3 high(10.f);
+    if (!mainDrawContext.OpaqueSurfaces.empty()) {
+        low = glm::vec3(std::numeric_limits<float>::max());
+        high = glm::vec3(std::numeric_limits<float>::lowest());
+        for (const RenderObject& obj : mainDrawContext.OpaqueSurfaces) {
+            const DrawObject& object = mainDrawContext.objects[obj.objectIndex];
+            glm::vec3 center = object.transform * glm::vec4(object.bounds.origin, 1.f);
+            low = glm::min(low, center);
+            high = glm::max(high, center);
+        }
+    }
 
+    // fixed seed, the same count always gives the same lights
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    float sceneSize = glm::length(high - low);
+
+    clusteredLights.lights.resize(testLightCount);
+    for (size_t i = 0; i < clusteredLights.lights.size(); i++) {
+        GPULight& light = clusteredLights.lights[i];
+
+        glm::vec3 position = low + (high - low) * glm::vec3(unit(rng), unit(rng), unit(rng));
+        float range = sceneSize * (0.02f + 0.04f * unit(rng));
+        light.positionRange = glm::vec4(position, range);
+        // about as bright as the sun halfway to the range
+        light.colorIntensity = glm::vec4(unit(rng), unit(rng), unit(rng), range * range * 0.25f);
+
+        // every fourth one is a spot light pointing down
+        if (i % 4 == 3) {
+            light.spotDirection = glm::vec4(0.f, -1.f, 0.f, std::cos(glm::radians(40.f)));
+            light.spotParams = glm::vec4(std::cos(glm::radians(25.f)), 0.f, 0.f, 0.f);
+        }
+        else {
+            light.spotDirection = glm::vec4(0.f, 0.f, 0.f, -1.f);
+            light.spotParams = glm::vec4(0.f);
+        }
+    }
+}
+
+void TinyVulkan::draw()
+{
     update_scene();
 
     // Wait until the gpu has finished rendering the last frame. Timeout of 1 second.
     VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame()._renderFence, true, 1000000000));
 
-    // Delete objs created for specific frame only
-    get_current_frame()._deletionQueue.flush();
+    // Delete what the finished frames were the last to use, what this one releases waits for its submit
+    uint64_t completedFrames;
+    VK_CHECK(vkGetSemaphoreCounterValue(_device, _graphicsTimeline, &completedFrames));
+    deletionQueue.collect(completedFrames);
+    deletionQueue.set_release_value(_frameNumber + 1);
     get_current_frame()._frameDescriptors.clear_descriptors(_device);
+    if (_descriptorBuffers) {
+        get_current_frame()._frameDescriptorBuffer.clear();
+    }
+
+    memoryTracker.update(_frameNumber);
+
+    // The timestamps of the last time this frame was rendered are in, they pick the resolution of this one
+    float renderScale = dynamicResolution.update(_frameNumber % FRAME_OVERLAP);
+    _drawExtent.width = std::max(1u, static_cast<uint32_t>(std::min(_swapchainExtent.width, _drawImage.imageExtent.width) * renderScale));
+    _drawExtent.height = std::max(1u, static_cast<uint32_t>(std::min(_swapchainExtent.height, _drawImage.imageExtent.height) * renderScale));
+
+    // Culling counters written the last time this frame was rendered
+    vmaInvalidateAllocation(_allocator, get_current_frame()._cullStatsBuffer.allocation, 0, VK_WHOLE_SIZE);
+    _cullStats = *(GPUCullStats*)get_current_frame()._cullStatsBuffer.info.pMappedData;
 
     // Fences have to be reset between uses
     VK_CHECK(vkResetFences(_device, 1, &get_current_frame()._renderFence));
@@ -817,37 +1854,102 @@ void TinyVulkan::draw()
     // Begin the command buffer recording. We will use this command buffer exactly once, so we want to let vulkan know that
     VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 
-    _drawExtent.width = _drawImage.imageExtent.width;
-    _drawExtent.height = _drawImage.imageExtent.height;
-
     // Start recording command buffers
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
+    dynamicResolution.begin_frame(cmd, _frameNumber % FRAME_OVERLAP);
 
-    // Transition our main draw image into general layout so we can write into it
-    // we will overwrite it all so we dont care about what was the older layout
-    vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    if (_asyncCompute) {
+        // take over what the compute queue wrote before anything here uses it
+        std::vector<VkImageMemoryBarrier2> acquires;
+        submit_async_compute(acquires, backgroundMode == BackgroundMode::EveryFrame);
 
-    draw_background(cmd);
+        VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        depInfo.imageMemoryBarrierCount = static_cast<uint32_t>(acquires.size());
+        depInfo.pImageMemoryBarriers = acquires.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+    }
+    else {
+        // Swap in the mips streamed since last frame before anything samples them
+        textureStreamer.update(cmd, _frameNumber);
+    }
 
-    vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-    vkutil::transition_image(cmd, _depthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    // The object buffer is shared by the shadow and geometry passes
+    update_objects(cmd);
+
+    // Moved or added objects could cast into any cascade, so they drop the cached ones
+    shadowCascades.prepare(_frameNumber % FRAME_OVERLAP, mainDrawContext, sceneData, mainCamera.position,
+        stats.objects_updated > 0);
+
+    // The passes only declare how they use the images, the graph records the barriers between them
+    renderGraph.begin();
+
+    // with async compute the acquire barrier above leaves the draw image ready for the geometry pass
+    bool asyncBackground = _asyncCompute && backgroundMode == BackgroundMode::EveryFrame;
+    RenderGraph::ImageState backgroundDone{ VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    RGImage drawImage = renderGraph.import_image("draw", _drawImage.image, _drawImage.imageView, _drawImage.imageExtent,
+        _drawImage.imageFormat, asyncBackground ? &backgroundDone : nullptr);
+    RGImage depthImage = renderGraph.import_image("depth", _depthImage.image, _depthImage.imageView, _depthImage.imageExtent,
+        _depthImage.imageFormat);
+
+    // the acquire semaphore is waited on at the color output stage, the first barrier has to chain after it
+    RenderGraph::ImageState acquired{ VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT };
+    RGImage swapchainImage = renderGraph.import_image("swapchain", _swapchainImages[swapchainImageIndex],
+        _swapchainImageViews[swapchainImageIndex], VkExtent3D{ _swapchainExtent.width, _swapchainExtent.height, 1 },
+        _swapchainImageFormat, &acquired);
+
+    RGImage backgroundImage = 0;
+    if (backgroundMode == BackgroundMode::Cached) {
+        // only rendered again when the effect changed, the geometry pass draws it where nothing else is
+        ComputeEffect& effect = backfroundEffects[currentBackgroundEffect];
+        if (backgroundCache.import(renderGraph, currentBackgroundEffect, effect, backgroundImage)) {
+            renderGraph.add_pass("background", { { backgroundImage, ImageUsage::StorageWrite } },
+                [&](VkCommandBuffer cmd) { draw_background(cmd, backgroundCache.target(), backgroundCache.extent()); });
+        }
+    }
+    else if (backgroundMode == BackgroundMode::Uncovered) {
+        backgroundImage = backgroundCache.import_uncovered(renderGraph);
+    }
+    else if (!_asyncCompute) {
+        renderGraph.add_pass("background", { { drawImage, ImageUsage::StorageWrite } },
+            [&](VkCommandBuffer cmd) { draw_background(cmd, _drawImageDescriptors, _drawExtent); });
+    }
 
-    draw_geometry(cmd);
+    RGImage shadowMap = shadowCascades.add_pass(renderGraph, _frameNumber % FRAME_OVERLAP);
+
+    if (backgroundMode == BackgroundMode::Cached) {
+        renderGraph.add_pass("geometry", { { drawImage, ImageUsage::ColorAttachment }, { depthImage, ImageUsage::DepthAttachment },
+            { shadowMap, ImageUsage::Sampled }, { backgroundImage, ImageUsage::Sampled } },
+            [&](VkCommandBuffer cmd) { draw_geometry(cmd); });
+    }
+    else {
+        renderGraph.add_pass("geometry", { { drawImage, ImageUsage::ColorAttachment }, { depthImage, ImageUsage::DepthAttachment },
+            { shadowMap, ImageUsage::Sampled } },
+            [&](VkCommandBuffer cmd) { draw_geometry(cmd); });
+    }
 
-    //transtion the draw image and the swapchain image into their correct transfer layouts
-    vkutil::transition_image(cmd, _drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    // Execute a copy from the draw image into the swapchain
-    vkutil::copy_image_to_image(cmd, _drawImage.image, _swapchainImages[swapchainImageIndex], _drawExtent, _swapchainExtent);
+    if (backgroundMode == BackgroundMode::Uncovered) {
+        // the effect only runs on the tiles the opaque surfaces left some pixel of, the transparent ones go over it after
+        renderGraph.add_pass("background", { { depthImage, ImageUsage::Sampled }, { backgroundImage, ImageUsage::StorageWrite } },
+            [&](VkCommandBuffer cmd) {
+                backgroundCache.classify_tiles(cmd, _drawExtent);
+                draw_background(cmd, backgroundCache.target(), _drawExtent, &backgroundCache.tiles());
+            });
+        renderGraph.add_pass("transparent", { { drawImage, ImageUsage::ColorAttachment }, { depthImage, ImageUsage::DepthAttachment },
+            { shadowMap, ImageUsage::Sampled }, { backgroundImage, ImageUsage::Sampled } },
+            [&](VkCommandBuffer cmd) { draw_transparent_pass(cmd); });
+    }
 
-    // Set swapchain image layout to Attachment Optimal so we can draw it
-    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    // Tonemap, upscale and sharpen the rendered part of the draw image into the swapchain
+    postProcess.add_passes(renderGraph, drawImage, _drawExtent, swapchainImage, _swapchainExtent);
 
     // Draw imgui into the swapchain image
-    draw_imgui(cmd, _swapchainImageViews[swapchainImageIndex]);
+    renderGraph.add_pass("imgui", { { swapchainImage, ImageUsage::ColorAttachment } },
+        [&](VkCommandBuffer cmd) { draw_imgui(cmd, _swapchainImageViews[swapchainImageIndex]); });
+
+    renderGraph.present(swapchainImage);
+    renderGraph.execute(cmd);
 
-    // Set swapchain image layout to Present so we can draw it
-    vkutil::transition_image(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    dynamicResolution.end_frame(cmd, _frameNumber % FRAME_OVERLAP);
 
     // Finalize the command buffer (we can no longer add commands, but it can now be executed)
     VK_CHECK(vkEndCommandBuffer(cmd));
@@ -858,10 +1960,22 @@ void TinyVulkan::draw()
 
     VkCommandBufferSubmitInfo cmdinfo = vkinit::command_buffer_submit_info(cmd);
 
-    VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore);
-    VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame()._renderSemaphore);
+    VkSemaphoreSubmitInfo waitInfos[2] = {
+        vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame()._swapchainSemaphore),
+        // the background and the streamed textures, first needed by the color output and the fragment shaders
+        vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, _computeTimeline),
+    };
+    waitInfos[1].value = _frameNumber + 1;
+
+    VkSemaphoreSubmitInfo signalInfos[2] = {
+        vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame()._renderSemaphore),
+        vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _graphicsTimeline),
+    };
+    signalInfos[1].value = _frameNumber + 1;
 
-    VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, &signalInfo, &waitInfo);
+    VkSubmitInfo2 submit = vkinit::submit_info(&cmdinfo, signalInfos, waitInfos);
+    submit.waitSemaphoreInfoCount = _asyncCompute ? 2 : 1;
+    submit.signalSemaphoreInfoCount = 2;
 
     // Submit command buffer to the queue and execute it.
     // _renderFence will now block until the graphic commands finish execution
@@ -934,13 +2048,26 @@ void TinyVulkan::run()
             resize_swapchain();
         }
 
+        reload_changed_shaders();
+
         // imgui new frame
         ImGui_ImplVulkan_NewFrame();
         ImGui_ImplSDL2_NewFrame();
         ImGui::NewFrame();
 
         if (ImGui::Begin("Background")) {
-            ImGui::SliderFloat("Render Scale", &renderScale, 0.3f, 1.f);
+            if (dynamicResolution.supported()) {
+                ImGui::Checkbox("Dynamic Resolution", &dynamicResolution.autoScale);
+            }
+            if (dynamicResolution.autoScale) {
+                ImGui::SliderFloat("Target GPU ms", &dynamicResolution.targetMs, 4.f, 33.3f);
+                ImGui::SliderFloat("Min Scale", &dynamicResolution.minScale, 0.3f, dynamicResolution.maxScale);
+            }
+            else {
+                ImGui::SliderFloat("Render Scale", &dynamicResolution.scale, 0.3f, 1.f);
+            }
+            ImGui::SliderFloat("Sharpness", &postProcess.sharpness, 0.f, 1.f);
+            ImGui::SliderFloat("Exposure", &postProcess.exposure, 0.1f, 4.f);
 
             // Grab selected effect
             ComputeEffect& selected = backfroundEffects[currentBackgroundEffect];
@@ -950,6 +2077,10 @@ void TinyVulkan::run()
 
             // Slider for the different push constants
             ImGui::SliderInt("Effect Index", &currentBackgroundEffect, 0, backfroundEffects.size() - 1);
+            ImGui::Combo("Background mode", reinterpret_cast<int*>(&backgroundMode), "Every frame\0Cached\0Uncovered tiles\0");
+            if (backgroundMode == BackgroundMode::Cached) {
+                ImGui::Checkbox("Half resolution background", &backgroundCache.halfResolution);
+            }
  
             ImGui::InputFloat4("data1", reinterpret_cast<float*>(&selected.pushConstants.data1));
             ImGui::InputFloat4("data2", reinterpret_cast<float*>(&selected.pushConstants.data2));
@@ -962,12 +2093,90 @@ void TinyVulkan::run()
             ImGui::Text("Update Time %f ms", stats.scene_update_time);
             ImGui::Text("Triangles %i", stats.triangle_count);
             ImGui::Text("Draws %i", stats.drawcall_count);
+            ImGui::Text("Occlusion culled %i", stats.occlusion_culled_count);
+            ImGui::Text("Meshlets culled %i", stats.meshlets_culled);
+            ImGui::Text("Objects updated %i", stats.objects_updated);
+            ImGui::Text("LOD triangles saved %i", stats.triangles_saved);
+            ImGui::Text("Textures %u, %.1f MB resident, %u uploads pending", textureStreamer.stats.textureCount,
+                textureStreamer.stats.residentBytes / (1024.f * 1024.f), textureStreamer.stats.pendingUploads);
+            ImGui::Text("Cached %u textures (%u reused), %u samplers (%u reused), %u meshes (%u reused)",
+                resourceCache.stats.textures, resourceCache.stats.textureHits, samplerCache.stats.samplers,
+                samplerCache.stats.hits, resourceCache.stats.meshes, resourceCache.stats.meshHits);
+            ImGui::Text("Pooled %zu mesh buffers, %zu materials", resourceCache.meshData.size(), resourceCache.materials.size());
+            ImGui::Text("Pipelines %u compiled, %u deduplicated, %f ms", pipelineRegistry.stats.compiled,
+                pipelineRegistry.stats.deduplicated, pipelineRegistry.stats.compileTime);
+            ImGui::Text("Shader reloads %u", pipelineRegistry.stats.reloaded);
+            ImGui::Text("GPU %f ms, rendering %ux%u (scale %.2f)", dynamicResolution.gpuMs, _drawExtent.width, _drawExtent.height,
+                dynamicResolution.scale);
+            ImGui::Text("Lights %zu in %u clusters", clusteredLights.lights.size(), CLUSTER_COUNT);
+            ImGui::Text("Background %u renders, %u frames reused", backgroundCache.stats.renders, backgroundCache.stats.reused);
+            DescriptorAllocator::Stats poolStats = get_current_frame()._frameDescriptors.stats();
+            ImGui::Text("Frame descriptor pools %u sets from %u threads, %u pools (%u new), %u out-of-pool retries",
+                poolStats.setsAllocated, poolStats.threads, poolStats.pools, poolStats.poolsCreated, poolStats.outOfPoolRetries);
+            if (_descriptorBuffers) {
+                const DescriptorBufferAllocator::Stats& descriptorStats = get_current_frame()._frameDescriptorBuffer.stats;
+                ImGui::Text("Descriptor buffer %u sets, %llu bytes in %u blocks", descriptorStats.sets,
+                    (unsigned long long)descriptorStats.bytes, descriptorStats.blocks);
+                ImGui::Text("Material and draw image descriptors %u sets, %llu bytes", _descriptorBuffer.stats.sets,
+                    (unsigned long long)_descriptorBuffer.stats.bytes);
+            }
+            ImGui::Text("Pending deletes %u buffers, %u images, %u views, %u blocks, %u freed last frame",
+                deletionQueue.stats.buffers, deletionQueue.stats.images, deletionQueue.stats.imageViews,
+                deletionQueue.stats.memoryBlocks, deletionQueue.stats.lastDestroyed);
+            for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+                const ShadowCascades::CascadeStats& cascade = shadowCascades.stats[i];
+                ImGui::Text("Cascade %u %s, %u objects, %u draws, %u triangles, %f ms (%u renders)", i,
+                    cascade.rendered ? "rendered" : "cached", cascade.objects, cascade.draws, cascade.triangles, cascade.gpuMs,
+                    cascade.renderCount);
+            }
+            ImGui::Text("Async compute %s", _asyncCompute ? "on" : "off (no separate compute queue)");
+            ImGui::Text("Render graph %u passes (%u culled), %u barriers, %u transient images in %u blocks",
+                renderGraph.stats.passes, renderGraph.stats.culledPasses, renderGraph.stats.barriers,
+                renderGraph.stats.transientImages, renderGraph.stats.transientBlocks);
         }
         ImGui::End();
 
         if (ImGui::Begin("Scene")) {
             ImGui::Checkbox("Structure", &bShouldRenderStructure);
             ImGui::Checkbox("Sponza", &bShouldRenderSponza);
+            ImGui::Checkbox("Depth pre-pass", &bDepthPrepass);
+            ImGui::Checkbox("Occlusion culling", &bOcclusionCulling);
+            ImGui::Checkbox("Meshlet culling", &bMeshletCulling);
+            ImGui::Checkbox("LODs", &bUseLods);
+            ImGui::SliderFloat("LOD error (px)", &lodErrorThreshold, 0.25f, 8.f);
+            ImGui::SliderInt("Texture budget (MB)", &textureStreamer.budgetMB, 16, 2048);
+            if (ImGui::SliderInt("Test lights", &testLightCount, 0, 4096)) {
+                scatter_test_lights();
+            }
+            ImGui::SliderFloat("Shadow distance", &shadowCascades.shadowDistance, 10.f, 1000.f);
+            ImGui::Checkbox("Cache distant cascades", &shadowCascades.cacheDistantCascades);
+            ImGui::SliderInt("First cached cascade", &shadowCascades.firstCachedCascade, 0, SHADOW_CASCADES - 1);
+            ImGui::SliderFloat("Cascade move threshold", &shadowCascades.cacheMoveThreshold, 0.01f, 0.5f);
+        }
+        ImGui::End();
+
+        if (ImGui::Begin("Memory")) {
+            constexpr float MB = 1024.f * 1024.f;
+            if (!memoryTracker.has_budget_extension()) {
+                ImGui::Text("VK_EXT_memory_budget missing, budgets are estimates");
+            }
+            for (size_t i = 0; i < memoryTracker.heaps.size(); i++) {
+                const MemoryTracker::HeapBudget& heap = memoryTracker.heaps[i];
+                float fraction = heap.budget ? float(heap.usage) / float(heap.budget) : 0.f;
+                char label[64];
+                snprintf(label, sizeof(label), "%.0f / %.0f MB", heap.usage / MB, heap.budget / MB);
+                ImGui::Text("Heap %zu%s", i, heap.deviceLocal ? " (device local)" : "");
+                ImGui::ProgressBar(fraction, ImVec2(-1.f, 0.f), label);
+            }
+            ImGui::Separator();
+            for (uint32_t c = 0; c < (uint32_t)MemoryCategory::Count; c++) {
+                MemoryCategory category = (MemoryCategory)c;
+                ImGui::Text("%s: %.1f MB in %u allocations", memory_category_name(category),
+                    memoryTracker.category_bytes(category) / MB, memoryTracker.category_count(category));
+            }
+            if (ImGui::Button("Dump JSON")) {
+                memoryTracker.dump_json("memory_stats.json");
+            }
         }
         ImGui::End();
 
@@ -985,7 +2194,23 @@ void TinyVulkan::run()
     }
 }
 
-AllocatedBuffer TinyVulkan::create_buffer(size_t allocSize, VkBufferUsageFlags usageFlags, VmaMemoryUsage memoryUsage)
+void TinyVulkan::reload_changed_shaders()
+{
+    std::vector<std::string> compiled = shaderWatcher.take_compiled();
+    if (compiled.empty()) {
+        return;
+    }
+
+    // we are between frames here, once the gpu is idle no command buffer references the old pipelines
+    vkDeviceWaitIdle(_device);
+
+    for (const std::string& path : compiled) {
+        pipelineRegistry.reload_shader(path);
+    }
+}
+
+AllocatedBuffer TinyVulkan::create_buffer(size_t allocSize, VkBufferUsageFlags usageFlags, VmaMemoryUsage memoryUsage,
+    MemoryCategory category)
 {
     // allocate buffer
     VkBufferCreateInfo bufferInfo = { .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
@@ -997,20 +2222,110 @@ AllocatedBuffer TinyVulkan::create_buffer(size_t allocSize, VkBufferUsageFlags u
     VmaAllocationCreateInfo vmaallocInfo = {};
     vmaallocInfo.usage = memoryUsage;
     vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+    MemoryTracker::set_category(vmaallocInfo, category);
     AllocatedBuffer newBuffer;
 
     // allocate the buffer
     VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &newBuffer.buffer, &newBuffer.allocation,
         &newBuffer.info));
+    memoryTracker.add(newBuffer.allocation);
 
     return newBuffer;
 }
 
 void TinyVulkan::destroy_buffer(const AllocatedBuffer& buffer)
 {
+    // buffers that were never created are destroyed too, for simpler growth code
+    if (buffer.allocation != VK_NULL_HANDLE) {
+        memoryTracker.remove(buffer.allocation);
+    }
     vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
 }
 
+VkDeviceAddress TinyVulkan::get_buffer_address(const AllocatedBuffer& buffer)
+{
+    VkBufferDeviceAddressInfo addressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO };
+    addressInfo.buffer = buffer.buffer;
+    return vkGetBufferDeviceAddress(_device, &addressInfo);
+}
+
+VkDescriptorSetLayoutCreateFlags TinyVulkan::descriptor_layout_flags() const
+{
+    return _descriptorBuffers ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+}
+
+VkPipelineCreateFlags TinyVulkan::descriptor_pipeline_flags() const
+{
+    return _descriptorBuffers ? VK_PIPELINE_CREATE_DESCRIPTOR_BUFFER_BIT_EXT : 0;
+}
+
+DescriptorHandle TinyVulkan::write_frame_descriptors(VkDescriptorSetLayout layout, DescriptorWriter& writer,
+    const DescriptorTemplate& updateTemplate)
+{
+    FrameData& frame = get_current_frame();
+    DescriptorHandle set;
+    if (_descriptorBuffers) {
+        set = frame._frameDescriptorBuffer.allocate(layout);
+    }
+    else {
+        set.set = frame._frameDescriptors.allocate(_device, layout);
+    }
+
+    write_descriptors(set, layout, writer, updateTemplate);
+    return set;
+}
+
+void TinyVulkan::bind_frame_descriptors(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout,
+    uint32_t setIndex, VkDescriptorSetLayout layout, DescriptorWriter& writer, const DescriptorTemplate& updateTemplate)
+{
+    DescriptorHandle set = write_frame_descriptors(layout, writer, updateTemplate);
+    bind_descriptors(cmd, bindPoint, pipelineLayout, setIndex, { &set, 1 });
+}
+
+DescriptorHandle TinyVulkan::allocate_descriptors(DescriptorAllocator& pool, VkDescriptorSetLayout layout)
+{
+    if (_descriptorBuffers) {
+        return _descriptorBuffer.allocate(layout);
+    }
+
+    DescriptorHandle set;
+    set.set = pool.allocate(_device, layout);
+    return set;
+}
+
+void TinyVulkan::write_descriptors(const DescriptorHandle& set, VkDescriptorSetLayout layout, DescriptorWriter& writer,
+    const DescriptorTemplate& updateTemplate)
+{
+    if (set.buffer != nullptr) {
+        set.buffer->write(set, layout, writer);
+        return;
+    }
+    writer.update_set(_device, set.set, updateTemplate);
+}
+
+void TinyVulkan::free_descriptors(const DescriptorHandle& set, VkDescriptorSetLayout layout)
+{
+    if (set.buffer != nullptr) {
+        _descriptorBuffer.free(set, layout);
+    }
+}
+
+void TinyVulkan::bind_descriptors(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout pipelineLayout,
+    uint32_t firstSet, std::span<const DescriptorHandle> sets)
+{
+    if (_descriptorBuffers) {
+        DescriptorBufferAllocator::bind(cmd, bindPoint, pipelineLayout, firstSet, sets);
+        return;
+    }
+
+    std::array<VkDescriptorSet, DescriptorBufferAllocator::MAX_BOUND_SETS> handles;
+    assert(sets.size() <= handles.size());
+    for (size_t i = 0; i < sets.size(); i++) {
+        handles[i] = sets[i].set;
+    }
+    vkCmdBindDescriptorSets(cmd, bindPoint, pipelineLayout, firstSet, static_cast<uint32_t>(sets.size()), handles.data(), 0, nullptr);
+}
+
 GPUMeshBuffers TinyVulkan::uploadMesh(std::span<uint32_t> indices, std::span<Vertex> vertices)
 {
     const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
@@ -1020,18 +2335,21 @@ GPUMeshBuffers TinyVulkan::uploadMesh(std::span<uint32_t> indices, std::span<Ver
 
     // Create vertex buffer
     newSurface.vertexBuffer = create_buffer(vertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY);
+        VMA_MEMORY_USAGE_GPU_ONLY, MemoryCategory::Mesh);
 
     // Find the adress of the vertex buffer
     VkBufferDeviceAddressInfo deviceAdressInfo{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,.buffer = newSurface.vertexBuffer.buffer };
     newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(_device, &deviceAdressInfo);
 
     // Create index buffer
-    newSurface.indexBuffer = create_buffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VMA_MEMORY_USAGE_GPU_ONLY);
+    newSurface.indexBuffer = create_buffer(indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+        | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY,
+        MemoryCategory::Mesh);
+    newSurface.indexBufferAddress = get_buffer_address(newSurface.indexBuffer);
 
     // Create staging buffer to be able to write on the CPU then copy into GPU buffers
-    AllocatedBuffer staging = create_buffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    AllocatedBuffer staging = create_buffer(vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY,
+        MemoryCategory::Transient);
 
     void* data = staging.allocation->GetMappedData();
 
@@ -1087,21 +2405,7 @@ void TinyVulkan::init_default_data()
     _errorCheckerboardImage = create_image(pixels.data(), VkExtent3D{ 16, 16, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
         VK_IMAGE_USAGE_SAMPLED_BIT);
 
-    VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-
-    sampl.magFilter = VK_FILTER_NEAREST;
-    sampl.minFilter = VK_FILTER_NEAREST;
-
-    vkCreateSampler(_device, &sampl, nullptr, &_defaultSamplerNearest);
-
-    sampl.magFilter = VK_FILTER_LINEAR;
-    sampl.minFilter = VK_FILTER_LINEAR;
-    vkCreateSampler(_device, &sampl, nullptr, &_defaultSamplerLinear);
-
     _mainDeletionQueue.push_function([&]() {
-        vkDestroySampler(_device, _defaultSamplerNearest, nullptr);
-        vkDestroySampler(_device, _defaultSamplerLinear, nullptr);
-
         destroy_image(_whiteImage);
         destroy_image(_greyImage);
         destroy_image(_blackImage);
@@ -1111,9 +2415,9 @@ void TinyVulkan::init_default_data()
     GLTFMetallic_Roughness::MaterialResources materialResources;
     //default the material textures
     materialResources.colorImage = _whiteImage;
-    materialResources.colorSampler = _defaultSamplerLinear;
+    materialResources.colorSampler = samplerCache.get(SAMPLER_LINEAR);
     materialResources.metalRoughImage = _whiteImage;
-    materialResources.metalRoughSampler = _defaultSamplerLinear;
+    materialResources.metalRoughSampler = samplerCache.get(SAMPLER_LINEAR);
 
     //set the uniform buffer for the material data
     AllocatedBuffer materialConstants = create_buffer(sizeof(GLTFMetallic_Roughness::MaterialConstants), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
@@ -1130,10 +2434,11 @@ void TinyVulkan::init_default_data()
     materialResources.dataBuffer = materialConstants.buffer;
     materialResources.dataBufferOffset = 0;
 
-    defaultData = metalRoughMaterial.write_material(_device, MaterialPass::MainColor, materialResources, globalDescriptorAllocator);
+    defaultData = metalRoughMaterial.write_material(this, MaterialPass::MainColor, materialResources, globalDescriptorAllocator);
 }
 
-AllocatedImage TinyVulkan::create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
+AllocatedImage TinyVulkan::create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped,
+    MemoryCategory category)
 {
     AllocatedImage newImage;
     newImage.imageFormat = format;
@@ -1148,9 +2453,11 @@ AllocatedImage TinyVulkan::create_image(VkExtent3D size, VkFormat format, VkImag
     VmaAllocationCreateInfo allocinfo = {};
     allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
     allocinfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    MemoryTracker::set_category(allocinfo, category);
 
     // allocate and create the image
     VK_CHECK(vmaCreateImage(_allocator, &img_info, &allocinfo, &newImage.image, &newImage.allocation, nullptr));
+    memoryTracker.add(newImage.allocation);
 
     // if the format is a depth format, we will need to have it use the correct aspect flag
     VkImageAspectFlags aspectFlag = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1170,12 +2477,26 @@ AllocatedImage TinyVulkan::create_image(VkExtent3D size, VkFormat format, VkImag
 AllocatedImage TinyVulkan::create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mipmapped)
 {
     size_t data_size = size.depth * size.width * size.height * 4;
-    AllocatedBuffer uploadbuffer = create_buffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+    AllocatedBuffer uploadbuffer = create_buffer(data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+        MemoryCategory::Transient);
 
     memcpy(uploadbuffer.info.pMappedData, data, data_size);
 
+    // the mip levels are written by the mip generator's compute shader
+    if (mipmapped) {
+        usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    }
     AllocatedImage new_image = create_image(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
 
+    // descriptors and views of the mip generation, freed once the submit is done
+    std::vector<DescriptorAllocator::PoolSizeRatio> mipSizes = { { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 16 } };
+    DescriptorAllocator mipDescriptors;
+    DeletionQueue mipDeletion;
+    mipDeletion.init(_device, _allocator, &memoryTracker);
+    if (mipmapped) {
+        mipDescriptors.init_pool(_device, 1, mipSizes);
+    }
+
     immediate_submit([&](VkCommandBuffer cmd) {
         vkutil::transition_image(cmd, new_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
@@ -1195,7 +2516,8 @@ AllocatedImage TinyVulkan::create_image(void* data, VkExtent3D size, VkFormat fo
             &copyRegion);
 
         if (mipmapped) {
-            vkutil::generate_mipmaps(cmd, new_image.image, VkExtent2D{ new_image.imageExtent.width,new_image.imageExtent.height });
+            mipGenerator.add(new_image);
+            mipGenerator.record(cmd, mipDescriptors, mipDeletion);
         }
         else {
             vkutil::transition_image(cmd, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
@@ -1203,24 +2525,31 @@ AllocatedImage TinyVulkan::create_image(void* data, VkExtent3D size, VkFormat fo
         }
         });
     destroy_buffer(uploadbuffer);
+    if (mipmapped) {
+        mipDeletion.flush();
+        mipDescriptors.destroy_pools(_device);
+    }
     return new_image;
 }
 
 void TinyVulkan::destroy_image(const AllocatedImage& img)
 {
     vkDestroyImageView(_device, img.imageView, nullptr);
+    if (img.allocation != VK_NULL_HANDLE) {
+        memoryTracker.remove(img.allocation);
+    }
     vmaDestroyImage(_allocator, img.image, img.allocation);
 }
 
 void GLTFMetallic_Roughness::build_pipelines(TinyVulkan* engine)
 {
-    VkShaderModule meshFragShader;
-    if (!vkutil::load_shader_module("../shaders/mesh.frag.spv", engine->_device, &meshFragShader)) {
+    VkShaderModule meshFragShader = engine->pipelineRegistry.get_shader("../shaders/mesh.frag.spv");
+    if (meshFragShader == VK_NULL_HANDLE) {
         printf("Error when building the triangle fragment shader module");
     }
 
-    VkShaderModule meshVertexShader;
-    if (!vkutil::load_shader_module("../shaders/mesh.vert.spv", engine->_device, &meshVertexShader)) {
+    VkShaderModule meshVertexShader = engine->pipelineRegistry.get_shader("../shaders/mesh.vert.spv");
+    if (meshVertexShader == VK_NULL_HANDLE) {
         printf("Error when building the triangle vertex shader module");
     }
 
@@ -1234,7 +2563,9 @@ void GLTFMetallic_Roughness::build_pipelines(TinyVulkan* engine)
     layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-    materialLayout = layoutBuilder.build(engine->_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+    materialLayout = layoutBuilder.build(engine->_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, nullptr,
+        engine->descriptor_layout_flags());
+    materialTemplate = layoutBuilder.build_template(engine->_device, materialLayout);
 
     VkDescriptorSetLayout layouts[] = { engine->_gpuSceneDataDescriptorLayout,
         materialLayout };
@@ -1268,26 +2599,46 @@ void GLTFMetallic_Roughness::build_pipelines(TinyVulkan* engine)
 
     // use the triangle layout we created
     pipelineBuilder._pipelineLayout = newLayout;
+    pipelineBuilder._flags = engine->descriptor_pipeline_flags();
 
-    // finally build the pipeline
-    opaquePipeline.pipeline = pipelineBuilder.build_pipeline(engine->_device);
+    // queue the pipeline, the registry copies the builder state so we can keep editing it
+    engine->pipelineRegistry.request_graphics(pipelineBuilder, &opaquePipeline.pipeline);
 
     // create the transparent variant
     pipelineBuilder.enable_blending_additive();
 
     pipelineBuilder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
 
-    transparentPipeline.pipeline = pipelineBuilder.build_pipeline(engine->_device);
+    engine->pipelineRegistry.request_graphics(pipelineBuilder, &transparentPipeline.pipeline);
 
-    vkDestroyShaderModule(engine->_device, meshFragShader, nullptr);
-    vkDestroyShaderModule(engine->_device, meshVertexShader, nullptr);
-    
+    // depth-only variant for the pre-pass and the occlusion culling phases
+    VkShaderModule depthVertexShader = engine->pipelineRegistry.get_shader("../shaders/depth_only.vert.spv");
+    if (depthVertexShader == VK_NULL_HANDLE) {
+        printf("Error when building the depth-only vertex shader module");
+    }
+
+    depthOnlyPipeline.layout = newLayout;
+
+    PipelineBuilder depthBuilder;
+    depthBuilder.set_vertex_shader(depthVertexShader);
+    depthBuilder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    depthBuilder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    depthBuilder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    depthBuilder.set_multisampling_none();
+    depthBuilder.disable_blending();
+    depthBuilder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+    depthBuilder.set_depth_format(engine->_depthImage.imageFormat);
+    depthBuilder._pipelineLayout = newLayout;
+    depthBuilder._flags = engine->descriptor_pipeline_flags();
+
+    engine->pipelineRegistry.request_graphics(depthBuilder, &depthOnlyPipeline.pipeline);
 }
 
-MaterialInstance GLTFMetallic_Roughness::write_material(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator)
+MaterialInstance GLTFMetallic_Roughness::write_material(TinyVulkan* engine, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator)
 {
     MaterialInstance matData;
     matData.passType = pass;
+    matData.materialIndex = materialCount.fetch_add(1);
     if (pass == MaterialPass::Transparent) {
         matData.pipeline = &transparentPipeline;
     }
@@ -1295,43 +2646,57 @@ MaterialInstance GLTFMetallic_Roughness::write_material(VkDevice device, Materia
         matData.pipeline = &opaquePipeline;
     }
 
-    matData.materialSet = descriptorAllocator.allocate(device, materialLayout);
+    matData.materialSet = write_material_set(engine, resources, descriptorAllocator);
 
+    return matData;
+}
+
+DescriptorHandle GLTFMetallic_Roughness::write_material_set(TinyVulkan* engine, const MaterialResources& resources, DescriptorAllocator& descriptorAllocator)
+{
+    DescriptorHandle materialSet = engine->allocate_descriptors(descriptorAllocator, materialLayout);
+    update_material_set(engine, resources, materialSet);
 
-    writer.clear();
+    return materialSet;
+}
+
+void GLTFMetallic_Roughness::update_material_set(TinyVulkan* engine, const MaterialResources& resources, const DescriptorHandle& materialSet)
+{
+    DescriptorWriter writer;
     writer.write_buffer(0, resources.dataBuffer, sizeof(MaterialConstants), resources.dataBufferOffset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
     writer.write_image(1, resources.colorImage.imageView, resources.colorSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.write_image(2, resources.metalRoughImage.imageView, resources.metalRoughSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
-    writer.update_set(device, matData.materialSet);
-
-    return matData;
+    engine->write_descriptors(materialSet, materialLayout, writer, materialTemplate);
 }
 
 void GLTFMetallic_Roughness::clear_resources(VkDevice device)
 {
+    materialTemplate.destroy(device);
     vkDestroyDescriptorSetLayout(device, materialLayout, nullptr);
     vkDestroyPipelineLayout(device, transparentPipeline.layout, nullptr);
-
-    vkDestroyPipeline(device, transparentPipeline.pipeline, nullptr);
-    vkDestroyPipeline(device, opaquePipeline.pipeline, nullptr);
 }
 
 void MeshNode::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
 {
     glm::mat4 nodeMatrix = topMatrix * worldTransform;
 
+    ResourceCache& resources = TinyVulkan::Get().resourceCache;
+
     for (auto& s : mesh->surfaces) {
         RenderObject def;
         def.indexCount = s.count;
         def.firstIndex = s.startIndex;
-        def.indexBuffer = mesh->meshBuffers.indexBuffer.buffer;
-        def.material = &s.material->data;
-        def.bounds = s.bounds;
-        def.transform = nodeMatrix;
-        def.vertexBufferAddress = mesh->meshBuffers.vertexBufferAddress;
+        def.mesh = mesh->buffers;
+        def.material = s.material->instance;
+        def.objectIndex = static_cast<uint32_t>(ctx.objects.size());
+        def.firstLod = s.firstLod;
+        def.lodCount = s.lodCount;
+        def.firstMeshlet = s.firstMeshlet;
+        def.meshletCount = s.meshletCount;
+
+        ctx.objects.push_back({ nodeMatrix, s.bounds });
 
-        if (s.material->data.passType == MaterialPass::Transparent) {
+        if (resources.materials.get(def.material).passType == MaterialPass::Transparent) {
             ctx.TransparentSurfaces.push_back(def);
         }
         else {
@@ -1350,6 +2715,7 @@ void TinyVulkan::update_scene()
 
     mainDrawContext.OpaqueSurfaces.clear();
     mainDrawContext.TransparentSurfaces.clear();
+    mainDrawContext.objects.clear();
     
     if (bShouldRenderStructure)
     {
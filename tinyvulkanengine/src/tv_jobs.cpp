@@ -0,0 +1,74 @@
+#include <tv_jobs.h>
+
+void WorkerPool::init(uint32_t threadCount)
+{
+    if (threadCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        // leave one core for the main thread
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    stopping = false;
+    for (uint32_t i = 0; i < threadCount; i++) {
+        threads.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+void WorkerPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    threads.clear();
+}
+
+void WorkerPool::submit(std::function<void()>&& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    jobAvailable.notify_one();
+}
+
+void WorkerPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    jobsDone.wait(lock, [this]() { return jobs.empty() && runningJobs == 0; });
+}
+
+void WorkerPool::worker_loop()
+{
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+            // drain the queue before stopping so shutdown never drops work
+            if (jobs.empty()) {
+                return;
+            }
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            runningJobs++;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            runningJobs--;
+            if (jobs.empty() && runningJobs == 0) {
+                jobsDone.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#include <tv_lights.h>
+#include <tv_engine.h>
+#include <tv_images.h>
+#include <tv_initializers.h>
+
+#include <cmath>
+#include <cstring>
+
+// Must match GROUP_SIZE in light_cull.comp
+constexpr uint32_t CLUSTERS_PER_GROUP = 64;
+
+void ClusteredLights::init(TinyVulkan* engine, uint32_t frameCount)
+{
+    _engine = engine;
+    _frames.resize(frameCount);
+
+    VkPushConstantRange range{};
+    range.offset = 0;
+    range.size = sizeof(PushConstants);
+    range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.pPushConstantRanges = &range;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(engine->_device, &layoutInfo, nullptr, &_pipelineLayout));
+
+    VkShaderModule shader = engine->pipelineRegistry.get_shader("../shaders/light_cull.comp.spv");
+    if (shader == VK_NULL_HANDLE) {
+        printf("Error when building the light culling shader \n");
+        assert(false);
+    }
+
+    engine->pipelineRegistry.request_compute(_pipelineLayout, shader, &_pipeline);
+}
+
+void ClusteredLights::destroy()
+{
+    for (FrameBuffers& frame : _frames) {
+        if (frame.lights.buffer != VK_NULL_HANDLE) {
+            _engine->destroy_buffer(frame.lights);
+        }
+        if (frame.clusters.buffer != VK_NULL_HANDLE) {
+            _engine->destroy_buffer(frame.clusters);
+        }
+    }
+    vkDestroyPipelineLayout(_engine->_device, _pipelineLayout, nullptr);
+}
+
+void ClusteredLights::record(VkCommandBuffer cmd, uint32_t frame, GPUSceneData& sceneData, VkExtent2D drawExtent)
+{
+    FrameBuffers& buffers = _frames[frame];
+    uint32_t lightCount = static_cast<uint32_t>(lights.size());
+
+    // the slice of a depth is log(depth) * scale + bias
+    float sliceScale = CLUSTER_Z / std::log(clusterFar / clusterNear);
+    sceneData.clusterParams = glm::vec4(drawExtent.width, drawExtent.height, sliceScale, -std::log(clusterNear) * sliceScale);
+    sceneData.lightCount = lightCount;
+    sceneData.lightBuffer = 0;
+    sceneData.clusterBuffer = 0;
+
+    if (lightCount == 0) {
+        return;
+    }
+
+    // This frame's fence was waited on, nothing else uses its buffers
+    if (buffers.lightCapacity < lightCount) {
+        if (buffers.lights.buffer != VK_NULL_HANDLE) {
+            _engine->destroy_buffer(buffers.lights);
+        }
+        buffers.lightCapacity = std::max(lightCount, buffers.lightCapacity * 2);
+        buffers.lights = _engine->create_buffer(buffers.lightCapacity * sizeof(GPULight),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+            MemoryCategory::Transient);
+    }
+    if (buffers.clusters.buffer == VK_NULL_HANDLE) {
+        // the counts, then the index slots of every cluster
+        buffers.clusters = _engine->create_buffer((CLUSTER_COUNT + CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER) * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+
+    memcpy(buffers.lights.info.pMappedData, lights.data(), lightCount * sizeof(GPULight));
+
+    sceneData.lightBuffer = _engine->get_buffer_address(buffers.lights);
+    sceneData.clusterBuffer = _engine->get_buffer_address(buffers.clusters);
+
+    PushConstants pushConstants;
+    pushConstants.view = sceneData.view;
+    pushConstants.projection = glm::vec4(sceneData.proj[0][0], sceneData.proj[1][1], clusterNear, clusterFar);
+    pushConstants.lightBuffer = sceneData.lightBuffer;
+    pushConstants.clusterBuffer = sceneData.clusterBuffer;
+    pushConstants.lightCount = lightCount;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+    vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(cmd, (CLUSTER_COUNT + CLUSTERS_PER_GROUP - 1) / CLUSTERS_PER_GROUP, 1, 1);
+
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+}
@@ -1,9 +1,11 @@
 ﻿#include <tv_loader.h>
 #include "stb_image.h"
 #include <iostream>
+#include <fstream>
 #include "tv_engine.h"
 #include "tv_initializers.h"
 #include "tv_types.h"
+#include "tv_meshutil.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/quaternion.hpp>
@@ -12,6 +14,121 @@
 #include <fastgltf/parser.hpp>
 #include <fastgltf/tools.hpp>
 
+// Simplified levels generated per surface, each aims for half the triangles of the one before
+constexpr int MAX_SURFACE_LODS = 4;
+// Surfaces below this many triangles are not worth simplifying
+constexpr uint32_t MIN_LOD_TRIANGLES = 64;
+// Simplification stops once it would move the surface by this fraction of its radius
+constexpr float MAX_LOD_RELATIVE_ERROR = 0.05f;
+
+// Surfaces below this many triangles are drawn whole
+constexpr uint32_t MIN_MESHLET_TRIANGLES = 512;
+
+/*
+    Splits the full detail range of every large surface into meshlets on the engine workers and
+    appends them to the meshlets of the mesh. This reorders the triangles inside each range.
+*/
+static void build_surface_meshlets(TinyVulkan* engine, std::vector<uint32_t>& indices, std::span<const Vertex> vertices,
+    std::vector<GeoSurface>& surfaces, std::vector<Meshlet>& meshlets)
+{
+    std::vector<std::vector<Meshlet>> surfaceMeshlets(surfaces.size());
+    for (size_t i = 0; i < surfaces.size(); i++) {
+        if (surfaces[i].count / 3 < MIN_MESHLET_TRIANGLES) {
+            continue;
+        }
+
+        engine->_workers.submit([&, i]() {
+            const GeoSurface& surface = surfaces[i];
+            std::span<uint32_t> range(indices.data() + surface.startIndex, surface.count);
+            surfaceMeshlets[i] = meshutil::build_meshlets(range, vertices, !surface.material->doubleSided);
+            });
+    }
+    engine->_workers.wait();
+
+    for (size_t i = 0; i < surfaces.size(); i++) {
+        surfaces[i].firstMeshlet = (uint32_t)meshlets.size();
+        surfaces[i].meshletCount = (uint32_t)surfaceMeshlets[i].size();
+        meshlets.insert(meshlets.end(), surfaceMeshlets[i].begin(), surfaceMeshlets[i].end());
+    }
+}
+
+/*
+    Builds the LOD chain of every surface on the engine workers, appends the simplified
+    index ranges after the full detail ones and their levels to the LODs of the mesh.
+*/
+static void build_surface_lods(TinyVulkan* engine, std::vector<uint32_t>& indices, std::span<const Vertex> vertices,
+    std::vector<GeoSurface>& surfaces, std::vector<SurfaceLOD>& lods)
+{
+    std::vector<std::vector<std::vector<uint32_t>>> lodIndices(surfaces.size());
+    std::vector<std::vector<float>> lodErrors(surfaces.size());
+
+    for (size_t i = 0; i < surfaces.size(); i++) {
+        engine->_workers.submit([&, i]() {
+            const GeoSurface& surface = surfaces[i];
+            std::span<const uint32_t> source(indices.data() + surface.startIndex, surface.count);
+            float maxError = surface.bounds.sphereRadius * MAX_LOD_RELATIVE_ERROR;
+
+            size_t previousCount = source.size();
+            for (int level = 1; level <= MAX_SURFACE_LODS; level++) {
+                size_t targetTriangles = (source.size() / 3) >> level;
+                if (targetTriangles < MIN_LOD_TRIANGLES) {
+                    break;
+                }
+
+                // always simplify the full surface, so the error is measured against it
+                std::vector<uint32_t> lod;
+                float error = meshutil::simplify(source, vertices, targetTriangles * 3, maxError, lod);
+
+                // the error bound was hit, a level this close to the previous one saves nothing
+                if (lod.size() > previousCount * 3 / 4) {
+                    break;
+                }
+
+                previousCount = lod.size();
+                lodIndices[i].push_back(std::move(lod));
+                lodErrors[i].push_back(error);
+            }
+            });
+    }
+    engine->_workers.wait();
+
+    for (size_t i = 0; i < surfaces.size(); i++) {
+        surfaces[i].firstLod = (uint32_t)lods.size();
+        surfaces[i].lodCount = (uint32_t)lodIndices[i].size();
+        for (size_t level = 0; level < lodIndices[i].size(); level++) {
+            SurfaceLOD lod;
+            lod.startIndex = (uint32_t)indices.size();
+            lod.count = (uint32_t)lodIndices[i][level].size();
+            lod.error = lodErrors[i][level];
+
+            indices.insert(indices.end(), lodIndices[i][level].begin(), lodIndices[i][level].end());
+            lods.push_back(lod);
+        }
+    }
+}
+
+// Meshes with the same vertices, indices and surface ranges share their GPU buffers
+static std::vector<uint8_t> mesh_contents(std::span<const uint32_t> indices, std::span<const Vertex> vertices,
+    const std::vector<GeoSurface>& surfaces)
+{
+    std::vector<uint8_t> contents;
+    auto append = [&](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        contents.insert(contents.end(), bytes, bytes + size);
+        };
+
+    uint32_t counts[2] = { (uint32_t)indices.size(), (uint32_t)vertices.size() };
+    append(counts, sizeof(counts));
+    append(indices.data(), indices.size_bytes());
+    append(vertices.data(), vertices.size_bytes());
+    for (const GeoSurface& surface : surfaces) {
+        // double sided surfaces are split into meshlets without normal cones
+        uint32_t range[3] = { surface.startIndex, surface.count, surface.material->doubleSided };
+        append(range, sizeof(range));
+    }
+    return contents;
+}
+
 VkFilter extract_filter(fastgltf::Filter filter)
 {
     switch (filter) {
@@ -95,7 +212,8 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 } };
 
-    file.descriptorPool.init_pool(engine->_device, gltf.materials.size(), sizes);
+    // the materials with a streamed texture keep a second set
+    file.descriptorPool.init_pool(engine->_device, gltf.materials.size() * 2, sizes);
 
     // load samplers
     for (fastgltf::Sampler& sampler : gltf.samplers) {
@@ -109,16 +227,15 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
 
         sampl.mipmapMode = extract_mipmap_mode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
 
-        VkSampler newSampler;
-        vkCreateSampler(engine->_device, &sampl, nullptr, &newSampler);
-
-        file.samplers.push_back(newSampler);
+        // files using the same filtering share the sampler
+        file.samplers.push_back(engine->samplerCache.get_sampler(sampl));
     }
 
     // temporal arrays for all the objects to use while creating the GLTF data
     std::vector<std::shared_ptr<MeshAsset>> meshes;
     std::vector<std::shared_ptr<Node>> nodes;
-    std::vector<AllocatedImage> images;
+    // INVALID_TEXTURE for the images that failed to load
+    std::vector<TextureHandle> textures;
     std::vector<std::shared_ptr<GLTFMaterial>> materials;
 
     // load all textures
@@ -128,16 +245,16 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
     }*/
 
     for (fastgltf::Image& image : gltf.images) {
-        std::optional<AllocatedImage> img = load_image(engine, gltf, image);
+        std::optional<TextureHandle> img = load_image(engine, gltf, image);
 
         if (img.has_value()) {
-            images.push_back(*img);
-            file.images[image.name.c_str()] = *img;
+            textures.push_back(*img);
+            file.textures.push_back(*img);
         }
         else {
-            // we failed to load, so lets give the slot a default white texture to not
+            // we failed to load, so the materials using it get the checkerboard texture to not
             // completely break loading
-            images.push_back(engine->_errorCheckerboardImage);
+            textures.push_back(INVALID_TEXTURE);
             printf("gltf failed to load texture: %s\n", image.name.c_str());
         }
     }
@@ -152,6 +269,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
         std::shared_ptr<GLTFMaterial> newMat = std::make_shared<GLTFMaterial>();
         materials.push_back(newMat);
         file.materials[mat.name.c_str()] = newMat;
+        newMat->doubleSided = mat.doubleSided;
 
         GLTFMetallic_Roughness::MaterialConstants constants;
         constants.colorFactors.x = mat.pbrData.baseColorFactor[0];
@@ -172,23 +290,54 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
         GLTFMetallic_Roughness::MaterialResources materialResources;
         // default the material textures
         materialResources.colorImage = engine->_whiteImage;
-        materialResources.colorSampler = engine->_defaultSamplerLinear;
+        materialResources.colorSampler = engine->samplerCache.get(SAMPLER_LINEAR);
         materialResources.metalRoughImage = engine->_whiteImage;
-        materialResources.metalRoughSampler = engine->_defaultSamplerLinear;
+        materialResources.metalRoughSampler = engine->samplerCache.get(SAMPLER_LINEAR);
 
         // set the uniform buffer for the material data
         materialResources.dataBuffer = file.materialDataBuffer.buffer;
         materialResources.dataBufferOffset = data_index * sizeof(GLTFMetallic_Roughness::MaterialConstants);
         // grab textures from gltf file
+        TextureHandle colorTexture = INVALID_TEXTURE;
         if (mat.pbrData.baseColorTexture.has_value()) {
             size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
             size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
 
-            materialResources.colorImage = images[img];
             materialResources.colorSampler = file.samplers[sampler];
+            materialResources.colorImage = engine->_errorCheckerboardImage;
+            colorTexture = textures[img];
+            if (colorTexture != INVALID_TEXTURE) {
+                materialResources.colorImage = engine->textureStreamer.get_image(colorTexture);
+            }
         }
         // build material
-        newMat->data = engine->metalRoughMaterial.write_material(engine->_device, passType, materialResources, file.descriptorPool);
+        MaterialHandle instance = engine->resourceCache.materials.add(
+            engine->metalRoughMaterial.write_material(engine, passType, materialResources, file.descriptorPool));
+        newMat->instance = instance;
+        file.materialInstances.push_back(instance);
+        file.materialSets.push_back(engine->resourceCache.materials.get(instance).materialSet);
+
+        if (colorTexture != INVALID_TEXTURE) {
+            engine->textureStreamer.set_material_texture(instance, colorTexture);
+
+            // streaming replaces the image. The material flips between the set the frames in flight
+            // bind and a spare one that gets rewritten for the new image
+            static_assert(FRAME_OVERLAP <= 2, "the spare material set is only idle with at most two frames in flight");
+            DescriptorHandle spareSet = engine->allocate_descriptors(file.descriptorPool, engine->metalRoughMaterial.materialLayout);
+            file.materialSets.push_back(spareSet);
+            int swapFrame = -1;
+            engine->textureStreamer.add_listener(colorTexture, instance, [=](VkImageView view) mutable {
+                materialResources.colorImage.imageView = view;
+                DescriptorHandle& materialSet = engine->resourceCache.materials.get(instance).materialSet;
+                // the spare was last bound by the frame before the swap, the wait at the start of this
+                // frame covered it. A set swapped in this frame is not bound by any submitted frame yet
+                if (swapFrame != engine->_frameNumber) {
+                    std::swap(materialSet, spareSet);
+                    swapFrame = engine->_frameNumber;
+                }
+                engine->metalRoughMaterial.update_material_set(engine, materialResources, materialSet);
+                });
+        }
 
         data_index++;
     }
@@ -295,7 +444,26 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
             newmesh->surfaces.push_back(newSurface);
         }
 
-        newmesh->meshBuffers = engine->uploadMesh(indices, vertices);
+        // geometry loaded before, by this file or another one, is not processed and uploaded again
+        std::vector<uint8_t> contents = mesh_contents(indices, vertices, newmesh->surfaces);
+        if (const MeshGeometry* cached = engine->resourceCache.acquire_mesh(contents)) {
+            for (size_t i = 0; i < newmesh->surfaces.size(); i++) {
+                std::shared_ptr<GLTFMaterial> material = std::move(newmesh->surfaces[i].material);
+                newmesh->surfaces[i] = cached->surfaces[i];
+                newmesh->surfaces[i].material = std::move(material);
+            }
+            newmesh->buffers = cached->buffers;
+        }
+        else {
+            PooledMesh pooled;
+            build_surface_meshlets(engine, indices, vertices, newmesh->surfaces, pooled.meshlets);
+            build_surface_lods(engine, indices, vertices, newmesh->surfaces, pooled.lods);
+
+            pooled.buffers = engine->uploadMesh(indices, vertices);
+            newmesh->buffers = engine->resourceCache.add_mesh(std::move(contents), std::move(pooled), newmesh->surfaces);
+        }
+        // both paths hold one cache reference for the file
+        file.geometry.push_back(newmesh->buffers);
     }
 
     // load all nodes and their meshes
@@ -358,11 +526,11 @@ std::optional<std::shared_ptr<LoadedGLTF>> loadGltf(TinyVulkan* engine, std::str
 
 }
 
-std::optional<AllocatedImage> load_image(TinyVulkan* engine, fastgltf::Asset& asset, fastgltf::Image& image)
+std::optional<TextureHandle> load_image(TinyVulkan* engine, fastgltf::Asset& asset, fastgltf::Image& image)
 {
-    AllocatedImage newImage{};
-
-    int width, height, nrChannels;
+    // encoded bytes of the image, external files are read into fileData
+    std::vector<uint8_t> fileData;
+    std::span<const uint8_t> bytes;
 
     std::visit(
         fastgltf::visitor
@@ -374,33 +542,17 @@ std::optional<AllocatedImage> load_image(TinyVulkan* engine, fastgltf::Asset& as
             assert(filePath.uri.isLocalPath()); // We're only capable of loading local files.
 
             const std::string path(filePath.uri.path().begin(), filePath.uri.path().end()); // Thanks C++.
-            unsigned char* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
-            if (data)
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (file.is_open())
             {
-                VkExtent3D imagesize;
-                imagesize.width = width;
-                imagesize.height = height;
-                imagesize.depth = 1;
-
-                newImage = engine->create_image(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT,true);
-
-                stbi_image_free(data);
+                fileData.resize(static_cast<size_t>(file.tellg()));
+                file.seekg(0);
+                file.read(reinterpret_cast<char*>(fileData.data()), fileData.size());
+                bytes = fileData;
             }
         }, [&](fastgltf::sources::Vector& vector)
             {
-                 unsigned char* data = stbi_load_from_memory(vector.bytes.data(), static_cast<int>(vector.bytes.size()), &width, &height, &nrChannels, 4);
-
-                 if (data)
-                 {
-                     VkExtent3D imagesize;
-                     imagesize.width = width;
-                     imagesize.height = height;
-                     imagesize.depth = 1;
-
-                     newImage = engine->create_image(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT,true);
-
-                     stbi_image_free(data);
-                 }
+                bytes = std::span<const uint8_t>(vector.bytes.data(), vector.bytes.size());
             }, [&](fastgltf::sources::BufferView& view)
                 {
                     auto& bufferView = asset.bufferViews[view.bufferViewIndex];
@@ -411,31 +563,38 @@ std::optional<AllocatedImage> load_image(TinyVulkan* engine, fastgltf::Asset& as
                         [](auto& arg) {},
                         [&](fastgltf::sources::Vector& vector)
                         {
-                            unsigned char* data = stbi_load_from_memory(vector.bytes.data() + bufferView.byteOffset, static_cast<int>(bufferView.byteLength), &width, &height, &nrChannels, 4);
-                            if (data)
-                            {
-                                VkExtent3D imagesize;
-                                imagesize.width = width;
-                                imagesize.height = height;
-                                imagesize.depth = 1;
-
-                                newImage = engine->create_image(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT,true);
-
-                                stbi_image_free(data);
-                            }
+                            bytes = std::span<const uint8_t>(vector.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
                         }
                     }, buffer.data);
                 },
         }, image.data);
 
-    // if any of the attempts to load the data failed, we havent written the image
-    // so handle is null
-    if (newImage.image == VK_NULL_HANDLE) {
+    if (bytes.empty()) {
         return {};
     }
-    else {
-        return newImage;
+
+    // the same file used again, here or by another glTF, is decoded and streamed once
+    TextureHandle newTexture = engine->resourceCache.acquire_texture(bytes);
+    if (newTexture != INVALID_TEXTURE) {
+        return newTexture;
     }
+
+    int width, height, nrChannels;
+    unsigned char* data = stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()), &width, &height, &nrChannels, 4);
+    // if decoding failed, we havent added the texture
+    if (!data) {
+        return {};
+    }
+
+    VkExtent2D imagesize;
+    imagesize.width = width;
+    imagesize.height = height;
+
+    newTexture = engine->textureStreamer.add_texture(data, imagesize);
+    engine->resourceCache.add_texture(bytes, newTexture);
+
+    stbi_image_free(data);
+    return newTexture;
 }
 
 void LoadedGLTF::Draw(const glm::mat4& topMatrix, DrawContext& ctx)
@@ -450,25 +609,23 @@ void LoadedGLTF::clearAll()
 {
     VkDevice dv = creator->_device;
 
+    for (const DescriptorHandle& set : materialSets) {
+        creator->free_descriptors(set, creator->metalRoughMaterial.materialLayout);
+    }
     descriptorPool.destroy_pools(dv);
     creator->destroy_buffer(materialDataBuffer);
 
-    for (auto& [k, v] : meshes) {
-
-        creator->destroy_buffer(v->meshBuffers.indexBuffer);
-        creator->destroy_buffer(v->meshBuffers.vertexBuffer);
+    // the cache destroys the buffers and textures no other file uses, the samplers stay for the next files
+    for (MeshHandle buffers : geometry) {
+        creator->resourceCache.release_mesh(buffers);
     }
 
-    for (auto& [k, v] : images) {
-
-        if (v.image == creator->_errorCheckerboardImage.image) {
-            //dont destroy the default images
-            continue;
-        }
-        creator->destroy_image(v);
+    for (MaterialHandle instance : materialInstances) {
+        creator->textureStreamer.remove_material(instance);
+        creator->resourceCache.materials.remove(instance);
     }
 
-    for (auto& sampler : samplers) {
-        vkDestroySampler(dv, sampler, nullptr);
+    for (TextureHandle texture : textures) {
+        creator->resourceCache.release_texture(texture);
     }
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include <tv_memory.h>
+
+#include <fstream>
+
+const char* memory_category_name(MemoryCategory category)
+{
+    switch (category) {
+    case MemoryCategory::Mesh: return "Meshes";
+    case MemoryCategory::Texture: return "Textures";
+    case MemoryCategory::RenderTarget: return "Render targets";
+    case MemoryCategory::Transient: return "Transient";
+    case MemoryCategory::Other: return "Other";
+    default: return "Unknown";
+    }
+}
+
+void MemoryTracker::init(VmaAllocator allocator, bool budgetExtension)
+{
+    _allocator = allocator;
+    _budgetExtension = budgetExtension;
+
+    const VkPhysicalDeviceMemoryProperties* memoryProperties;
+    vmaGetMemoryProperties(_allocator, &memoryProperties);
+
+    heaps.resize(memoryProperties->memoryHeapCount);
+    heapWarned.assign(memoryProperties->memoryHeapCount, false);
+    for (uint32_t i = 0; i < memoryProperties->memoryHeapCount; i++) {
+        heaps[i].deviceLocal = (memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+    }
+
+    update(0);
+}
+
+void MemoryTracker::set_category(VmaAllocationCreateInfo& info, MemoryCategory category)
+{
+    info.pUserData = reinterpret_cast<void*>(static_cast<uintptr_t>(category));
+}
+
+void MemoryTracker::add(VmaAllocation allocation)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(_allocator, allocation, &info);
+
+    uint32_t category = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(info.pUserData));
+    bytes[category] += info.size;
+    counts[category]++;
+}
+
+void MemoryTracker::remove(VmaAllocation allocation)
+{
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(_allocator, allocation, &info);
+
+    uint32_t category = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(info.pUserData));
+    bytes[category] -= info.size;
+    counts[category]--;
+}
+
+void MemoryTracker::update(uint32_t frameNumber)
+{
+    // lets VMA refresh the budgets it fetched from the driver
+    vmaSetCurrentFrameIndex(_allocator, frameNumber);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(_allocator, budgets);
+
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        heaps[i].usage = budgets[i].usage;
+        heaps[i].budget = budgets[i].budget;
+
+        float fraction = heaps[i].budget > 0 ? (float)heaps[i].usage / (float)heaps[i].budget : 0.f;
+        if (!heapWarned[i] && fraction > warningThreshold) {
+            heapWarned[i] = true;
+            printf("Memory warning: heap %u at %.0f%% of its budget (%.1f / %.1f MB)\n", i, fraction * 100.f,
+                heaps[i].usage / (1024.f * 1024.f), heaps[i].budget / (1024.f * 1024.f));
+        }
+        // a little below the threshold before warning again, so it does not repeat every frame
+        else if (heapWarned[i] && fraction < warningThreshold - 0.05f) {
+            heapWarned[i] = false;
+        }
+    }
+}
+
+bool MemoryTracker::dump_json(const char* filePath) const
+{
+    std::ofstream file(filePath);
+    if (!file.is_open()) {
+        printf("Failed to write memory statistics to %s\n", filePath);
+        return false;
+    }
+
+    file << "{\n  \"budgetExtension\": " << (_budgetExtension ? "true" : "false") << ",\n";
+
+    file << "  \"categories\": {";
+    for (uint32_t i = 0; i < (uint32_t)MemoryCategory::Count; i++) {
+        file << (i == 0 ? "\n" : ",\n") << "    \"" << memory_category_name((MemoryCategory)i) << "\": { \"bytes\": "
+            << bytes[i].load() << ", \"allocations\": " << counts[i].load() << " }";
+    }
+    file << "\n  },\n";
+
+    file << "  \"heaps\": [";
+    for (uint32_t i = 0; i < heaps.size(); i++) {
+        file << (i == 0 ? "\n" : ",\n") << "    { \"deviceLocal\": " << (heaps[i].deviceLocal ? "true" : "false")
+            << ", \"usage\": " << heaps[i].usage << ", \"budget\": " << heaps[i].budget << " }";
+    }
+    file << "\n  ],\n";
+
+    // VMA already writes its statistics as JSON
+    char* vmaStats;
+    vmaBuildStatsString(_allocator, &vmaStats, VK_TRUE);
+    file << "  \"vma\": " << vmaStats << "\n}\n";
+    vmaFreeStatsString(_allocator, vmaStats);
+
+    return true;
+}
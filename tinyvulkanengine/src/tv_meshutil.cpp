@@ -0,0 +1,427 @@
+#include <tv_meshutil.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+#include <glm/common.hpp>
+
+namespace {
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix
+struct Quadric {
+    double a00, a01, a02, a11, a12, a22;
+    double b0, b1, b2;
+    double c;
+
+    void add_plane(const glm::vec3& n, float d)
+    {
+        a00 += n.x * n.x; a01 += n.x * n.y; a02 += n.x * n.z;
+        a11 += n.y * n.y; a12 += n.y * n.z; a22 += n.z * n.z;
+        b0 += n.x * d; b1 += n.y * d; b2 += n.z * d;
+        c += d * d;
+    }
+
+    void add(const Quadric& q)
+    {
+        a00 += q.a00; a01 += q.a01; a02 += q.a02;
+        a11 += q.a11; a12 += q.a12; a22 += q.a22;
+        b0 += q.b0; b1 += q.b1; b2 += q.b2;
+        c += q.c;
+    }
+
+    double error(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a00 * x * x + a11 * y * y + a22 * z * z
+            + 2 * (a01 * x * y + a02 * x * z + a12 * y * z)
+            + 2 * (b0 * x + b1 * y + b2 * z) + c;
+        // rounding can push it slightly below zero
+        return std::max(e, 0.0);
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+struct PositionHash {
+    size_t operator()(const glm::vec3& p) const
+    {
+        uint32_t bits[3];
+        memcpy(bits, &p, sizeof(bits));
+
+        size_t seed = 0;
+        for (uint32_t b : bits) {
+            hash_combine(seed, std::hash<uint32_t>{}(b));
+        }
+        return seed;
+    }
+};
+
+glm::vec3 triangle_normal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+    return glm::cross(b - a, c - a);
+}
+
+}
+
+float meshutil::simplify(std::span<const uint32_t> indices, std::span<const Vertex> vertices, size_t targetIndexCount,
+    float targetError, std::vector<uint32_t>& result)
+{
+    result.assign(indices.begin(), indices.end());
+    if (indices.size() <= targetIndexCount || indices.empty()) {
+        return 0.f;
+    }
+
+    // surfaces use a contiguous block of the vertex buffer, work on that block only
+    auto [minIt, maxIt] = std::minmax_element(indices.begin(), indices.end());
+    uint32_t base = *minIt;
+    size_t vertexCount = *maxIt - base + 1;
+
+    auto position = [&](uint32_t v) -> const glm::vec3& { return vertices[v].position; };
+
+    std::vector<bool> locked(vertexCount, false);
+
+    // vertices sharing a position sit on a uv or normal seam, moving one side would tear the surface
+    {
+        std::unordered_map<glm::vec3, uint32_t, PositionHash> firstAtPosition;
+        for (uint32_t v : indices) {
+            auto [it, inserted] = firstAtPosition.try_emplace(position(v), v);
+            if (!inserted && it->second != v) {
+                locked[it->second - base] = true;
+                locked[v - base] = true;
+            }
+        }
+    }
+
+    // border edges have no twin going the other way, moving their vertices would shrink the outline
+    {
+        std::unordered_set<uint64_t> edges;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint64_t a = indices[i + e];
+                uint64_t b = indices[i + (e + 1) % 3];
+                edges.insert((a << 32) | b);
+            }
+        }
+        for (uint64_t edge : edges) {
+            uint64_t twin = (edge << 32) | (edge >> 32);
+            if (!edges.contains(twin)) {
+                locked[(edge >> 32) - base] = true;
+                locked[(edge & 0xffffffff) - base] = true;
+            }
+        }
+    }
+
+    std::vector<Quadric> quadrics(vertexCount, Quadric{});
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        glm::vec3 n = triangle_normal(position(indices[i]), position(indices[i + 1]), position(indices[i + 2]));
+        float length = glm::length(n);
+        if (length == 0.f) {
+            continue;
+        }
+        n /= length;
+        float d = -glm::dot(n, position(indices[i]));
+
+        for (int k = 0; k < 3; k++) {
+            quadrics[indices[i + k] - base].add_plane(n, d);
+        }
+    }
+
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1);
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+
+    double maxCost = double(targetError) * double(targetError);
+    double resultCost = 0.0;
+
+    // Each pass collapses a batch of independent edges, cheapest first
+    while (result.size() > targetIndexCount) {
+        size_t triangleCount = result.size() / 3;
+
+        // triangles around every vertex
+        std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+        for (uint32_t v : result) {
+            adjacencyOffsets[v - base + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+        }
+        adjacency.resize(result.size());
+        {
+            std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t i = 0; i < result.size(); i++) {
+                adjacency[fill[result[i] - base]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = result[i + e];
+                uint32_t b = result[i + (e + 1) % 3];
+
+                // both directions, the triangle on the other side adds the same pair again which is harmless
+                if (!locked[a - base]) {
+                    Quadric q = quadrics[a - base];
+                    q.add(quadrics[b - base]);
+                    collapses.push_back({ a, b, q.error(position(b)) });
+                }
+                if (!locked[b - base]) {
+                    Quadric q = quadrics[b - base];
+                    q.add(quadrics[a - base]);
+                    collapses.push_back({ b, a, q.error(position(a)) });
+                }
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        for (size_t v = 0; v < vertexCount; v++) {
+            remap[v] = static_cast<uint32_t>(v + base);
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        size_t removedTriangles = 0;
+        size_t appliedCollapses = 0;
+
+        for (const Collapse& collapse : collapses) {
+            if (collapse.cost > maxCost || triangleCount - removedTriangles <= targetIndexCount / 3) {
+                break;
+            }
+
+            uint32_t a = collapse.from - base;
+            uint32_t b = collapse.to - base;
+            if (touched[a] || touched[b]) {
+                continue;
+            }
+
+            // moving a onto b must not fold any of the triangles that survive
+            bool flips = false;
+            size_t degenerate = 0;
+            for (uint32_t t = adjacencyOffsets[a]; t < adjacencyOffsets[a + 1] && !flips; t++) {
+                const uint32_t* tri = &result[adjacency[t] * 3];
+                if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+                    degenerate++;
+                    continue;
+                }
+
+                glm::vec3 p[3];
+                glm::vec3 moved[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = position(tri[k]);
+                    moved[k] = tri[k] == collapse.from ? position(collapse.to) : p[k];
+                }
+                glm::vec3 before = triangle_normal(p[0], p[1], p[2]);
+                glm::vec3 after = triangle_normal(moved[0], moved[1], moved[2]);
+                flips = glm::dot(before, after) <= 0.f;
+            }
+            if (flips) {
+                continue;
+            }
+
+            remap[a] = collapse.to;
+            quadrics[b].add(quadrics[a]);
+            resultCost = std::max(resultCost, collapse.cost);
+            removedTriangles += degenerate;
+            appliedCollapses++;
+
+            // the one ring of a changed shape, nothing else in it may move this pass
+            for (uint32_t t = adjacencyOffsets[a]; t < adjacencyOffsets[a + 1]; t++) {
+                const uint32_t* tri = &result[adjacency[t] * 3];
+                for (int k = 0; k < 3; k++) {
+                    touched[tri[k] - base] = true;
+                }
+            }
+        }
+
+        if (appliedCollapses == 0) {
+            break;
+        }
+
+        // apply the collapses and drop the triangles that became degenerate
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            uint32_t v0 = remap[result[i] - base];
+            uint32_t v1 = remap[result[i + 1] - base];
+            uint32_t v2 = remap[result[i + 2] - base];
+            if (v0 == v1 || v1 == v2 || v0 == v2) {
+                continue;
+            }
+            result[write++] = v0;
+            result[write++] = v1;
+            result[write++] = v2;
+        }
+        result.resize(write);
+    }
+
+    return static_cast<float>(std::sqrt(resultCost));
+}
+
+std::vector<Meshlet> meshutil::build_meshlets(std::span<uint32_t> indices, std::span<const Vertex> vertices,
+    bool coneCulling, size_t maxVertices, size_t maxTriangles)
+{
+    std::vector<Meshlet> meshlets;
+    if (indices.empty()) {
+        return meshlets;
+    }
+
+    size_t triangleCount = indices.size() / 3;
+    auto [minIt, maxIt] = std::minmax_element(indices.begin(), indices.end());
+    uint32_t base = *minIt;
+    size_t vertexCount = *maxIt - base + 1;
+
+    // triangles around every vertex
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (uint32_t v : indices) {
+        adjacencyOffsets[v - base + 1]++;
+    }
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    std::vector<uint32_t> adjacency(indices.size());
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i] - base]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    // last meshlet each vertex was added to
+    std::vector<uint32_t> vertexMeshlet(vertexCount, UINT32_MAX);
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint32_t> order;
+    order.reserve(triangleCount);
+
+    size_t seed = 0;
+    while (true) {
+        while (seed < triangleCount && emitted[seed]) {
+            seed++;
+        }
+        if (seed == triangleCount) {
+            break;
+        }
+
+        uint32_t id = static_cast<uint32_t>(meshlets.size());
+        Meshlet meshlet{};
+        meshlet.firstIndex = static_cast<uint32_t>(order.size() * 3);
+        meshletVertices.clear();
+
+        auto new_vertices = [&](size_t t) {
+            uint32_t count = 0;
+            for (int k = 0; k < 3; k++) {
+                count += vertexMeshlet[indices[t * 3 + k] - base] != id;
+            }
+            return count;
+        };
+
+        auto add = [&](size_t t) {
+            emitted[t] = true;
+            order.push_back(static_cast<uint32_t>(t));
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[t * 3 + k] - base;
+                if (vertexMeshlet[v] != id) {
+                    vertexMeshlet[v] = id;
+                    meshletVertices.push_back(v);
+                }
+            }
+            meshlet.triangleCount++;
+        };
+
+        add(seed);
+
+        // grow through the triangles touching the meshlet, the ones adding the fewest vertices first
+        while (meshlet.triangleCount < maxTriangles) {
+            size_t best = SIZE_MAX;
+            uint32_t bestNew = 4;
+
+            for (size_t i = 0; i < meshletVertices.size() && bestNew > 0; i++) {
+                uint32_t v = meshletVertices[i];
+                for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v + 1]; a++) {
+                    uint32_t t = adjacency[a];
+                    if (emitted[t]) {
+                        continue;
+                    }
+                    uint32_t added = new_vertices(t);
+                    if (added < bestNew) {
+                        best = t;
+                        bestNew = added;
+                    }
+                }
+            }
+
+            if (best == SIZE_MAX || meshletVertices.size() + bestNew > maxVertices) {
+                break;
+            }
+            add(best);
+        }
+
+        // bounding sphere around the box of the vertices
+        glm::vec3 minpos = vertices[meshletVertices[0] + base].position;
+        glm::vec3 maxpos = minpos;
+        for (uint32_t v : meshletVertices) {
+            minpos = glm::min(minpos, vertices[v + base].position);
+            maxpos = glm::max(maxpos, vertices[v + base].position);
+        }
+        meshlet.center = (minpos + maxpos) * 0.5f;
+        meshlet.radius = 0.f;
+        for (uint32_t v : meshletVertices) {
+            meshlet.radius = std::max(meshlet.radius, glm::length(vertices[v + base].position - meshlet.center));
+        }
+
+        meshlet.coneAxis = glm::vec3(0.f, 0.f, 1.f);
+        meshlet.coneCutoff = 1.f;
+
+        if (coneCulling) {
+            std::vector<glm::vec3> normals;
+            glm::vec3 axis(0.f);
+            for (uint32_t i = 0; i < meshlet.triangleCount; i++) {
+                size_t t = order[meshlet.firstIndex / 3 + i];
+                glm::vec3 n = triangle_normal(vertices[indices[t * 3]].position, vertices[indices[t * 3 + 1]].position,
+                    vertices[indices[t * 3 + 2]].position);
+                float length = glm::length(n);
+                if (length > 0.f) {
+                    normals.push_back(n / length);
+                    axis += n / length;
+                }
+            }
+
+            float axisLength = glm::length(axis);
+            if (axisLength > 0.f) {
+                axis /= axisLength;
+
+                float minDot = 1.f;
+                for (const glm::vec3& n : normals) {
+                    minDot = std::min(minDot, glm::dot(axis, n));
+                }
+
+                // past 90 degrees some triangle always faces the camera
+                if (minDot > 0.f) {
+                    meshlet.coneAxis = axis;
+                    meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+                }
+            }
+        }
+
+        meshlets.push_back(meshlet);
+    }
+
+    std::vector<uint32_t> reordered(indices.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            reordered[i * 3 + k] = indices[order[i] * 3 + k];
+        }
+    }
+    std::copy(reordered.begin(), reordered.end(), indices.begin());
+
+    return meshlets;
+}
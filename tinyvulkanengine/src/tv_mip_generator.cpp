@@ -0,0 +1,262 @@
+#include <tv_mip_generator.h>
+#include <tv_engine.h>
+#include <tv_images.h>
+#include <tv_initializers.h>
+
+#include <cmath>
+
+// Must match the mips array in mipgen.comp
+constexpr uint32_t MAX_MIP_VIEWS = 16;
+// Levels one workgroup reduces its tile into
+constexpr uint32_t TILE_LEVELS = 6;
+// Largest source level the tail workgroup can finish alone, 64 texels after TILE_LEVELS
+constexpr uint32_t MAX_SINGLE_PASS_SIZE = 4096;
+
+void MipGenerator::init(TinyVulkan* engine)
+{
+    _engine = engine;
+
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, MAX_MIP_VIEWS);
+    _descriptorLayout = builder.build(engine->_device, VK_SHADER_STAGE_COMPUTE_BIT);
+    _descriptorTemplate = builder.build_template(engine->_device, _descriptorLayout);
+
+    VkPushConstantRange range{};
+    range.offset = 0;
+    range.size = sizeof(PushConstants);
+    range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_descriptorLayout;
+    layoutInfo.pPushConstantRanges = &range;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(engine->_device, &layoutInfo, nullptr, &_pipelineLayout));
+
+    VkShaderModule shader = engine->pipelineRegistry.get_shader("../shaders/mipgen.comp.spv");
+    if (shader == VK_NULL_HANDLE) {
+        printf("Error when building the mip generation shader \n");
+        assert(false);
+    }
+
+    engine->pipelineRegistry.request_compute(_pipelineLayout, shader, &_pipeline);
+}
+
+void MipGenerator::destroy()
+{
+    if (_counterBuffer.buffer != VK_NULL_HANDLE) {
+        _engine->destroy_buffer(_counterBuffer);
+    }
+    vkDestroyPipelineLayout(_engine->_device, _pipelineLayout, nullptr);
+    _descriptorTemplate.destroy(_engine->_device);
+    vkDestroyDescriptorSetLayout(_engine->_device, _descriptorLayout, nullptr);
+}
+
+void MipGenerator::add(const AllocatedImage& image)
+{
+    assert(image.imageFormat == VK_FORMAT_R8G8B8A8_UNORM);
+    pending.push_back(image);
+}
+
+void MipGenerator::take_acquire_barriers(std::vector<VkImageMemoryBarrier2>& barriers)
+{
+    barriers.insert(barriers.end(), acquires.begin(), acquires.end());
+    acquires.clear();
+}
+
+void MipGenerator::record(VkCommandBuffer cmd, DescriptorAllocator& descriptors, DeletionQueue& deletionQueue, bool release)
+{
+    lastBatchSize = static_cast<uint32_t>(pending.size());
+    if (pending.empty()) {
+        return;
+    }
+
+    VkDevice device = _engine->_device;
+
+    // the previous batch may still be counting on the old buffer
+    if (pending.size() > _counterCapacity) {
+        if (_counterBuffer.buffer != VK_NULL_HANDLE) {
+            deletionQueue.push_buffer(_counterBuffer);
+        }
+        _counterCapacity = std::max<uint32_t>(static_cast<uint32_t>(pending.size()), _counterCapacity * 2);
+        _counterBuffer = _engine->create_buffer(_counterCapacity * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY);
+        _countersCleared = false;
+    }
+
+    if (!_countersCleared) {
+        vkCmdFillBuffer(cmd, _counterBuffer.buffer, 0, VK_WHOLE_SIZE, 0);
+        vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_CLEAR_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+        _countersCleared = true;
+    }
+
+    std::vector<Job> jobs;
+    jobs.reserve(pending.size());
+    for (const AllocatedImage& image : pending) {
+        Job& job = jobs.emplace_back();
+        job.image = image;
+        job.mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(image.imageExtent.width, image.imageExtent.height)))) + 1;
+        job.nextMip = 0;
+        job.set = VK_NULL_HANDLE;
+
+        if (job.mipLevels == 1) {
+            continue;
+        }
+        assert(job.mipLevels <= MAX_MIP_VIEWS);
+
+        for (uint32_t mip = 0; mip < job.mipLevels; mip++) {
+            VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(image.imageFormat, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+            viewInfo.subresourceRange.baseMipLevel = mip;
+            viewInfo.subresourceRange.levelCount = 1;
+
+            VkImageView view;
+            VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &view));
+            job.views.push_back(view);
+        }
+
+        job.set = descriptors.allocate(device, _descriptorLayout);
+        DescriptorWriter writer;
+        for (uint32_t i = 0; i < MAX_MIP_VIEWS; i++) {
+            VkImageView view = job.views[std::min(i, job.mipLevels - 1)];
+            writer.write_image(0, view, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, i);
+        }
+        writer.update_set(device, job.set, _descriptorTemplate);
+    }
+    pending.clear();
+
+    // level 0 keeps the copied pixels, the other levels are overwritten so their contents are dropped
+    // barriers into SHADER_READ_ONLY_OPTIMAL, split into a release and an acquire when the graphics queue samples the images
+    std::vector<VkImageMemoryBarrier2> barriers;
+    auto finish_image = [&](VkImageMemoryBarrier2 barrier) {
+        if (release) {
+            barrier.srcQueueFamilyIndex = _engine->_computeQueueFamily;
+            barrier.dstQueueFamilyIndex = _engine->_graphicsQueueFamily;
+
+            // the graphics submit waits for this queue at the fragment shader stage
+            VkImageMemoryBarrier2 acquire = barrier;
+            acquire.srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+            acquire.srcAccessMask = VK_ACCESS_2_NONE;
+            acquires.push_back(acquire);
+
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.dstAccessMask = VK_ACCESS_2_NONE;
+        }
+        barriers.push_back(barrier);
+        };
+
+    for (const Job& job : jobs) {
+        VkImageMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.image = job.image.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier.subresourceRange.levelCount = 1;
+
+        if (job.mipLevels == 1) {
+            // nothing to generate, straight to the final layout
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+            barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            finish_image(barrier);
+            continue;
+        }
+        barriers.push_back(barrier);
+
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.subresourceRange.baseMipLevel = 1;
+        barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+        barriers.push_back(barrier);
+    }
+
+    // the counters were last written by the previous batch
+    VkMemoryBarrier2 counterBarrier{ .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+    counterBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    counterBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    counterBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    counterBarrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+
+    VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+    depInfo.memoryBarrierCount = 1;
+    depInfo.pMemoryBarriers = &counterBarrier;
+    depInfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+    depInfo.pImageMemoryBarriers = barriers.data();
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+
+    VkDeviceAddress counterAddress = _engine->get_buffer_address(_counterBuffer);
+
+    // images above MAX_SINGLE_PASS_SIZE need a second dispatch, after the first one is done
+    bool morePasses = true;
+    while (morePasses) {
+        morePasses = false;
+
+        for (uint32_t i = 0; i < jobs.size(); i++) {
+            Job& job = jobs[i];
+            if (job.nextMip + 1 >= job.mipLevels) {
+                continue;
+            }
+
+            uint32_t width = std::max(job.image.imageExtent.width >> job.nextMip, 1u);
+            uint32_t height = std::max(job.image.imageExtent.height >> job.nextMip, 1u);
+            uint32_t maxLevels = std::max(width, height) > MAX_SINGLE_PASS_SIZE ? TILE_LEVELS : TILE_LEVELS * 2;
+
+            PushConstants pushConstants;
+            pushConstants.counterBuffer = counterAddress;
+            pushConstants.counterIndex = i;
+            pushConstants.srcMip = job.nextMip;
+            pushConstants.mipCount = std::min(job.mipLevels - 1 - job.nextMip, maxLevels);
+
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &job.set, 0, nullptr);
+            vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+            // a workgroup covers 64x64 texels of the source level
+            vkCmdDispatch(cmd, (width + 63) / 64, (height + 63) / 64, 1);
+
+            job.nextMip += pushConstants.mipCount;
+            morePasses |= job.nextMip + 1 < job.mipLevels;
+        }
+
+        if (morePasses) {
+            vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+        }
+    }
+
+    barriers.clear();
+    for (const Job& job : jobs) {
+        if (job.mipLevels == 1) {
+            continue;
+        }
+
+        VkImageMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.image = job.image.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+        finish_image(barrier);
+
+        for (VkImageView view : job.views) {
+            deletionQueue.push_image_view(view);
+        }
+    }
+
+    if (!barriers.empty()) {
+        depInfo = { .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        depInfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+        depInfo.pImageMemoryBarriers = barriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+    }
+}
@@ -0,0 +1,283 @@
+#include <tv_pipeline_registry.h>
+#include <tv_initializers.h>
+
+#include <algorithm>
+
+void PipelineRegistry::init(VkDevice device, VkPipelineCache cache, WorkerPool* workers)
+{
+    _device = device;
+    _cache = cache;
+    _workers = workers;
+}
+
+void PipelineRegistry::destroy()
+{
+    // never destroy a pipeline a worker may still be writing
+    _workers->wait();
+
+    for (auto& [key, entry] : entries) {
+        vkDestroyPipeline(_device, entry.pipeline, nullptr);
+    }
+    entries.clear();
+    pending.clear();
+
+    for (auto& [path, module] : shaders) {
+        vkDestroyShaderModule(_device, module, nullptr);
+    }
+    shaders.clear();
+}
+
+VkShaderModule PipelineRegistry::get_shader(const char* filePath)
+{
+    auto it = shaders.find(filePath);
+    if (it != shaders.end()) {
+        return it->second;
+    }
+
+    VkShaderModule module;
+    if (!vkutil::load_shader_module(filePath, _device, &module)) {
+        printf("Error when building the shader module %s\n", filePath);
+        return VK_NULL_HANDLE;
+    }
+
+    shaders[filePath] = module;
+    return module;
+}
+
+size_t PipelineRegistry::key_of(const Entry& entry)
+{
+    if (!entry.isCompute) {
+        return entry.builder.hash();
+    }
+
+    // same fields as PipelineBuilder::hash covers for the graphics ones
+    size_t key = std::hash<uint32_t>{}(VK_SHADER_STAGE_COMPUTE_BIT);
+    hash_combine(key, std::hash<uint64_t>{}((uint64_t)entry.computeLayout));
+    hash_combine(key, std::hash<uint64_t>{}((uint64_t)entry.computeShader));
+    hash_combine(key, std::hash<uint32_t>{}(entry.computeFlags));
+    return key;
+}
+
+bool PipelineRegistry::same_state(const Entry& a, const Entry& b)
+{
+    if (a.isCompute != b.isCompute) {
+        return false;
+    }
+    if (a.isCompute) {
+        return a.computeLayout == b.computeLayout && a.computeShader == b.computeShader && a.computeFlags == b.computeFlags;
+    }
+    return a.builder.same_state(b.builder);
+}
+
+PipelineRegistry::Entry* PipelineRegistry::find(const Entry& request)
+{
+    auto [begin, end] = entries.equal_range(key_of(request));
+    for (auto it = begin; it != end; ++it) {
+        if (same_state(it->second, request)) {
+            return &it->second;
+        }
+    }
+    return nullptr;
+}
+
+PipelineRegistry::Entry* PipelineRegistry::find_or_add(const Entry& request, bool& added)
+{
+    stats.requested++;
+
+    Entry* entry = find(request);
+    added = entry == nullptr;
+    if (!added) {
+        stats.deduplicated++;
+        return entry;
+    }
+    return &entries.emplace(key_of(request), request)->second;
+}
+
+void PipelineRegistry::request_graphics(const PipelineBuilder& builder, VkPipeline* target)
+{
+    Entry request{};
+    request.isCompute = false;
+    request.builder = builder;
+    request.pipeline = VK_NULL_HANDLE;
+
+    bool added;
+    Entry* entry = find_or_add(request, added);
+    entry->targets.push_back(target);
+
+    if (!added) {
+        // already compiled and resolved, hand out the handle right away
+        if (std::find(pending.begin(), pending.end(), entry) == pending.end()) {
+            *target = entry->pipeline;
+        }
+        return;
+    }
+
+    compile(*entry);
+}
+
+void PipelineRegistry::request_compute(VkPipelineLayout layout, VkShaderModule shader, VkPipeline* target, VkPipelineCreateFlags flags)
+{
+    Entry request{};
+    request.isCompute = true;
+    request.computeLayout = layout;
+    request.computeShader = shader;
+    request.computeFlags = flags;
+    request.pipeline = VK_NULL_HANDLE;
+
+    bool added;
+    Entry* entry = find_or_add(request, added);
+    entry->targets.push_back(target);
+
+    if (!added) {
+        if (std::find(pending.begin(), pending.end(), entry) == pending.end()) {
+            *target = entry->pipeline;
+        }
+        return;
+    }
+
+    compile(*entry);
+}
+
+void PipelineRegistry::compile(Entry& entry)
+{
+    if (pending.empty()) {
+        firstPendingTime = std::chrono::steady_clock::now();
+    }
+    pending.push_back(&entry);
+
+    build(entry);
+}
+
+void PipelineRegistry::build(Entry& entry)
+{
+    Entry* e = &entry;
+    _workers->submit([this, e]() {
+        if (e->isCompute) {
+            VkComputePipelineCreateInfo info{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+            info.flags = e->computeFlags;
+            info.layout = e->computeLayout;
+            info.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, e->computeShader);
+
+            // the pipeline cache is internally synchronized, so every worker can share it.
+            // a broken reloaded shader must not abort, same as build_pipeline
+            if (vkCreateComputePipelines(_device, _cache, 1, &info, nullptr, &e->pipeline) != VK_SUCCESS) {
+                printf("Failed to create compute pipeline\n");
+                e->pipeline = VK_NULL_HANDLE;
+            }
+        }
+        else {
+            e->pipeline = e->builder.build_pipeline(_device, _cache);
+        }
+        });
+}
+
+void PipelineRegistry::wait()
+{
+    if (pending.empty()) {
+        return;
+    }
+
+    _workers->wait();
+
+    for (Entry* e : pending) {
+        for (VkPipeline* target : e->targets) {
+            *target = e->pipeline;
+        }
+        stats.compiled++;
+    }
+    pending.clear();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - firstPendingTime);
+    stats.compileTime += elapsed.count() / 1000.f;
+}
+
+bool PipelineRegistry::reload_shader(const std::string& filePath)
+{
+    auto shaderIt = shaders.find(filePath);
+    if (shaderIt == shaders.end()) {
+        // no pipeline was built from this shader
+        return false;
+    }
+
+    VkShaderModule newModule;
+    if (!vkutil::load_shader_module(filePath.c_str(), _device, &newModule)) {
+        printf("Error when reloading the shader module %s\n", filePath.c_str());
+        return false;
+    }
+
+    VkShaderModule oldModule = shaderIt->second;
+
+    // resolve the requests still compiling, their targets get copied below
+    wait();
+
+    // rebuild copies of the entries using the old module, the old entries stay until every copy built
+    std::vector<decltype(entries)::iterator> oldEntries;
+    std::vector<Entry> rebuilt;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        Entry& e = it->second;
+        bool usesShader = e.computeShader == oldModule;
+        for (const VkPipelineShaderStageCreateInfo& stage : e.builder._shaderStages) {
+            usesShader |= stage.module == oldModule;
+        }
+        if (!usesShader) {
+            continue;
+        }
+
+        oldEntries.push_back(it);
+        Entry& copy = rebuilt.emplace_back(e);
+        copy.pipeline = VK_NULL_HANDLE;
+        if (copy.isCompute) {
+            copy.computeShader = newModule;
+        }
+        for (VkPipelineShaderStageCreateInfo& stage : copy.builder._shaderStages) {
+            if (stage.module == oldModule) {
+                stage.module = newModule;
+            }
+        }
+    }
+
+    // the workers write into the copies, so the vector must not grow from here on
+    for (Entry& e : rebuilt) {
+        build(e);
+    }
+    _workers->wait();
+
+    if (std::any_of(rebuilt.begin(), rebuilt.end(), [](const Entry& e) { return e.pipeline == VK_NULL_HANDLE; })) {
+        for (Entry& e : rebuilt) {
+            vkDestroyPipeline(_device, e.pipeline, nullptr);
+        }
+        vkDestroyShaderModule(_device, newModule, nullptr);
+        printf("Error when rebuilding the pipelines of %s, keeping the old ones\n", filePath.c_str());
+        return false;
+    }
+
+    // erasing keeps the other iterators valid
+    for (auto it : oldEntries) {
+        vkDestroyPipeline(_device, it->second.pipeline, nullptr);
+        entries.erase(it);
+    }
+
+    // the keys change with the module
+    for (Entry& e : rebuilt) {
+        Entry* entry = find(e);
+        if (entry) {
+            // an entry with the same state exists already, its pipeline takes over the rebuilt targets
+            vkDestroyPipeline(_device, e.pipeline, nullptr);
+            entry->targets.insert(entry->targets.end(), e.targets.begin(), e.targets.end());
+        }
+        else {
+            entry = &entries.emplace(key_of(e), std::move(e))->second;
+        }
+        for (VkPipeline* target : entry->targets) {
+            *target = entry->pipeline;
+        }
+    }
+
+    shaderIt->second = newModule;
+    vkDestroyShaderModule(_device, oldModule, nullptr);
+
+    stats.reloaded++;
+    stats.compiled += static_cast<uint32_t>(rebuilt.size());
+    printf("Reloaded %s, rebuilt %zu pipelines\n", filePath.c_str(), rebuilt.size());
+    return true;
+}
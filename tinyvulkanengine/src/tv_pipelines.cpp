@@ -68,11 +68,19 @@ void PipelineBuilder::clear()
 
     _renderInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
 
+    _flags = 0;
+
     _shaderStages.clear();
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkPipelineCache cache)
 {
+    // the builder may have been copied (e.g. onto a worker thread), so point the
+    // render info back at our own format storage
+    if (_renderInfo.colorAttachmentCount > 0) {
+        _renderInfo.pColorAttachmentFormats = &_colorAttachmentformat;
+    }
+
     // make viewport state from our stored viewport and scissor.
     // at the moment we wont support multiple viewports or scissors
     VkPipelineViewportStateCreateInfo viewportState = {};
@@ -90,7 +98,8 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
 
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
+    // depth-only pipelines have no color attachment to blend
+    colorBlending.attachmentCount = _renderInfo.colorAttachmentCount;
     colorBlending.pAttachments = &_colorBlendAttachment;
 
     // completely clear VertexInputStateCreateInfo, as we have no need for it
@@ -113,6 +122,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDepthStencilState = &_depthStencil;
     pipelineInfo.layout = _pipelineLayout;
+    pipelineInfo.flags = _flags;
 
     VkDynamicState state[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
 
@@ -125,7 +135,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
     // its easy to error out on create graphics pipeline, so we handle it a bit
    // better than the common VK_CHECK case
     VkPipeline newPipeline;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo,
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo,
         nullptr, &newPipeline)
         != VK_SUCCESS) {
         printf("Failed to create pipeline\n");
@@ -136,6 +146,96 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
     }
 }
 
+size_t PipelineBuilder::hash() const
+{
+    size_t h = 0;
+
+    for (const VkPipelineShaderStageCreateInfo& stage : _shaderStages) {
+        hash_combine(h, std::hash<uint32_t>{}(stage.stage));
+        hash_combine(h, std::hash<uint64_t>{}((uint64_t)stage.module));
+        hash_combine(h, std::hash<std::string_view>{}(stage.pName));
+    }
+
+    hash_combine(h, std::hash<uint32_t>{}(_inputAssembly.topology));
+    hash_combine(h, std::hash<uint32_t>{}(_inputAssembly.primitiveRestartEnable));
+
+    hash_combine(h, std::hash<uint32_t>{}(_rasterizer.polygonMode));
+    hash_combine(h, std::hash<uint32_t>{}(_rasterizer.cullMode));
+    hash_combine(h, std::hash<uint32_t>{}(_rasterizer.frontFace));
+    hash_combine(h, std::hash<float>{}(_rasterizer.lineWidth));
+
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.blendEnable));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.srcColorBlendFactor));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.dstColorBlendFactor));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.colorBlendOp));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.srcAlphaBlendFactor));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.dstAlphaBlendFactor));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.alphaBlendOp));
+    hash_combine(h, std::hash<uint32_t>{}(_colorBlendAttachment.colorWriteMask));
+
+    hash_combine(h, std::hash<uint32_t>{}(_multisampling.rasterizationSamples));
+    hash_combine(h, std::hash<uint32_t>{}(_multisampling.sampleShadingEnable));
+    hash_combine(h, std::hash<uint32_t>{}(_multisampling.alphaToCoverageEnable));
+
+    hash_combine(h, std::hash<uint32_t>{}(_depthStencil.depthTestEnable));
+    hash_combine(h, std::hash<uint32_t>{}(_depthStencil.depthWriteEnable));
+    hash_combine(h, std::hash<uint32_t>{}(_depthStencil.depthCompareOp));
+
+    hash_combine(h, std::hash<uint32_t>{}(_renderInfo.colorAttachmentCount));
+    if (_renderInfo.colorAttachmentCount > 0) {
+        hash_combine(h, std::hash<uint32_t>{}(_colorAttachmentformat));
+    }
+    hash_combine(h, std::hash<uint32_t>{}(_renderInfo.depthAttachmentFormat));
+
+    hash_combine(h, std::hash<uint64_t>{}((uint64_t)_pipelineLayout));
+    hash_combine(h, std::hash<uint32_t>{}(_flags));
+
+    return h;
+}
+
+bool PipelineBuilder::same_state(const PipelineBuilder& other) const
+{
+    if (_shaderStages.size() != other._shaderStages.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < _shaderStages.size(); i++) {
+        const VkPipelineShaderStageCreateInfo& a = _shaderStages[i];
+        const VkPipelineShaderStageCreateInfo& b = other._shaderStages[i];
+        if (a.stage != b.stage || a.module != b.module || std::string_view(a.pName) != b.pName) {
+            return false;
+        }
+    }
+
+    const VkPipelineColorBlendAttachmentState& blend = _colorBlendAttachment;
+    const VkPipelineColorBlendAttachmentState& otherBlend = other._colorBlendAttachment;
+
+    return _inputAssembly.topology == other._inputAssembly.topology
+        && _inputAssembly.primitiveRestartEnable == other._inputAssembly.primitiveRestartEnable
+        && _rasterizer.polygonMode == other._rasterizer.polygonMode
+        && _rasterizer.cullMode == other._rasterizer.cullMode
+        && _rasterizer.frontFace == other._rasterizer.frontFace
+        && _rasterizer.lineWidth == other._rasterizer.lineWidth
+        && blend.blendEnable == otherBlend.blendEnable
+        && blend.srcColorBlendFactor == otherBlend.srcColorBlendFactor
+        && blend.dstColorBlendFactor == otherBlend.dstColorBlendFactor
+        && blend.colorBlendOp == otherBlend.colorBlendOp
+        && blend.srcAlphaBlendFactor == otherBlend.srcAlphaBlendFactor
+        && blend.dstAlphaBlendFactor == otherBlend.dstAlphaBlendFactor
+        && blend.alphaBlendOp == otherBlend.alphaBlendOp
+        && blend.colorWriteMask == otherBlend.colorWriteMask
+        && _multisampling.rasterizationSamples == other._multisampling.rasterizationSamples
+        && _multisampling.sampleShadingEnable == other._multisampling.sampleShadingEnable
+        && _multisampling.alphaToCoverageEnable == other._multisampling.alphaToCoverageEnable
+        && _depthStencil.depthTestEnable == other._depthStencil.depthTestEnable
+        && _depthStencil.depthWriteEnable == other._depthStencil.depthWriteEnable
+        && _depthStencil.depthCompareOp == other._depthStencil.depthCompareOp
+        && _renderInfo.colorAttachmentCount == other._renderInfo.colorAttachmentCount
+        && (_renderInfo.colorAttachmentCount == 0 || _colorAttachmentformat == other._colorAttachmentformat)
+        && _renderInfo.depthAttachmentFormat == other._renderInfo.depthAttachmentFormat
+        && _pipelineLayout == other._pipelineLayout
+        && _flags == other._flags;
+}
+
 void PipelineBuilder::set_shaders(VkShaderModule vertexShader, VkShaderModule fragmentShader)
 {
     _shaderStages.clear();
@@ -147,6 +247,14 @@ void PipelineBuilder::set_shaders(VkShaderModule vertexShader, VkShaderModule fr
         vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragmentShader));
 }
 
+void PipelineBuilder::set_vertex_shader(VkShaderModule vertexShader)
+{
+    _shaderStages.clear();
+
+    _shaderStages.push_back(
+        vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, vertexShader));
+}
+
 void PipelineBuilder::set_input_topology(VkPrimitiveTopology topology)
 {
     _inputAssembly.topology = topology;
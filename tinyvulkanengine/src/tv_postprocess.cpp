@@ -0,0 +1,93 @@
+#include <tv_postprocess.h>
+#include <tv_engine.h>
+#include <tv_images.h>
+#include <tv_initializers.h>
+
+void PostProcess::init(TinyVulkan* engine)
+{
+    _engine = engine;
+
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    // written every frame, so from the descriptor buffer when the engine has one
+    _descriptorLayout = builder.build(engine->_device, VK_SHADER_STAGE_COMPUTE_BIT, nullptr, engine->descriptor_layout_flags());
+    if (!engine->_descriptorBuffers) {
+        _descriptorTemplate = builder.build_template(engine->_device, _descriptorLayout);
+    }
+
+    VkPushConstantRange range{};
+    range.offset = 0;
+    range.size = sizeof(PushConstants);
+    range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &_descriptorLayout;
+    layoutInfo.pPushConstantRanges = &range;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(engine->_device, &layoutInfo, nullptr, &_pipelineLayout));
+
+    VkShaderModule upscaleShader = engine->pipelineRegistry.get_shader("../shaders/upscale.comp.spv");
+    VkShaderModule sharpenShader = engine->pipelineRegistry.get_shader("../shaders/sharpen.comp.spv");
+    if (upscaleShader == VK_NULL_HANDLE || sharpenShader == VK_NULL_HANDLE) {
+        printf("Error when building the post processing shaders \n");
+        assert(false);
+    }
+
+    engine->pipelineRegistry.request_compute(_pipelineLayout, upscaleShader, &_upscalePipeline, engine->descriptor_pipeline_flags());
+    engine->pipelineRegistry.request_compute(_pipelineLayout, sharpenShader, &_sharpenPipeline, engine->descriptor_pipeline_flags());
+}
+
+void PostProcess::destroy()
+{
+    vkDestroyPipelineLayout(_engine->_device, _pipelineLayout, nullptr);
+    _descriptorTemplate.destroy(_engine->_device);
+    vkDestroyDescriptorSetLayout(_engine->_device, _descriptorLayout, nullptr);
+}
+
+void PostProcess::dispatch(VkCommandBuffer cmd, VkPipeline pipeline, VkImageView input, VkImageView output,
+    const PushConstants& pushConstants)
+{
+    // the transient views can change between frames, so the set is made every frame
+    DescriptorWriter writer;
+    writer.write_image(0, input, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.write_image(1, output, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    _engine->bind_frame_descriptors(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, _descriptorLayout, writer,
+        _descriptorTemplate);
+    vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PushConstants), &pushConstants);
+    vkCmdDispatch(cmd, (pushConstants.outputSize.x + 15) / 16, (pushConstants.outputSize.y + 15) / 16, 1);
+}
+
+void PostProcess::add_passes(RenderGraph& graph, RGImage input, VkExtent2D inputExtent, RGImage output, VkExtent2D outputExtent)
+{
+    VkExtent3D size = { outputExtent.width, outputExtent.height, 1 };
+    // tonemapped, so the sharpening works on the values that get displayed
+    RGImage upscaled = graph.create_transient("upscaled", size, VK_FORMAT_R16G16B16A16_SFLOAT);
+    // the swapchain format has no guaranteed storage support, this one does
+    RGImage finalImage = graph.create_transient("final", size, VK_FORMAT_R8G8B8A8_UNORM);
+
+    PushConstants pushConstants;
+    pushConstants.inputSize = glm::ivec2(inputExtent.width, inputExtent.height);
+    pushConstants.outputSize = glm::ivec2(outputExtent.width, outputExtent.height);
+    pushConstants.exposure = exposure;
+    pushConstants.sharpness = sharpness;
+
+    graph.add_pass("upscale", { { input, ImageUsage::StorageRead }, { upscaled, ImageUsage::StorageWrite } },
+        [=, this, &graph](VkCommandBuffer cmd) {
+            dispatch(cmd, _upscalePipeline, graph.get_view(input), graph.get_view(upscaled), pushConstants);
+        });
+
+    graph.add_pass("sharpen", { { upscaled, ImageUsage::StorageRead }, { finalImage, ImageUsage::StorageWrite } },
+        [=, this, &graph](VkCommandBuffer cmd) {
+            dispatch(cmd, _sharpenPipeline, graph.get_view(upscaled), graph.get_view(finalImage), pushConstants);
+        });
+
+    // same size, the blit only converts to the swapchain format
+    graph.add_pass("present copy", { { finalImage, ImageUsage::TransferSrc }, { output, ImageUsage::TransferDst } },
+        [=, &graph](VkCommandBuffer cmd) {
+            vkutil::copy_image_to_image(cmd, graph.get_image(finalImage), graph.get_image(output), outputExtent, outputExtent);
+        });
+}
@@ -0,0 +1,474 @@
+#include <tv_render_graph.h>
+#include <tv_engine.h>
+#include <tv_initializers.h>
+
+#include <algorithm>
+#include <numeric>
+
+namespace {
+    // Layout, synchronization scope and image usage flag of an ImageUsage
+    struct UsageInfo {
+        VkImageLayout layout;
+        VkPipelineStageFlags2 stage;
+        VkAccessFlags2 access;
+        VkImageUsageFlags imageUsage;
+        bool reads;
+        bool writes;
+    };
+
+    constexpr VkAccessFlags2 WRITE_ACCESS = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+        | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+    UsageInfo usage_info(ImageUsage usage)
+    {
+        switch (usage) {
+        case ImageUsage::ColorAttachment:
+            return { VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true, true };
+        case ImageUsage::DepthAttachment:
+            return { VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL,
+                VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true, true };
+        case ImageUsage::StorageWrite:
+            return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                VK_IMAGE_USAGE_STORAGE_BIT, false, true };
+        case ImageUsage::StorageRead:
+            return { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+                VK_IMAGE_USAGE_STORAGE_BIT, true, false };
+        case ImageUsage::Sampled:
+            return { VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_IMAGE_USAGE_SAMPLED_BIT, true, false };
+        case ImageUsage::TransferSrc:
+            return { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT,
+                VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, true, false };
+        case ImageUsage::TransferDst:
+        default:
+            return { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT,
+                VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_USAGE_TRANSFER_DST_BIT, false, true };
+        }
+    }
+
+    VkImageAspectFlags aspect_of(VkFormat format)
+    {
+        switch (format) {
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_D32_SFLOAT:
+        case VK_FORMAT_X8_D24_UNORM_PACK32:
+            return VK_IMAGE_ASPECT_DEPTH_BIT;
+        case VK_FORMAT_D16_UNORM_S8_UINT:
+        case VK_FORMAT_D24_UNORM_S8_UINT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        default:
+            return VK_IMAGE_ASPECT_COLOR_BIT;
+        }
+    }
+}
+
+void RenderGraph::init(TinyVulkan* engine)
+{
+    _engine = engine;
+}
+
+void RenderGraph::destroy()
+{
+    destroy_transients(false);
+    importedStates.clear();
+}
+
+void RenderGraph::begin()
+{
+    resources.clear();
+    passes.clear();
+}
+
+RGImage RenderGraph::import_image(const char* name, VkImage image, VkImageView view, VkExtent3D extent, VkFormat format,
+    const ImageState* initial)
+{
+    Resource& resource = resources.emplace_back();
+    resource.name = name;
+    resource.image = image;
+    resource.view = view;
+    resource.extent = extent;
+    resource.format = format;
+    resource.imported = true;
+
+    if (initial) {
+        resource.state = *initial;
+    }
+    else {
+        auto it = importedStates.find(image);
+        resource.state = it != importedStates.end() ? it->second : ImageState{ VK_IMAGE_LAYOUT_UNDEFINED };
+    }
+
+    return static_cast<RGImage>(resources.size() - 1);
+}
+
+RGImage RenderGraph::create_transient(const char* name, VkExtent3D extent, VkFormat format)
+{
+    Resource& resource = resources.emplace_back();
+    resource.name = name;
+    resource.image = VK_NULL_HANDLE;
+    resource.view = VK_NULL_HANDLE;
+    resource.extent = extent;
+    resource.format = format;
+    resource.imported = false;
+
+    return static_cast<RGImage>(resources.size() - 1);
+}
+
+void RenderGraph::mark_output(RGImage image)
+{
+    resources[image].output = true;
+}
+
+void RenderGraph::present(RGImage image)
+{
+    resources[image].output = true;
+    resources[image].present = true;
+}
+
+void RenderGraph::add_pass(const char* name, std::initializer_list<ImageAccess> accesses, std::function<void(VkCommandBuffer)>&& record)
+{
+    Pass& pass = passes.emplace_back();
+    pass.name = name;
+    pass.accesses = accesses;
+    pass.record = std::move(record);
+    pass.culled = false;
+}
+
+VkImage RenderGraph::get_image(RGImage image) const
+{
+    return resources[image].image;
+}
+
+VkImageView RenderGraph::get_view(RGImage image) const
+{
+    return resources[image].view;
+}
+
+void RenderGraph::cull_passes()
+{
+    // walk back from the outputs, a pass stays when a later pass or an output needs what it writes
+    std::vector<bool> needed(resources.size());
+    for (size_t i = 0; i < resources.size(); i++) {
+        needed[i] = resources[i].output;
+    }
+
+    for (size_t p = passes.size(); p-- > 0;) {
+        Pass& pass = passes[p];
+
+        pass.culled = true;
+        for (const ImageAccess& access : pass.accesses) {
+            if (usage_info(access.usage).writes && needed[access.image]) {
+                pass.culled = false;
+            }
+        }
+        if (pass.culled) {
+            continue;
+        }
+
+        // a write that ignores the previous contents makes the earlier writers unnecessary
+        for (const ImageAccess& access : pass.accesses) {
+            UsageInfo info = usage_info(access.usage);
+            if (info.writes && !info.reads) {
+                needed[access.image] = false;
+            }
+        }
+        for (const ImageAccess& access : pass.accesses) {
+            if (usage_info(access.usage).reads) {
+                needed[access.image] = true;
+            }
+        }
+    }
+
+    for (Resource& resource : resources) {
+        resource.firstPass = UINT32_MAX;
+        resource.lastPass = 0;
+        resource.usage = 0;
+    }
+    for (uint32_t p = 0; p < passes.size(); p++) {
+        if (passes[p].culled) {
+            continue;
+        }
+        for (const ImageAccess& access : passes[p].accesses) {
+            Resource& resource = resources[access.image];
+            resource.firstPass = std::min(resource.firstPass, p);
+            resource.lastPass = std::max(resource.lastPass, p);
+            resource.usage |= usage_info(access.usage).imageUsage;
+        }
+    }
+}
+
+void RenderGraph::allocate_transients()
+{
+    std::vector<RGImage> requests;
+    for (RGImage i = 0; i < resources.size(); i++) {
+        if (!resources[i].imported && resources[i].firstPass != UINT32_MAX) {
+            requests.push_back(i);
+        }
+    }
+
+    // same images used by the same passes as last frame, keep them
+    bool unchanged = requests.size() == transients.size();
+    for (size_t i = 0; unchanged && i < requests.size(); i++) {
+        const Resource& resource = resources[requests[i]];
+        const TransientImage& transient = transients[i];
+        unchanged = transient.name == resource.name && transient.format == resource.format && transient.usage == resource.usage
+            && transient.extent.width == resource.extent.width && transient.extent.height == resource.extent.height
+            && transient.extent.depth == resource.extent.depth
+            && transient.firstPass == resource.firstPass && transient.lastPass == resource.lastPass;
+    }
+
+    if (!unchanged) {
+        // the frame in flight may still use the old ones
+        destroy_transients(true);
+
+        VkDevice device = _engine->_device;
+        std::vector<VkMemoryRequirements> requirements(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            const Resource& resource = resources[requests[i]];
+
+            TransientImage& transient = transients.emplace_back();
+            transient.name = resource.name;
+            transient.extent = resource.extent;
+            transient.format = resource.format;
+            transient.usage = resource.usage;
+            transient.firstPass = resource.firstPass;
+            transient.lastPass = resource.lastPass;
+
+            VkImageCreateInfo imageInfo = vkinit::image_create_info(resource.format, resource.usage, resource.extent);
+            VK_CHECK(vkCreateImage(device, &imageInfo, nullptr, &transient.image));
+            vkGetImageMemoryRequirements(device, transient.image, &requirements[i]);
+        }
+
+        // largest first, each image goes to the first block whose images are all done before it starts
+        std::vector<size_t> order(requests.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return requirements[a].size > requirements[b].size; });
+
+        std::vector<VkMemoryRequirements> blockRequirements;
+        std::vector<std::vector<size_t>> blockImages;
+        for (size_t i : order) {
+            TransientImage& transient = transients[i];
+
+            uint32_t block = 0;
+            for (; block < blockImages.size(); block++) {
+                if ((blockRequirements[block].memoryTypeBits & requirements[i].memoryTypeBits) == 0) {
+                    continue;
+                }
+                bool overlaps = std::any_of(blockImages[block].begin(), blockImages[block].end(), [&](size_t other) {
+                    return transients[other].firstPass <= transient.lastPass && transient.firstPass <= transients[other].lastPass;
+                    });
+                if (!overlaps) {
+                    break;
+                }
+            }
+
+            if (block == blockImages.size()) {
+                blockRequirements.push_back(requirements[i]);
+                blockImages.emplace_back();
+            }
+            else {
+                VkMemoryRequirements& blockReq = blockRequirements[block];
+                blockReq.size = std::max(blockReq.size, requirements[i].size);
+                blockReq.alignment = std::max(blockReq.alignment, requirements[i].alignment);
+                blockReq.memoryTypeBits &= requirements[i].memoryTypeBits;
+            }
+            blockImages[block].push_back(i);
+            transient.block = block;
+        }
+
+        for (uint32_t block = 0; block < blockImages.size(); block++) {
+            VmaAllocationCreateInfo allocInfo = {};
+            allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+            allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            MemoryTracker::set_category(allocInfo, MemoryCategory::RenderTarget);
+
+            MemoryBlock& memory = blocks.emplace_back();
+            memory.state = ImageState{ VK_IMAGE_LAYOUT_UNDEFINED };
+            VK_CHECK(vmaAllocateMemory(_engine->_allocator, &blockRequirements[block], &allocInfo, &memory.allocation, nullptr));
+            _engine->memoryTracker.add(memory.allocation);
+
+            for (size_t i : blockImages[block]) {
+                TransientImage& transient = transients[i];
+                VK_CHECK(vmaBindImageMemory(_engine->_allocator, memory.allocation, transient.image));
+
+                VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(transient.format, transient.image, aspect_of(transient.format));
+                VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &transient.view));
+            }
+        }
+    }
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        Resource& resource = resources[requests[i]];
+        resource.image = transients[i].image;
+        resource.view = transients[i].view;
+        resource.transientIndex = static_cast<uint32_t>(i);
+    }
+
+    stats.transientImages = static_cast<uint32_t>(transients.size());
+    stats.transientBlocks = static_cast<uint32_t>(blocks.size());
+}
+
+void RenderGraph::destroy_transients(bool deferred)
+{
+    if (transients.empty()) {
+        return;
+    }
+
+    for (const TransientImage& transient : transients) {
+        if (deferred) {
+            _engine->deletionQueue.push_image_view(transient.view);
+            _engine->deletionQueue.push_raw_image(transient.image);
+        }
+        else {
+            vkDestroyImageView(_engine->_device, transient.view, nullptr);
+            vkDestroyImage(_engine->_device, transient.image, nullptr);
+        }
+    }
+    // the queue frees memory after the images bound to it
+    for (const MemoryBlock& block : blocks) {
+        if (deferred) {
+            _engine->deletionQueue.push_memory(block.allocation);
+        }
+        else {
+            _engine->memoryTracker.remove(block.allocation);
+            vmaFreeMemory(_engine->_allocator, block.allocation);
+        }
+    }
+    transients.clear();
+    blocks.clear();
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+    cull_passes();
+    allocate_transients();
+
+    stats.passes = 0;
+    stats.culledPasses = 0;
+    stats.barriers = 0;
+
+    std::vector<VkImageMemoryBarrier2> barriers;
+    auto transition = [&](Resource& resource, const UsageInfo& info, bool discard) {
+        ImageState& state = resource.state;
+        bool layoutChange = state.layout != info.layout;
+
+        VkPipelineStageFlags2 srcStage;
+        if (layoutChange || info.writes) {
+            // the transition or write must not overtake any earlier use
+            srcStage = state.writeStage | state.readStages;
+        }
+        else if (state.writeStage != VK_PIPELINE_STAGE_2_NONE && (info.stage & ~state.readStages) != 0) {
+            // a read from stages the last write was not made visible to yet
+            srcStage = state.writeStage;
+        }
+        else {
+            state.readStages |= info.stage;
+            return;
+        }
+
+        if (!layoutChange && srcStage == VK_PIPELINE_STAGE_2_NONE) {
+            // first use without a previous one to wait for
+            state = { info.layout, info.writes ? info.stage : VK_PIPELINE_STAGE_2_NONE, info.access & WRITE_ACCESS,
+                info.reads ? info.stage : VK_PIPELINE_STAGE_2_NONE };
+            return;
+        }
+
+        VkImageMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+        barrier.srcStageMask = srcStage;
+        barrier.srcAccessMask = state.writeAccess;
+        barrier.dstStageMask = info.stage;
+        barrier.dstAccessMask = info.access;
+        barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+        barrier.newLayout = info.layout;
+        barrier.image = resource.image;
+        barrier.subresourceRange = vkinit::image_subresource_range(aspect_of(resource.format));
+        barriers.push_back(barrier);
+
+        if (layoutChange || info.writes) {
+            // later uses wait for this barrier's destination stages, which includes the transition
+            state = { info.layout, info.stage, info.access & WRITE_ACCESS, info.reads ? info.stage : VK_PIPELINE_STAGE_2_NONE };
+        }
+        else {
+            state.readStages |= info.stage;
+        }
+        };
+
+    auto flush_barriers = [&]() {
+        if (barriers.empty()) {
+            return;
+        }
+        VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        depInfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+        depInfo.pImageMemoryBarriers = barriers.data();
+        vkCmdPipelineBarrier2(cmd, &depInfo);
+
+        stats.barriers += static_cast<uint32_t>(barriers.size());
+        barriers.clear();
+        };
+
+    for (uint32_t p = 0; p < passes.size(); p++) {
+        Pass& pass = passes[p];
+        if (pass.culled) {
+            stats.culledPasses++;
+            continue;
+        }
+        stats.passes++;
+
+        // a transient starts from the last use of whichever image had its memory before, this frame
+        // or the last one, so its first barrier also waits for that image to be done with the memory
+        for (const ImageAccess& access : pass.accesses) {
+            Resource& resource = resources[access.image];
+            if (!resource.imported && resource.firstPass == p) {
+                resource.state = blocks[transients[resource.transientIndex].block].state;
+                resource.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            }
+        }
+
+        // every barrier the pass needs goes into one call
+        for (const ImageAccess& access : pass.accesses) {
+            Resource& resource = resources[access.image];
+            UsageInfo info = usage_info(access.usage);
+            // nothing reads the previous contents, so they can be dropped
+            bool discard = resource.firstPass == p && (!resource.imported || !info.reads);
+            transition(resource, info, discard);
+
+            // the block follows the image using it now, the next image placed in it waits for that
+            if (!resource.imported) {
+                blocks[transients[resource.transientIndex].block].state = resource.state;
+            }
+        }
+        flush_barriers();
+
+        pass.record(cmd);
+    }
+
+    for (Resource& resource : resources) {
+        if (resource.present) {
+            VkImageMemoryBarrier2 barrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+            // presentation waits on the submit's semaphore, nothing to wait for here
+            barrier.srcStageMask = resource.state.writeStage | resource.state.readStages;
+            barrier.srcAccessMask = resource.state.writeAccess;
+            barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+            barrier.dstAccessMask = VK_ACCESS_2_NONE;
+            barrier.oldLayout = resource.state.layout;
+            barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+            barrier.image = resource.image;
+            barrier.subresourceRange = vkinit::image_subresource_range(aspect_of(resource.format));
+            barriers.push_back(barrier);
+
+            resource.state.layout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        }
+    }
+    flush_barriers();
+
+    // remember where every imported image was left for the next frame, the blocks already hold their last user's
+    for (Resource& resource : resources) {
+        if (resource.imported && resource.firstPass != UINT32_MAX) {
+            importedStates[resource.image] = resource.state;
+        }
+    }
+}
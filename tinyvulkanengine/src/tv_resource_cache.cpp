@@ -0,0 +1,133 @@
+#include "tv_resource_cache.h"
+#include "tv_engine.h"
+
+#include <algorithm>
+#include <string_view>
+
+void ResourceCache::init(TinyVulkan* engine)
+{
+    _engine = engine;
+}
+
+void ResourceCache::destroy()
+{
+    if (!textures.empty() || !meshes.empty() || materials.size() > 0) {
+        printf("resource cache destroyed with %zu textures, %zu meshes and %zu materials still referenced\n",
+            textures.size(), meshes.size(), materials.size());
+    }
+
+    for (auto& [key, entry] : textures) {
+        _engine->textureStreamer.remove_texture(entry.resource);
+    }
+    for (PooledMesh& mesh : meshData.values()) {
+        _engine->destroy_buffer(mesh.buffers.indexBuffer);
+        _engine->destroy_buffer(mesh.buffers.vertexBuffer);
+    }
+
+    textures.clear();
+    textureKeys.clear();
+    meshes.clear();
+    meshKeys.clear();
+    meshData = {};
+    materials = {};
+    stats = {};
+}
+
+size_t ResourceCache::hash_bytes(std::span<const uint8_t> bytes)
+{
+    return std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
+}
+
+template<typename T>
+auto ResourceCache::find(std::unordered_multimap<size_t, Entry<T>>& entries, std::span<const uint8_t> contents)
+{
+    auto [begin, end] = entries.equal_range(hash_bytes(contents));
+    auto it = std::find_if(begin, end, [&](const auto& entry) {
+        return std::ranges::equal(entry.second.contents, contents);
+        });
+    return it != end ? it : entries.end();
+}
+
+TextureHandle ResourceCache::acquire_texture(std::span<const uint8_t> bytes)
+{
+    auto it = find(textures, bytes);
+    if (it == textures.end()) {
+        return INVALID_TEXTURE;
+    }
+
+    it->second.refCount++;
+    stats.textureHits++;
+    return it->second.resource;
+}
+
+void ResourceCache::add_texture(std::span<const uint8_t> bytes, TextureHandle texture)
+{
+    size_t key = hash_bytes(bytes);
+    textures.emplace(key, Entry<TextureHandle>{ texture, 1, std::vector<uint8_t>(bytes.begin(), bytes.end()) });
+    textureKeys[texture] = key;
+    stats.textures++;
+}
+
+void ResourceCache::release_texture(TextureHandle texture)
+{
+    auto keyIt = textureKeys.find(texture);
+    assert(keyIt != textureKeys.end());
+
+    auto [begin, end] = textures.equal_range(keyIt->second);
+    auto it = std::find_if(begin, end, [&](const auto& entry) { return entry.second.resource == texture; });
+    if (--it->second.refCount > 0) {
+        return;
+    }
+
+    _engine->textureStreamer.remove_texture(texture);
+    textures.erase(it);
+    textureKeys.erase(keyIt);
+    stats.textures--;
+}
+
+const MeshGeometry* ResourceCache::acquire_mesh(std::span<const uint8_t> contents)
+{
+    auto it = find(meshes, contents);
+    if (it == meshes.end()) {
+        return nullptr;
+    }
+
+    it->second.refCount++;
+    stats.meshHits++;
+    return &it->second.resource;
+}
+
+MeshHandle ResourceCache::add_mesh(std::vector<uint8_t> contents, PooledMesh mesh, std::vector<GeoSurface> surfaces)
+{
+    // the cached surfaces must not keep the first file's materials alive
+    for (GeoSurface& surface : surfaces) {
+        surface.material.reset();
+    }
+
+    MeshHandle handle = meshData.add(std::move(mesh));
+    size_t key = hash_bytes(contents);
+    meshes.emplace(key, Entry<MeshGeometry>{ MeshGeometry{ handle, std::move(surfaces) }, 1, std::move(contents) });
+    meshKeys[handle.value] = key;
+    stats.meshes++;
+    return handle;
+}
+
+void ResourceCache::release_mesh(MeshHandle handle)
+{
+    auto keyIt = meshKeys.find(handle.value);
+    assert(keyIt != meshKeys.end());
+
+    auto [begin, end] = meshes.equal_range(keyIt->second);
+    auto it = std::find_if(begin, end, [&](const auto& entry) { return entry.second.resource.buffers == handle; });
+    if (--it->second.refCount > 0) {
+        return;
+    }
+
+    // objects drawn by the frames in flight may still read them
+    GPUMeshBuffers buffers = meshData.remove(it->second.resource.buffers).buffers;
+    _engine->deletionQueue.push_buffer(buffers.indexBuffer);
+    _engine->deletionQueue.push_buffer(buffers.vertexBuffer);
+    meshes.erase(it);
+    meshKeys.erase(keyIt);
+    stats.meshes--;
+}
@@ -0,0 +1,94 @@
+#include "tv_sampler_cache.h"
+
+void SamplerCache::init(VkDevice device)
+{
+    _device = device;
+
+    VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    sampl.magFilter = VK_FILTER_LINEAR;
+    sampl.minFilter = VK_FILTER_LINEAR;
+    uint32_t linear = get_index(sampl);
+
+    sampl.magFilter = VK_FILTER_NEAREST;
+    sampl.minFilter = VK_FILTER_NEAREST;
+    uint32_t nearest = get_index(sampl);
+
+    assert(linear == SAMPLER_LINEAR && nearest == SAMPLER_NEAREST);
+}
+
+void SamplerCache::destroy()
+{
+    for (VkSampler sampler : _samplers) {
+        vkDestroySampler(_device, sampler, nullptr);
+    }
+    _samplers.clear();
+    _infos.clear();
+    _indices.clear();
+    stats = {};
+}
+
+size_t SamplerCache::sampler_key(const VkSamplerCreateInfo& info)
+{
+    size_t key = std::hash<uint32_t>{}(info.flags);
+    hash_combine(key, std::hash<uint32_t>{}(info.magFilter));
+    hash_combine(key, std::hash<uint32_t>{}(info.minFilter));
+    hash_combine(key, std::hash<uint32_t>{}(info.mipmapMode));
+    hash_combine(key, std::hash<uint32_t>{}(info.addressModeU));
+    hash_combine(key, std::hash<uint32_t>{}(info.addressModeV));
+    hash_combine(key, std::hash<uint32_t>{}(info.addressModeW));
+    hash_combine(key, std::hash<float>{}(info.mipLodBias));
+    hash_combine(key, std::hash<uint32_t>{}(info.anisotropyEnable));
+    hash_combine(key, std::hash<float>{}(info.maxAnisotropy));
+    hash_combine(key, std::hash<uint32_t>{}(info.compareEnable));
+    hash_combine(key, std::hash<uint32_t>{}(info.compareOp));
+    hash_combine(key, std::hash<float>{}(info.minLod));
+    hash_combine(key, std::hash<float>{}(info.maxLod));
+    hash_combine(key, std::hash<uint32_t>{}(info.borderColor));
+    hash_combine(key, std::hash<uint32_t>{}(info.unnormalizedCoordinates));
+    return key;
+}
+
+bool SamplerCache::same_info(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b)
+{
+    return a.flags == b.flags && a.magFilter == b.magFilter && a.minFilter == b.minFilter && a.mipmapMode == b.mipmapMode
+        && a.addressModeU == b.addressModeU && a.addressModeV == b.addressModeV && a.addressModeW == b.addressModeW
+        && a.mipLodBias == b.mipLodBias && a.anisotropyEnable == b.anisotropyEnable && a.maxAnisotropy == b.maxAnisotropy
+        && a.compareEnable == b.compareEnable && a.compareOp == b.compareOp && a.minLod == b.minLod && a.maxLod == b.maxLod
+        && a.borderColor == b.borderColor && a.unnormalizedCoordinates == b.unnormalizedCoordinates;
+}
+
+uint32_t SamplerCache::get_index(const VkSamplerCreateInfo& info)
+{
+    assert(info.pNext == nullptr);
+    size_t key = sampler_key(info);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto [begin, end] = _indices.equal_range(key);
+    for (auto it = begin; it != end; ++it) {
+        if (same_info(_infos[it->second], info)) {
+            stats.hits++;
+            return it->second;
+        }
+    }
+
+    VkSampler sampler;
+    VK_CHECK(vkCreateSampler(_device, &info, nullptr, &sampler));
+
+    uint32_t index = (uint32_t)_samplers.size();
+    _samplers.push_back(sampler);
+    _infos.push_back(info);
+    _indices.emplace(key, index);
+    stats.samplers++;
+    return index;
+}
+
+VkSampler SamplerCache::get(uint32_t index)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _samplers[index];
+}
+
+VkSampler SamplerCache::get_sampler(const VkSamplerCreateInfo& info)
+{
+    return get(get_index(info));
+}
@@ -0,0 +1,164 @@
+#include <tv_shader_reload.h>
+
+#include <set>
+#include <cstdlib>
+#include <chrono>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+static bool is_shader_source(const std::string& extension)
+{
+    return extension == ".vert" || extension == ".frag" || extension == ".comp";
+}
+
+static int run_command(std::string command)
+{
+#ifdef _WIN32
+    // cmd.exe strips the outer quotes of the whole line
+    command = "\"" + command + "\"";
+#endif
+    return std::system(command.c_str());
+}
+
+bool ShaderWatcher::init(const std::string& shaderDir, const std::string& validatorPath)
+{
+    _shaderDir = shaderDir;
+    _validator = validatorPath;
+
+    // the default is a bare name looked up on the PATH, so run it once to see it is there
+#ifdef _WIN32
+    const char* quiet = " > NUL 2>&1";
+#else
+    const char* quiet = " > /dev/null 2>&1";
+#endif
+    if (_validator.empty() || run_command("\"" + _validator + "\" --version" + quiet) != 0) {
+        printf("Shader hot-reload disabled: glslangValidator not found\n");
+        return false;
+    }
+
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK);
+    if (inotifyFd < 0 || inotify_add_watch(inotifyFd, _shaderDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        printf("Shader hot-reload disabled: cannot watch %s\n", _shaderDir.c_str());
+        return false;
+    }
+#else
+    std::error_code ec;
+    for (const auto& file : std::filesystem::directory_iterator(_shaderDir, ec)) {
+        writeTimes[file.path().filename().string()] = file.last_write_time(ec);
+    }
+    if (ec) {
+        printf("Shader hot-reload disabled: cannot watch %s\n", _shaderDir.c_str());
+        return false;
+    }
+#endif
+
+    stopping = false;
+    thread = std::thread([this]() { watch_loop(); });
+    return true;
+}
+
+void ShaderWatcher::stop()
+{
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+#ifdef __linux__
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+}
+
+std::vector<std::string> ShaderWatcher::take_compiled()
+{
+    std::lock_guard<std::mutex> lock(compiledMutex);
+    std::vector<std::string> result;
+    result.swap(compiled);
+    return result;
+}
+
+void ShaderWatcher::watch_loop()
+{
+    while (!stopping) {
+        // editors often write a file several times in a row, only compile it once per batch
+        std::set<std::string> changed;
+
+#ifdef __linux__
+        pollfd pfd{ inotifyFd, POLLIN, 0 };
+        // short timeout so stop() never waits long
+        if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            if (event->len > 0) {
+                changed.insert(event->name);
+            }
+            offset += sizeof(inotify_event) + event->len;
+        }
+#else
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        std::error_code ec;
+        for (const auto& file : std::filesystem::directory_iterator(_shaderDir, ec)) {
+            std::string name = file.path().filename().string();
+            auto writeTime = file.last_write_time(ec);
+
+            auto it = writeTimes.find(name);
+            if (it == writeTimes.end() || it->second != writeTime) {
+                writeTimes[name] = writeTime;
+                changed.insert(name);
+            }
+        }
+#endif
+
+        for (const std::string& name : changed) {
+            handle_change(name);
+        }
+    }
+}
+
+void ShaderWatcher::handle_change(const std::string& fileName)
+{
+    std::string extension = std::filesystem::path(fileName).extension().string();
+
+    if (is_shader_source(extension)) {
+        compile(fileName);
+    }
+    else if (extension == ".glsl") {
+        // we do not track which shader includes what, so rebuild all of them
+        std::error_code ec;
+        for (const auto& file : std::filesystem::directory_iterator(_shaderDir, ec)) {
+            if (is_shader_source(file.path().extension().string())) {
+                compile(file.path().filename().string());
+            }
+        }
+    }
+}
+
+void ShaderWatcher::compile(const std::string& fileName)
+{
+    // same paths the pipeline registry loaded the modules from
+    std::string source = _shaderDir + "/" + fileName;
+    std::string output = source + ".spv";
+
+    std::string command = "\"" + _validator + "\" -V \"" + source + "\" -o \"" + output + "\"";
+    if (run_command(command) != 0) {
+        printf("Shader hot-reload: failed to compile %s\n", source.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(compiledMutex);
+    compiled.push_back(output);
+}
@@ -0,0 +1,394 @@
+#include <tv_shadows.h>
+#include <tv_engine.h>
+#include <tv_initializers.h>
+#include <tv_pipelines.h>
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+// Size of every cascade, in texels
+constexpr uint32_t SHADOW_RESOLUTION = 2048;
+// Near plane of the camera, where the first cascade starts
+constexpr float SHADOW_NEAR = 0.1f;
+// Weight of a new measurement in the smoothed cascade times
+constexpr float SMOOTHING = 0.2f;
+
+void ShadowCascades::init(TinyVulkan* engine, uint32_t frameCount)
+{
+    _engine = engine;
+    _frames.resize(frameCount);
+    VkDevice device = engine->_device;
+
+    _shadowMap.imageFormat = VK_FORMAT_D32_SFLOAT;
+    _shadowMap.imageExtent = { SHADOW_RESOLUTION, SHADOW_RESOLUTION, 1 };
+
+    VkImageCreateInfo imageInfo = vkinit::image_create_info(_shadowMap.imageFormat,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, _shadowMap.imageExtent);
+    imageInfo.arrayLayers = SHADOW_CASCADES;
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+    allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    MemoryTracker::set_category(allocInfo, MemoryCategory::RenderTarget);
+
+    VK_CHECK(vmaCreateImage(engine->_allocator, &imageInfo, &allocInfo, &_shadowMap.image, &_shadowMap.allocation, nullptr));
+    engine->memoryTracker.add(_shadowMap.allocation);
+
+    VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(_shadowMap.imageFormat, _shadowMap.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.subresourceRange.layerCount = SHADOW_CASCADES;
+    VK_CHECK(vkCreateImageView(device, &viewInfo, nullptr, &_shadowMap.imageView));
+
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        VkImageViewCreateInfo layerInfo = vkinit::imageview_create_info(_shadowMap.imageFormat, _shadowMap.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+        layerInfo.subresourceRange.baseArrayLayer = i;
+        VK_CHECK(vkCreateImageView(device, &layerInfo, nullptr, &_layerViews[i]));
+    }
+
+    // Reverse-Z, the fragment is lit when it is at least as close to the sun as the stored depth.
+    // The border is the far plane, so everything outside the map is lit
+    VkSamplerCreateInfo samplerInfo = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+    _sampler = engine->samplerCache.get_sampler(samplerInfo);
+
+    VkPushConstantRange range{};
+    range.offset = 0;
+    range.size = sizeof(PushConstants);
+    range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkPipelineLayoutCreateInfo layoutInfo = vkinit::pipeline_layout_create_info();
+    layoutInfo.pPushConstantRanges = &range;
+    layoutInfo.pushConstantRangeCount = 1;
+    VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_pipelineLayout));
+
+    VkShaderModule shader = engine->pipelineRegistry.get_shader("../shaders/shadow.vert.spv");
+    if (shader == VK_NULL_HANDLE) {
+        printf("Error when building the shadow vertex shader \n");
+        assert(false);
+    }
+
+    PipelineBuilder builder;
+    builder.set_vertex_shader(shader);
+    builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+    builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+    builder.set_multisampling_none();
+    builder.disable_blending();
+    builder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+    builder.set_depth_format(_shadowMap.imageFormat);
+    builder._pipelineLayout = _pipelineLayout;
+    engine->pipelineRegistry.request_graphics(builder, &_pipeline);
+
+    // the cascade costs are only shown, without timestamps they stay at zero
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(engine->_chosenGPU, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(engine->_chosenGPU, &familyCount, families.data());
+
+    uint32_t validBits = families[engine->_graphicsQueueFamily].timestampValidBits;
+    if (validBits > 0) {
+        _timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(engine->_chosenGPU, &properties);
+        _timestampPeriod = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo poolInfo{ .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = frameCount * SHADOW_CASCADES * 2;
+        VK_CHECK(vkCreateQueryPool(device, &poolInfo, nullptr, &_queryPool));
+    }
+}
+
+void ShadowCascades::destroy()
+{
+    VkDevice device = _engine->_device;
+
+    for (FrameBuffers& frame : _frames) {
+        if (frame.instances.buffer != VK_NULL_HANDLE) {
+            _engine->destroy_buffer(frame.instances);
+        }
+    }
+    if (_queryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, _queryPool, nullptr);
+    }
+    vkDestroyPipelineLayout(device, _pipelineLayout, nullptr);
+    for (VkImageView view : _layerViews) {
+        vkDestroyImageView(device, view, nullptr);
+    }
+    _engine->destroy_image(_shadowMap);
+}
+
+void ShadowCascades::read_timestamps(uint32_t frame)
+{
+    FrameBuffers& buffers = _frames[frame];
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        if (!buffers.pending[i]) {
+            continue;
+        }
+        buffers.pending[i] = false;
+
+        uint64_t timestamps[2];
+        uint32_t firstQuery = (frame * SHADOW_CASCADES + i) * 2;
+        VkResult result = vkGetQueryPoolResults(_engine->_device, _queryPool, firstQuery, 2, sizeof(timestamps), timestamps,
+            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS) {
+            continue;
+        }
+
+        float ms = ((timestamps[1] - timestamps[0]) & _timestampMask) * _timestampPeriod / 1000000.f;
+        stats[i].gpuMs = stats[i].gpuMs == 0.f ? ms : stats[i].gpuMs + (ms - stats[i].gpuMs) * SMOOTHING;
+    }
+}
+
+void ShadowCascades::prepare(uint32_t frame, const DrawContext& context, GPUSceneData& sceneData,
+    glm::vec3 cameraPosition, bool sceneChanged)
+{
+    const std::vector<RenderObject>& objects = context.OpaqueSurfaces;
+
+    // the fence of the frame was waited on, its timestamps are in
+    read_timestamps(frame);
+
+    glm::vec3 sunDirection = glm::normalize(glm::vec3(sceneData.sunlightDirection));
+    glm::vec3 up = std::abs(sunDirection.y) > 0.99f ? glm::vec3(0.f, 0.f, 1.f) : glm::vec3(0.f, 1.f, 0.f);
+
+    // half the size of the view at a distance of 1, from the projection scale
+    float tanX = 1.f / std::abs(sceneData.proj[0][0]);
+    float tanY = 1.f / std::abs(sceneData.proj[1][1]);
+    glm::mat4 inverseView = glm::inverse(sceneData.view);
+
+    float splitNear = SHADOW_NEAR;
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        Cascade& cascade = _cascades[i];
+
+        // between even and logarithmic splits, the log ones keep the texel density close to the camera
+        float t = float(i + 1) / SHADOW_CASCADES;
+        float evenSplit = SHADOW_NEAR + (shadowDistance - SHADOW_NEAR) * t;
+        float logSplit = SHADOW_NEAR * std::pow(shadowDistance / SHADOW_NEAR, t);
+        float splitFar = evenSplit + (logSplit - evenSplit) * splitLambda;
+
+        bool cached = cacheDistantCascades && int(i) >= firstCachedCascade;
+
+        glm::vec3 center;
+        float radius;
+        if (cached) {
+            // a sphere around the camera covers every direction it can turn to, the slack
+            // covers moving until the cascade is rendered again
+            radius = splitFar * (1.f + cacheMoveThreshold);
+            cascade.render = !cascade.valid || sceneChanged || cascade.radius != radius
+                || glm::dot(cascade.sunDirection, sunDirection) < 0.9999f
+                || glm::distance(cascade.center, cameraPosition) > splitFar * cacheMoveThreshold;
+            center = cascade.render ? cameraPosition : cascade.center;
+        }
+        else {
+            // sphere around the corners of the slice of the view, its size does not change as the
+            // camera turns so the texels do not swim
+            glm::vec3 corners[8];
+            center = glm::vec3(0.f);
+            for (uint32_t c = 0; c < 8; c++) {
+                float depth = (c & 4) ? splitFar : splitNear;
+                glm::vec4 viewCorner((c & 1 ? 1.f : -1.f) * tanX * depth, (c & 2 ? 1.f : -1.f) * tanY * depth, -depth, 1.f);
+                corners[c] = glm::vec3(inverseView * viewCorner);
+                center += corners[c] / 8.f;
+            }
+            radius = 0.f;
+            for (const glm::vec3& corner : corners) {
+                radius = std::max(radius, glm::distance(corner, center));
+            }
+            radius = std::ceil(radius * 16.f) / 16.f;
+            cascade.render = true;
+        }
+        splitNear = splitFar;
+
+        sceneData.cascadeSplits[i] = splitFar;
+        sceneData.cascadeTexelSizes[i] = 2.f * radius / SHADOW_RESOLUTION;
+        stats[i].rendered = cascade.render;
+
+        if (!cascade.render) {
+            sceneData.shadowMatrices[i] = cascade.viewproj;
+            continue;
+        }
+
+        // reverse-Z like the camera, 1 at the sun and 0 past the far side of the sphere
+        float depthRange = 2.f * radius + casterDistance;
+        glm::mat4 view = glm::lookAt(center + sunDirection * (radius + casterDistance), center, up);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, depthRange, 0.f);
+
+        // moves the cascade in whole texels so the edges of the shadows stay put
+        glm::vec4 origin = projection * view * glm::vec4(0.f, 0.f, 0.f, 1.f);
+        glm::vec2 texels = glm::vec2(origin) * (SHADOW_RESOLUTION / 2.f);
+        glm::vec2 offset = (glm::round(texels) - texels) * (2.f / SHADOW_RESOLUTION);
+        projection[3][0] += offset.x;
+        projection[3][1] += offset.y;
+
+        cascade.viewproj = projection * view;
+        cascade.center = center;
+        cascade.radius = radius;
+        cascade.sunDirection = sunDirection;
+        // a fit to the view slice does not hold once the camera turns
+        cascade.valid = cached;
+        sceneData.shadowMatrices[i] = cascade.viewproj;
+
+        // the objects whose bounding sphere touches the box of the cascade
+        std::vector<uint32_t> visible;
+        for (uint32_t o = 0; o < objects.size(); o++) {
+            const DrawObject& obj = context.objects[objects[o].objectIndex];
+            glm::vec3 lightCenter = view * obj.transform * glm::vec4(obj.bounds.origin, 1.f);
+            float scale = std::max({ glm::length(glm::vec3(obj.transform[0])), glm::length(glm::vec3(obj.transform[1])),
+                glm::length(glm::vec3(obj.transform[2])) });
+            float objRadius = obj.bounds.sphereRadius * scale;
+
+            if (std::abs(lightCenter.x) - objRadius <= radius && std::abs(lightCenter.y) - objRadius <= radius
+                && -lightCenter.z + objRadius >= 0.f && -lightCenter.z - objRadius <= depthRange) {
+                visible.push_back(o);
+            }
+        }
+
+        // copies of the same mesh next to each other, so they become one instanced draw
+        std::sort(visible.begin(), visible.end(), [&](uint32_t iA, uint32_t iB) {
+            const RenderObject& A = objects[iA];
+            const RenderObject& B = objects[iB];
+            return std::tie(A.mesh, A.firstIndex, A.indexCount) < std::tie(B.mesh, B.firstIndex, B.indexCount);
+            });
+
+        cascade.batches.clear();
+        stats[i].objects = static_cast<uint32_t>(visible.size());
+        stats[i].triangles = 0;
+        for (uint32_t v = 0; v < visible.size(); v++) {
+            const RenderObject& obj = objects[visible[v]];
+            stats[i].triangles += obj.indexCount / 3;
+            // the instances read the object buffer, from here on only the object index is needed
+            visible[v] = obj.objectIndex;
+
+            if (!cascade.batches.empty()) {
+                Batch& last = cascade.batches.back();
+                if (last.mesh == obj.mesh && last.firstIndex == obj.firstIndex && last.indexCount == obj.indexCount) {
+                    last.instanceCount++;
+                    continue;
+                }
+            }
+            const GPUMeshBuffers& mesh = _engine->resourceCache.meshData.get(obj.mesh).buffers;
+            cascade.batches.push_back({ mesh.vertexBufferAddress, obj.mesh, mesh.indexBuffer.buffer, obj.firstIndex,
+                obj.indexCount, v, 1 });
+        }
+        cascade.objectIndices = std::move(visible);
+
+        stats[i].draws = static_cast<uint32_t>(cascade.batches.size());
+        stats[i].renderCount++;
+    }
+
+    // the object indices of every cascade drawn this frame, one after the other
+    FrameBuffers& buffers = _frames[frame];
+    uint32_t instanceCount = 0;
+    for (Cascade& cascade : _cascades) {
+        if (cascade.render) {
+            cascade.firstInstance = instanceCount;
+            instanceCount += static_cast<uint32_t>(cascade.objectIndices.size());
+        }
+    }
+    if (instanceCount == 0) {
+        return;
+    }
+
+    // This frame's fence was waited on, nothing else uses its buffer
+    if (buffers.instanceCapacity < instanceCount) {
+        if (buffers.instances.buffer != VK_NULL_HANDLE) {
+            _engine->destroy_buffer(buffers.instances);
+        }
+        buffers.instanceCapacity = std::max(instanceCount, buffers.instanceCapacity * 2);
+        buffers.instances = _engine->create_buffer(buffers.instanceCapacity * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+            MemoryCategory::Transient);
+    }
+
+    uint32_t* instances = (uint32_t*)buffers.instances.info.pMappedData;
+    for (const Cascade& cascade : _cascades) {
+        if (cascade.render) {
+            std::copy(cascade.objectIndices.begin(), cascade.objectIndices.end(), instances + cascade.firstInstance);
+        }
+    }
+}
+
+RGImage ShadowCascades::add_pass(RenderGraph& graph, uint32_t frame)
+{
+    // imported, the cached cascades have to survive between frames
+    RGImage shadowMap = graph.import_image("shadow cascades", _shadowMap.image, _shadowMap.imageView, _shadowMap.imageExtent,
+        _shadowMap.imageFormat);
+
+    graph.add_pass("shadows", { { shadowMap, ImageUsage::DepthAttachment } },
+        [this, frame](VkCommandBuffer cmd) { record(cmd, frame); });
+
+    return shadowMap;
+}
+
+void ShadowCascades::record(VkCommandBuffer cmd, uint32_t frame)
+{
+    FrameBuffers& buffers = _frames[frame];
+    if (_queryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(cmd, _queryPool, frame * SHADOW_CASCADES * 2, SHADOW_CASCADES * 2);
+    }
+
+    PushConstants pushConstants;
+    pushConstants.instanceBuffer = buffers.instances.buffer != VK_NULL_HANDLE ? _engine->get_buffer_address(buffers.instances) : 0;
+    pushConstants.objectBuffer = _engine->_objectBuffer.buffer != VK_NULL_HANDLE ? _engine->get_buffer_address(_engine->_objectBuffer) : 0;
+
+    VkViewport viewport = { 0.f, 0.f, float(SHADOW_RESOLUTION), float(SHADOW_RESOLUTION), 0.f, 1.f };
+    VkRect2D scissor = { { 0, 0 }, { SHADOW_RESOLUTION, SHADOW_RESOLUTION } };
+
+    for (uint32_t i = 0; i < SHADOW_CASCADES; i++) {
+        const Cascade& cascade = _cascades[i];
+        if (!cascade.render) {
+            continue;
+        }
+
+        uint32_t firstQuery = (frame * SHADOW_CASCADES + i) * 2;
+        if (_queryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, _queryPool, firstQuery);
+        }
+
+        // cleared to the far plane, the other layers keep what they hold
+        VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(_layerViews[i], VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        VkRenderingInfo renderInfo = vkinit::rendering_info({ SHADOW_RESOLUTION, SHADOW_RESOLUTION }, nullptr, &depthAttachment);
+        vkCmdBeginRendering(cmd, &renderInfo);
+
+        if (!cascade.batches.empty()) {
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+            vkCmdSetViewport(cmd, 0, 1, &viewport);
+            vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+            pushConstants.viewproj = cascade.viewproj;
+            VkBuffer lastIndexBuffer = VK_NULL_HANDLE;
+            VkDeviceAddress lastVertexBuffer = 0;
+
+            for (const Batch& batch : cascade.batches) {
+                if (batch.indexBuffer != lastIndexBuffer) {
+                    lastIndexBuffer = batch.indexBuffer;
+                    vkCmdBindIndexBuffer(cmd, batch.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                }
+                if (batch.vertexBuffer != lastVertexBuffer) {
+                    lastVertexBuffer = batch.vertexBuffer;
+                    pushConstants.vertexBuffer = batch.vertexBuffer;
+                    vkCmdPushConstants(cmd, _pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstants), &pushConstants);
+                }
+                vkCmdDrawIndexed(cmd, batch.indexCount, batch.instanceCount, batch.firstIndex, 0,
+                    cascade.firstInstance + batch.firstInstance);
+            }
+        }
+
+        vkCmdEndRendering(cmd);
+
+        if (_queryPool != VK_NULL_HANDLE) {
+            vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, _queryPool, firstQuery + 1);
+            buffers.pending[i] = true;
+        }
+    }
+}
@@ -0,0 +1,375 @@
+#include <tv_texture_streaming.h>
+#include <tv_engine.h>
+#include <tv_images.h>
+
+#include <algorithm>
+#include <cmath>
+
+static VkExtent3D mip_extent(VkExtent2D size, uint32_t mip)
+{
+    return VkExtent3D{ std::max(size.width >> mip, 1u), std::max(size.height >> mip, 1u), 1 };
+}
+
+// 2x2 box filter, odd edges reuse their last row or column
+static void downsample(const uint8_t* src, VkExtent3D srcSize, uint8_t* dst, VkExtent3D dstSize)
+{
+    for (uint32_t y = 0; y < dstSize.height; y++) {
+        uint32_t y0 = std::min(y * 2, srcSize.height - 1);
+        uint32_t y1 = std::min(y * 2 + 1, srcSize.height - 1);
+
+        for (uint32_t x = 0; x < dstSize.width; x++) {
+            uint32_t x0 = std::min(x * 2, srcSize.width - 1);
+            uint32_t x1 = std::min(x * 2 + 1, srcSize.width - 1);
+
+            for (uint32_t c = 0; c < 4; c++) {
+                uint32_t sum = src[(y0 * srcSize.width + x0) * 4 + c] + src[(y0 * srcSize.width + x1) * 4 + c]
+                    + src[(y1 * srcSize.width + x0) * 4 + c] + src[(y1 * srcSize.width + x1) * 4 + c];
+                dst[(y * dstSize.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+void TextureStreamer::init(TinyVulkan* engine, WorkerPool* workers)
+{
+    _engine = engine;
+    _workers = workers;
+}
+
+void TextureStreamer::destroy()
+{
+    _workers->wait();
+
+    for (Upload& upload : finished) {
+        _engine->destroy_buffer(upload.staging);
+    }
+    finished.clear();
+
+    for (TextureHandle handle = 0; handle < textures.size(); handle++) {
+        if (textures[handle].alive) {
+            remove_texture(handle);
+        }
+    }
+    textures.clear();
+    materialTextures.clear();
+}
+
+TextureHandle TextureStreamer::add_texture(const uint8_t* pixels, VkExtent2D size)
+{
+    TextureHandle handle = static_cast<TextureHandle>(textures.size());
+
+    Texture texture{};
+    texture.size = size;
+    texture.mipCount = static_cast<uint32_t>(std::floor(std::log2(std::max(size.width, size.height)))) + 1;
+
+    texture.mipOffsets.resize(texture.mipCount + 1);
+    texture.mipOffsets[0] = 0;
+    for (uint32_t mip = 0; mip < texture.mipCount; mip++) {
+        VkExtent3D extent = mip_extent(size, mip);
+        texture.mipOffsets[mip + 1] = texture.mipOffsets[mip] + extent.width * extent.height * 4;
+    }
+
+    texture.baseMip = 0;
+    while (texture.baseMip + 1 < texture.mipCount) {
+        VkExtent3D extent = mip_extent(size, texture.baseMip);
+        if (std::max(extent.width, extent.height) <= residentSize) {
+            break;
+        }
+        texture.baseMip++;
+    }
+
+    // an upload only copies its first mip, the GPU generates the coarser ones
+    texture.mipData.resize(texture.mipOffsets[texture.baseMip + 1]);
+    memcpy(texture.mipData.data(), pixels, texture.mipOffsets[1]);
+    for (uint32_t mip = 1; mip <= texture.baseMip; mip++) {
+        downsample(texture.mipData.data() + texture.mipOffsets[mip - 1], mip_extent(size, mip - 1),
+            texture.mipData.data() + texture.mipOffsets[mip], mip_extent(size, mip));
+    }
+
+    // nothing is resident until the first update swaps in the low mips
+    texture.residentMip = texture.mipCount;
+    texture.wantedMip = texture.baseMip;
+    texture.targetMip = texture.baseMip;
+    texture.lastUsedFrame = currentFrame;
+    texture.alive = true;
+
+    // the low mips are small, they go with the next update together with every texture of the load
+    Upload upload;
+    upload.texture = handle;
+    upload.firstMip = texture.baseMip;
+
+    size_t uploadSize = mip_size(texture, texture.baseMip);
+    upload.staging = _engine->create_buffer(uploadSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+        MemoryCategory::Transient);
+    memcpy(upload.staging.info.pMappedData, texture.mipData.data() + texture.mipOffsets[texture.baseMip], uploadSize);
+
+    committedBytes += chain_size(texture, texture.baseMip);
+    stats.textureCount++;
+    stats.pendingUploads++;
+
+    textures.push_back(std::move(texture));
+
+    std::lock_guard<std::mutex> lock(finishedMutex);
+    finished.push_back(upload);
+    return handle;
+}
+
+void TextureStreamer::remove_texture(TextureHandle handle)
+{
+    Texture& texture = textures[handle];
+
+    // a worker may still be copying out of the mip data
+    if (texture.targetMip != texture.residentMip) {
+        _workers->wait();
+    }
+
+    _engine->destroy_image(texture.image);
+
+    committedBytes -= chain_size(texture, texture.targetMip);
+    stats.residentBytes -= chain_size(texture, texture.residentMip);
+    stats.textureCount--;
+
+    texture.alive = false;
+    texture.image = {};
+    texture.listeners.clear();
+    // the slot stays, so free the pixels now
+    std::vector<uint8_t>().swap(texture.mipData);
+
+    std::replace(materialTextures.begin(), materialTextures.end(), handle, INVALID_TEXTURE);
+}
+
+const AllocatedImage& TextureStreamer::get_image(TextureHandle texture) const
+{
+    // sampled until the first upload lands, the listeners then get the real image
+    if (textures[texture].image.image == VK_NULL_HANDLE) {
+        return _engine->_whiteImage;
+    }
+    return textures[texture].image;
+}
+
+void TextureStreamer::add_listener(TextureHandle texture, MaterialHandle material,
+    std::function<void(VkImageView)>&& listener)
+{
+    textures[texture].listeners.emplace_back(material, std::move(listener));
+}
+
+void TextureStreamer::set_material_texture(MaterialHandle material, TextureHandle texture)
+{
+    if (material.index() >= materialTextures.size()) {
+        materialTextures.resize(material.index() + 1, INVALID_TEXTURE);
+    }
+    materialTextures[material.index()] = texture;
+}
+
+void TextureStreamer::remove_material(MaterialHandle material)
+{
+    if (material.index() >= materialTextures.size() || materialTextures[material.index()] == INVALID_TEXTURE) {
+        return;
+    }
+
+    TextureHandle& texture = materialTextures[material.index()];
+    std::erase_if(textures[texture].listeners, [&](const auto& listener) { return listener.first == material; });
+    // the pool hands the slot out again, to a material that may have no texture
+    texture = INVALID_TEXTURE;
+}
+
+void TextureStreamer::request_material(MaterialHandle material, float screenSize)
+{
+    // a plain array lookup, this runs for every drawn object
+    if (material.index() >= materialTextures.size() || materialTextures[material.index()] == INVALID_TEXTURE) {
+        return;
+    }
+
+    Texture& texture = textures[materialTextures[material.index()]];
+    texture.lastUsedFrame = currentFrame;
+
+    // about one texel per pixel, assuming the uvs span the texture once
+    float texels = static_cast<float>(std::max(texture.size.width, texture.size.height));
+    uint32_t mip = 0;
+    if (screenSize < texels) {
+        mip = static_cast<uint32_t>(std::floor(std::log2(texels / std::max(screenSize, 1.f))));
+    }
+
+    texture.wantedMip = std::min({ texture.wantedMip, texture.baseMip, mip });
+}
+
+void TextureStreamer::update(VkCommandBuffer cmd, uint64_t frameNumber)
+{
+    currentFrame = frameNumber;
+    stats.streamedIn = 0;
+    stats.evicted = 0;
+
+    std::vector<Upload> ready;
+    {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        ready.swap(finished);
+    }
+
+    for (Upload& upload : ready) {
+        stats.pendingUploads--;
+        Texture& texture = textures[upload.texture];
+
+        if (!texture.alive) {
+            _engine->destroy_buffer(upload.staging);
+            continue;
+        }
+
+        AllocatedImage newImage = record_upload(cmd, texture, upload);
+
+        // the frame in flight may still sample the old image
+        AllocatedImage oldImage = texture.image;
+        AllocatedBuffer staging = upload.staging;
+        _engine->deletionQueue.push_image(oldImage);
+        _engine->deletionQueue.push_buffer(staging);
+
+        if (upload.firstMip < texture.residentMip) {
+            stats.streamedIn++;
+        }
+        else {
+            stats.evicted++;
+        }
+        stats.residentBytes += chain_size(texture, upload.firstMip);
+        stats.residentBytes -= chain_size(texture, texture.residentMip);
+
+        texture.image = newImage;
+        texture.residentMip = upload.firstMip;
+        for (auto& [material, listener] : texture.listeners) {
+            listener(newImage.imageView);
+        }
+    }
+
+    // the mips below the copied ones, for every upload of this frame at once. With async compute
+    // cmd runs on the compute queue and the images still have to be handed to the graphics queue
+    FrameData& frame = _engine->get_current_frame();
+    _engine->mipGenerator.record(cmd, frame._frameDescriptors, _engine->deletionQueue, _engine->_asyncCompute);
+
+    size_t budget = static_cast<size_t>(std::max(budgetMB, 0)) * 1024 * 1024;
+
+    // Drops the detail of textures that were not used last frame, oldest first
+    auto evict = [&](size_t bytes) {
+        std::vector<TextureHandle> candidates;
+        for (TextureHandle handle = 0; handle < textures.size(); handle++) {
+            const Texture& texture = textures[handle];
+            if (texture.alive && texture.lastUsedFrame + 1 < currentFrame && texture.targetMip == texture.residentMip
+                && texture.residentMip < texture.baseMip) {
+                candidates.push_back(handle);
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [&](TextureHandle a, TextureHandle b) {
+            return textures[a].lastUsedFrame < textures[b].lastUsedFrame;
+            });
+
+        size_t freed = 0;
+        for (TextureHandle handle : candidates) {
+            if (freed >= bytes) {
+                break;
+            }
+            const Texture& texture = textures[handle];
+            freed += chain_size(texture, texture.residentMip) - chain_size(texture, texture.baseMip);
+            start_upload(handle, texture.baseMip);
+        }
+        };
+
+    std::vector<TextureHandle> requests;
+    for (TextureHandle handle = 0; handle < textures.size(); handle++) {
+        const Texture& texture = textures[handle];
+        if (texture.alive && texture.targetMip == texture.residentMip && texture.wantedMip < texture.residentMip) {
+            requests.push_back(handle);
+        }
+    }
+
+    // the textures furthest from the detail they need go first
+    std::sort(requests.begin(), requests.end(), [&](TextureHandle a, TextureHandle b) {
+        return textures[a].residentMip - textures[a].wantedMip > textures[b].residentMip - textures[b].wantedMip;
+        });
+
+    uint32_t started = 0;
+    for (TextureHandle handle : requests) {
+        if (started == maxUploadsPerFrame) {
+            break;
+        }
+
+        const Texture& texture = textures[handle];
+        size_t residentBytes = chain_size(texture, texture.residentMip);
+
+        uint32_t mip = texture.wantedMip;
+        if (committedBytes + chain_size(texture, mip) - residentBytes > budget) {
+            evict(committedBytes + chain_size(texture, mip) - residentBytes - budget);
+        }
+        // settle for less detail when the evictions did not free enough
+        while (mip < texture.residentMip && committedBytes + chain_size(texture, mip) - residentBytes > budget) {
+            mip++;
+        }
+
+        if (mip < texture.residentMip) {
+            start_upload(handle, mip);
+            started++;
+        }
+    }
+
+    // collect the requests of the frame about to be drawn
+    for (Texture& texture : textures) {
+        texture.wantedMip = texture.baseMip;
+    }
+}
+
+size_t TextureStreamer::chain_size(const Texture& texture, uint32_t firstMip) const
+{
+    return texture.mipOffsets[texture.mipCount] - texture.mipOffsets[firstMip];
+}
+
+size_t TextureStreamer::mip_size(const Texture& texture, uint32_t mip) const
+{
+    return texture.mipOffsets[mip + 1] - texture.mipOffsets[mip];
+}
+
+void TextureStreamer::start_upload(TextureHandle handle, uint32_t firstMip)
+{
+    Texture& texture = textures[handle];
+
+    committedBytes += chain_size(texture, firstMip);
+    committedBytes -= chain_size(texture, texture.residentMip);
+    texture.targetMip = firstMip;
+    stats.pendingUploads++;
+
+    // the pixel storage never moves while the texture is alive
+    const uint8_t* data = texture.mipData.data() + texture.mipOffsets[firstMip];
+    size_t size = mip_size(texture, firstMip);
+
+    _workers->submit([this, handle, firstMip, data, size]() {
+        Upload upload;
+        upload.texture = handle;
+        upload.firstMip = firstMip;
+        upload.staging = _engine->create_buffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU,
+            MemoryCategory::Transient);
+        memcpy(upload.staging.info.pMappedData, data, size);
+
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished.push_back(upload);
+        });
+}
+
+AllocatedImage TextureStreamer::record_upload(VkCommandBuffer cmd, const Texture& texture, const Upload& upload)
+{
+    AllocatedImage image = _engine->create_image(mip_extent(texture.size, upload.firstMip), VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT, true);
+
+    vkutil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkBufferImageCopy copyRegion = {};
+    copyRegion.bufferOffset = 0;
+
+    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copyRegion.imageSubresource.mipLevel = 0;
+    copyRegion.imageSubresource.baseArrayLayer = 0;
+    copyRegion.imageSubresource.layerCount = 1;
+    copyRegion.imageExtent = mip_extent(texture.size, upload.firstMip);
+
+    vkCmdCopyBufferToImage(cmd, upload.staging.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+    // update() records the mip generation of all the uploads, which leaves them ready for sampling
+    _engine->mipGenerator.add(image);
+
+    return image;
+}